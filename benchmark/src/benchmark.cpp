@@ -1,27 +1,62 @@
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <random>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
 #include <benchmark/benchmark.h>
 
 #include "../../src/include/kbtree.h"
+#include "../../src/include/kbtree_static.h"
+#include "../../src/include/kbtree_wide.h"
+#include "../../src/include/kbtree_atomic.h"
+#include "../../src/include/kmagazine.h"
+#include "../../src/include/kquarantine.h"
+#include "../../src/include/kgeneration.h"
+#include "../../src/include/kshard.h"
 #include "../../src/include/kvector.h"
 #include "../../src/include/kbset.h"
 #include "../../src/include/kset_inc.h"
 #include "../../src/include/kset_dec.h"
+#include "../../src/include/kveb.h"
+#include "../../src/include/kscan.h"
+#include "../../src/include/kjournal.h"
 
 // passed as a define, for example: -DBMARK_TEST_SIZE=1048576
 constexpr uint32_t bmark_test_size = BMARK_TEST_SIZE;
 constexpr uint32_t bmark_last_id = bmark_test_size - 1;
 
+// multi-threaded benchmarks run with 1, 2, 4, ... up to the number of cores
+static const int bmark_max_threads = std::max(1U, std::thread::hardware_concurrency());
+
+// all IDs used but the last one
+template <typename T>
+static void set_up_used(T& id_factory) {
+    for (uint32_t i = 0; i < bmark_test_size; ++i) {
+        id_factory.use_id(i);
+    }
+
+    id_factory.free_id(bmark_last_id);
+}
+
+// a data word at a time
+static void set_up_used(kupid::kbtree& id_factory) {
+    id_factory.use_range(0, bmark_last_id);
+}
+
 template <typename T>
 class KFactory : public ::benchmark::Fixture {
     public:
         KFactory() : _id_factory{bmark_test_size} {};
 
         void SetUp(const ::benchmark::State& state) {
-            for (uint32_t i = 0; i < bmark_test_size; ++i) {
-                _id_factory.use_id(i);
-            }
-
-            _id_factory.free_id(bmark_last_id);
+            set_up_used(_id_factory);
         }
 
         void TearDown(const ::benchmark::State& state) {
@@ -37,11 +72,7 @@ template <>
 class KFactory<kbset_factory> : public ::benchmark::Fixture {
     public:
         void SetUp(const ::benchmark::State& state) {
-            for (uint32_t i = 0; i < bmark_test_size; ++i) {
-                _id_factory.use_id(i);
-            }
-
-            _id_factory.free_id(bmark_last_id);
+            set_up_used(_id_factory);
         }
 
         void TearDown(const ::benchmark::State& state) {
@@ -51,6 +82,22 @@ class KFactory<kbset_factory> : public ::benchmark::Fixture {
         kbset_factory _id_factory;
 };
 
+using kbtree_static_factory = kupid::kbtree_static<bmark_test_size>;
+
+template <>
+class KFactory<kbtree_static_factory> : public ::benchmark::Fixture {
+    public:
+        void SetUp(const ::benchmark::State& state) {
+            set_up_used(_id_factory);
+        }
+
+        void TearDown(const ::benchmark::State& state) {
+            _id_factory.clear();
+        }
+
+        kbtree_static_factory _id_factory;
+};
+
 // print size and id
 
 static void print_info() {
@@ -79,75 +126,1253 @@ BENCHMARK_REGISTER_F(benchmark_kbtree, test_kbtree);
 #endif
 
 // -----------------------------------------------------------------------------
-// kupid::kvector
+// kupid::kbtree_static<size>
 
-using benchmark_kvector = KFactory<kupid::kvector>;
+using benchmark_kbtree_static = KFactory<kbtree_static_factory>;
 
-BENCHMARK_DEFINE_F(benchmark_kvector, test_kvector)(benchmark::State& state) {
-    uint32_t id;
+BENCHMARK_DEFINE_F(benchmark_kbtree_static, test_kbtree_static)(benchmark::State& state) {
+    int64_t id;
     while (state.KeepRunning()) {
         benchmark::DoNotOptimize(id = _id_factory.next(false));
     }
 }
 
+// free and use the last ID: set_id_state() walks every layer
+BENCHMARK_DEFINE_F(benchmark_kbtree_static, test_kbtree_static_use_id)(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        _id_factory.use_id(bmark_last_id);
+        _id_factory.free_id(bmark_last_id);
+    }
+}
+
+BENCHMARK_DEFINE_F(benchmark_kbtree, test_kbtree_use_id)(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        _id_factory.use_id(bmark_last_id);
+        _id_factory.free_id(bmark_last_id);
+    }
+}
+
 #ifdef UNIT_MS
-BENCHMARK_REGISTER_F(benchmark_kvector, test_kvector)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(benchmark_kbtree_static, test_kbtree_static)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(benchmark_kbtree_static, test_kbtree_static_use_id)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(benchmark_kbtree, test_kbtree_use_id)->Unit(benchmark::kMillisecond);
 #else
-BENCHMARK_REGISTER_F(benchmark_kvector, test_kvector);
+BENCHMARK_REGISTER_F(benchmark_kbtree_static, test_kbtree_static);
+BENCHMARK_REGISTER_F(benchmark_kbtree_static, test_kbtree_static_use_id);
+BENCHMARK_REGISTER_F(benchmark_kbtree, test_kbtree_use_id);
 #endif
 
 // -----------------------------------------------------------------------------
-// kupid::kbset<size>
+// kupid::kbtree64
 
-using benchmark_kbset = KFactory<kupid::kbset<bmark_test_size>>;
+using benchmark_kbtree64 = KFactory<kupid::kbtree64>;
 
-BENCHMARK_DEFINE_F(benchmark_kbset, test_kbset)(benchmark::State& state) {
-    uint32_t id;
+BENCHMARK_DEFINE_F(benchmark_kbtree64, test_kbtree64)(benchmark::State& state) {
+    int64_t id;
     while (state.KeepRunning()) {
         benchmark::DoNotOptimize(id = _id_factory.next(false));
     }
 }
 
 #ifdef UNIT_MS
-BENCHMARK_REGISTER_F(benchmark_kbset, test_kbset)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(benchmark_kbtree64, test_kbtree64)->Unit(benchmark::kMillisecond);
 #else
-BENCHMARK_REGISTER_F(benchmark_kbset, test_kbset);
+BENCHMARK_REGISTER_F(benchmark_kbtree64, test_kbtree64);
 #endif
 
 // -----------------------------------------------------------------------------
-// kupid::kset_inc
+// kupid::kbtree - batch admission: next_n() vs. a loop of next()
 
-using benchmark_kset_inc = KFactory<kupid::kset_inc>;
+constexpr uint32_t bmark_batch_size = bmark_test_size < 10000 ? bmark_test_size : 10000;
+
+static void test_kbtree_next_loop(benchmark::State& state) {
+    kupid::kbtree id_factory{bmark_test_size};
+    std::vector<uint32_t> ids(bmark_batch_size);
 
-BENCHMARK_DEFINE_F(benchmark_kset_inc, kset_inc)(benchmark::State& state) {
-    uint32_t id;
     while (state.KeepRunning()) {
-        benchmark::DoNotOptimize(id = _id_factory.next(false));
+        for (uint32_t i = 0; i < bmark_batch_size; ++i) {
+            ids[i] = id_factory.next();
+        }
+
+        benchmark::DoNotOptimize(ids.data());
+
+        state.PauseTiming();
+        id_factory.clear();
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * bmark_batch_size);
+}
+
+static void test_kbtree_next_n(benchmark::State& state) {
+    kupid::kbtree id_factory{bmark_test_size};
+    std::vector<uint32_t> ids(bmark_batch_size);
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id_factory.next_n(bmark_batch_size, ids.data()));
+
+        state.PauseTiming();
+        id_factory.clear();
+        state.ResumeTiming();
     }
+
+    state.SetItemsProcessed(state.iterations() * bmark_batch_size);
 }
 
 #ifdef UNIT_MS
-BENCHMARK_REGISTER_F(benchmark_kset_inc, kset_inc)->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_next_loop)->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_next_n)->Unit(benchmark::kMillisecond);
 #else
-BENCHMARK_REGISTER_F(benchmark_kset_inc, kset_inc);
+BENCHMARK(test_kbtree_next_loop);
+BENCHMARK(test_kbtree_next_n);
 #endif
 
 // -----------------------------------------------------------------------------
-// kupid::kset_dec
+// kupid::kbtree - first run of free IDs: next_range() vs. a scan of the data layer
 
-using benchmark_kset_dec = KFactory<kupid::kset_dec>;
+// every 100th ID of the first 3/4 is used, a run longer than 99 IDs lies in the last quarter
+constexpr uint32_t bmark_range_size = bmark_test_size / 4 < 200 ? bmark_test_size / 4 : 200;
 
-BENCHMARK_DEFINE_F(benchmark_kset_dec, kset_dec)(benchmark::State& state) {
-    uint32_t id;
+static void set_up_range(kupid::kbtree& id_factory) {
+    for (uint32_t i = 0; i < bmark_test_size / 4 * 3; i += 100) {
+        id_factory.use_id(i);
+    }
+}
+
+static void test_kbtree_next_range(benchmark::State& state) {
+    kupid::kbtree id_factory{bmark_test_size};
+    set_up_range(id_factory);
+
+    int64_t id;
     while (state.KeepRunning()) {
-        benchmark::DoNotOptimize(id = _id_factory.next(false));
+        benchmark::DoNotOptimize(id = id_factory.next_range(bmark_range_size, false));
+    }
+}
+
+static void test_kbtree_scan_range(benchmark::State& state) {
+    kupid::kbtree id_factory{bmark_test_size};
+    set_up_range(id_factory);
+
+    int64_t id;
+    while (state.KeepRunning()) {
+        uint32_t run = 0;
+        id = -1;
+
+        for (uint32_t i = 0; i < bmark_test_size; ++i) {
+            run = id_factory.is_using(i) ? 0 : run + 1;
+
+            if (run == bmark_range_size) {
+                id = i + 1 - bmark_range_size;
+                break;
+            }
+        }
+
+        benchmark::DoNotOptimize(id);
+    }
+}
+
+// a used tree with a free run at its end, arg: size, the full subtrees before it are skipped from their summaries
+static void test_kbtree_next_range_end(benchmark::State& state) {
+    uint32_t size = static_cast<uint32_t>(state.range(0));
+    kupid::kbtree id_factory{size};
+    id_factory.use_range(0, size - 1000);
+
+    int64_t id;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id = id_factory.next_range(1000, false));
     }
 }
 
+BENCHMARK(test_kbtree_next_range_end)->Arg(1 << 20)->Arg(1 << 24)->Arg(1 << 28);
+
 #ifdef UNIT_MS
-BENCHMARK_REGISTER_F(benchmark_kset_dec, kset_dec)->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_next_range)->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_scan_range)->Unit(benchmark::kMillisecond);
 #else
-BENCHMARK_REGISTER_F(benchmark_kset_dec, kset_dec);
+BENCHMARK(test_kbtree_next_range);
+BENCHMARK(test_kbtree_scan_range);
+#endif
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - marking 16M IDs used: use_range() vs. a loop of use_id()
+
+static void test_kbtree_use_id_loop(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+
+    while (state.KeepRunning()) {
+        for (uint32_t i = 0; i < id_factory.size(); ++i) {
+            id_factory.use_id(i);
+        }
+
+        state.PauseTiming();
+        id_factory.clear();
+        state.ResumeTiming();
+    }
+
+    state.SetBytesProcessed(state.iterations() * (id_factory.size() / 8));
+}
+
+static void test_kbtree_use_range(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+
+    while (state.KeepRunning()) {
+        id_factory.use_range(0, id_factory.size());
+
+        state.PauseTiming();
+        id_factory.clear();
+        state.ResumeTiming();
+    }
+
+    state.SetBytesProcessed(state.iterations() * (id_factory.size() / 8));
+}
+
+BENCHMARK(test_kbtree_use_id_loop)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_use_range)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+
+// -----------------------------------------------------------------------------
+// bulk construction from a sorted list of used IDs or a preset vs. a loop of use_id()
+
+// every ID but each 10th is used
+static std::vector<uint32_t> get_used_ids(uint32_t size) {
+    std::vector<uint32_t> used;
+    used.reserve(size);
+
+    for (uint32_t i = 0; i < size; ++i) {
+        if (i % 10 != 9) {
+            used.push_back(i);
+        }
+    }
+
+    return used;
+}
+
+template <typename T>
+static void test_build_use_id(benchmark::State& state) {
+    uint32_t size = state.range(0);
+    std::vector<uint32_t> used = get_used_ids(size);
+
+    while (state.KeepRunning()) {
+        T id_factory{size};
+
+        for (uint32_t id : used) {
+            id_factory.use_id(id);
+        }
+
+        benchmark::DoNotOptimize(id_factory.next(false));
+    }
+}
+
+template <typename T>
+static void test_build_sorted(benchmark::State& state) {
+    uint32_t size = state.range(0);
+    std::vector<uint32_t> used = get_used_ids(size);
+
+    while (state.KeepRunning()) {
+        T id_factory{size, used};
+        benchmark::DoNotOptimize(id_factory.next(false));
+    }
+}
+
+template <typename T>
+static void test_build_all_used(benchmark::State& state) {
+    uint32_t size = state.range(0);
+
+    while (state.KeepRunning()) {
+        T id_factory{size, kupid::kpreset::all_used};
+        benchmark::DoNotOptimize(id_factory.next(false));
+    }
+}
+
+BENCHMARK_TEMPLATE(test_build_use_id, kupid::kbtree)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_sorted, kupid::kbtree)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_all_used, kupid::kbtree)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_use_id, kupid::kbtree_wide)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_sorted, kupid::kbtree_wide)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_use_id, kupid::kbtree_atomic)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_sorted, kupid::kbtree_atomic)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_use_id, kupid::kveb)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_sorted, kupid::kveb)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_use_id, kupid::kvector)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_sorted, kupid::kvector)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_use_id, kupid::kset_dec)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(test_build_sorted, kupid::kset_dec)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree in a file - reopen after a clean close vs. after a crash
+
+static const std::string bmark_file_path = "/tmp/kupid_bmark_kbtree.bin";
+
+// the state word of the file header, at offset 32
+static void set_file_dirty() {
+    std::fstream file{bmark_file_path, std::ios::in | std::ios::out | std::ios::binary};
+    uint32_t state = 2;
+    file.seekp(32);
+    file.write(reinterpret_cast<const char*>(&state), sizeof(state));
+}
+
+static void test_kbtree_file_reopen(benchmark::State& state) {
+    uint32_t size = state.range(0);
+    bool is_dirty = state.range(1);
+
+    std::remove(bmark_file_path.c_str());
+    kupid::kbtree{size, bmark_file_path}.use_range(0, size / 2);
+
+    while (state.KeepRunning()) {
+        if (is_dirty) {
+            state.PauseTiming();
+            set_file_dirty();
+            state.ResumeTiming();
+        }
+
+        kupid::kbtree id_factory{size, bmark_file_path};
+        benchmark::DoNotOptimize(id_factory.next(false));
+    }
+
+    std::remove(bmark_file_path.c_str());
+}
+
+BENCHMARK(test_kbtree_file_reopen)->Args({1 << 24, 0})->Args({1 << 24, 1})->Unit(benchmark::kMillisecond);
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - next() and free_id() without a journal, and with a journal by fsync policy
+
+static const std::string bmark_journal_path = "/tmp/kupid_bmark.log";
+
+// arg 1: -1 no journal, 0 fsync_policy::none, 1 fsync_policy::commit, 2 fsync_policy::interval
+static void test_kbtree_journal(benchmark::State& state) {
+    uint32_t size = state.range(0);
+    int policy = state.range(1);
+
+    kupid::kbtree id_factory{size};
+    std::unique_ptr<kupid::kjournal> journal;
+
+    std::remove(bmark_journal_path.c_str());
+
+    if (policy >= 0) {
+        kupid::kjournal::options options;
+        options.policy = static_cast<kupid::kjournal::fsync_policy>(policy);
+        journal.reset(new kupid::kjournal{bmark_journal_path.c_str(), options});
+        id_factory.attach(journal.get());
+    }
+
+    // a ring of live IDs, the oldest one is freed for each new one
+    std::vector<uint32_t> live(1024);
+
+    for (auto& id : live) {
+        id = id_factory.next();
+    }
+
+    size_t index = 0;
+    while (state.KeepRunning()) {
+        id_factory.free_id(live[index]);
+        live[index] = id_factory.next();
+        index = (index + 1) % live.size();
+    }
+
+    if (journal) {
+        journal->commit();
+    }
+
+    state.SetItemsProcessed(state.iterations() * 2);
+
+    id_factory.attach(nullptr);
+    journal.reset();
+    std::remove(bmark_journal_path.c_str());
+}
+
+BENCHMARK(test_kbtree_journal)->Args({1 << 20, -1})->Args({1 << 20, 0})->Args({1 << 20, 1})->Args({1 << 20, 2});
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - iteration over the used IDs by occupancy: is_using() of every ID,
+// for_each_used(), the used_ids() view and export_used()
+
+// arg 1: used IDs per mille, scattered
+static void set_up_occupancy(kupid::kbtree& id_factory, uint32_t per_mille) {
+    std::mt19937 rnd_factory{787350};
+
+    for (uint32_t id = 0; id < id_factory.size(); ++id) {
+        if (rnd_factory() % 1000 < per_mille) {
+            id_factory.use_id(id);
+        }
+    }
+}
+
+static void test_kbtree_is_using_loop(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+
+    while (state.KeepRunning()) {
+        uint64_t sum = 0;
+
+        for (uint32_t id = 0; id < id_factory.size(); ++id) {
+            if (id_factory.is_using(id)) {
+                sum += id;
+            }
+        }
+
+        benchmark::DoNotOptimize(sum);
+    }
+}
+
+static void test_kbtree_for_each_used(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+
+    while (state.KeepRunning()) {
+        uint64_t sum = 0;
+        id_factory.for_each_used([&sum](uint32_t id) { sum += id; });
+        benchmark::DoNotOptimize(sum);
+    }
+}
+
+static void test_kbtree_used_ids(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+
+    while (state.KeepRunning()) {
+        uint64_t sum = 0;
+
+        for (auto id : id_factory.used_ids()) {
+            sum += id;
+        }
+
+        benchmark::DoNotOptimize(sum);
+    }
+}
+
+static void test_kbtree_export_used(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+    std::vector<uint32_t> ids(id_factory.size());
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id_factory.export_used(ids.data(), ids.size()));
+    }
+}
+
+BENCHMARK(test_kbtree_is_using_loop)->Args({1 << 24, 1})->Args({1 << 24, 500})->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_for_each_used)->Args({1 << 24, 1})->Args({1 << 24, 500})->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_used_ids)->Args({1 << 24, 1})->Args({1 << 24, 500})->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_export_used)->Args({1 << 24, 1})->Args({1 << 24, 500})->Unit(benchmark::kMillisecond);
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - free IDs: the count kept by every change of state,
+// against a count of the used IDs by for_each_used()
+
+static void test_kbtree_free_count(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id_factory.free_count());
+    }
+}
+
+static void test_kbtree_free_count_scan(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+
+    while (state.KeepRunning()) {
+        uint32_t used = 0;
+        id_factory.for_each_used([&used](uint32_t) { ++used; });
+        benchmark::DoNotOptimize(id_factory.size() - used);
+    }
+}
+
+BENCHMARK(test_kbtree_free_count)->Args({1 << 24, 1})->Args({1 << 24, 500});
+BENCHMARK(test_kbtree_free_count_scan)->Args({1 << 24, 1})->Args({1 << 24, 500});
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - rank and select of random IDs, with the used counts clean,
+// and after a use_id() and a free_id() which make a block and the counts above it modified
+
+static void test_kbtree_rank_used(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+    std::mt19937 rnd_factory{787350};
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id_factory.rank_used(rnd_factory() % id_factory.size()));
+    }
+}
+
+static void test_kbtree_select_used(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+    std::mt19937 rnd_factory{787350};
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id_factory.select_used(rnd_factory() % id_factory.used_count()));
+    }
+}
+
+static void test_kbtree_select_free(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+    std::mt19937 rnd_factory{787350};
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id_factory.select_free(rnd_factory() % id_factory.free_count()));
+    }
+}
+
+static void test_kbtree_rank_modified(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+    std::mt19937 rnd_factory{787350};
+
+    while (state.KeepRunning()) {
+        uint32_t id = rnd_factory() % id_factory.size();
+
+        // the state of the ID is restored
+        if (id_factory.is_using(id)) {
+            id_factory.free_id(id);
+            id_factory.use_id(id);
+        } else {
+            id_factory.use_id(id);
+            id_factory.free_id(id);
+        }
+        benchmark::DoNotOptimize(id_factory.rank_used(rnd_factory() % id_factory.size()));
+    }
+}
+
+BENCHMARK(test_kbtree_rank_used)->Args({1 << 24, 1})->Args({1 << 24, 500});
+BENCHMARK(test_kbtree_select_used)->Args({1 << 24, 1})->Args({1 << 24, 500});
+BENCHMARK(test_kbtree_select_free)->Args({1 << 24, 1})->Args({1 << 24, 500});
+BENCHMARK(test_kbtree_rank_modified)->Args({1 << 24, 1})->Args({1 << 24, 500});
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - growth from 2^24 to 2^25 IDs by occupancy: resize() past the capacity,
+// resize() within a reserved capacity, and a new tree with every used ID replayed
+
+static void test_kbtree_resize_grow(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        kupid::kbtree id_factory{1 << 24};
+        set_up_occupancy(id_factory, state.range(0));
+        state.ResumeTiming();
+
+        id_factory.resize(1 << 25);
+        benchmark::DoNotOptimize(id_factory.next(false));
+    }
+}
+
+static void test_kbtree_resize_reserved(benchmark::State& state) {
+    kupid::kbtree id_factory{1 << 24};
+    set_up_occupancy(id_factory, state.range(0));
+    id_factory.reserve(1 << 25);
+
+    while (state.KeepRunning()) {
+        id_factory.resize(1 << 25);
+        id_factory.resize(1 << 24);
+    }
+}
+
+static void test_kbtree_resize_replay(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        kupid::kbtree id_factory{1 << 24};
+        set_up_occupancy(id_factory, state.range(0));
+        state.ResumeTiming();
+
+        kupid::kbtree grown{1 << 25};
+        id_factory.for_each_used([&grown](uint32_t id) { grown.use_id(id); });
+        benchmark::DoNotOptimize(grown.next(false));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - a pool of 2^32 - 1 IDs: construction and arg 1 IDs taken by next(),
+// with the resident MB after them, then a clear() of the pool up to its high-water mark
+
+static double get_resident_mb() {
+    std::ifstream statm{"/proc/self/statm"};
+    size_t pages = 0;
+    size_t resident = 0;
+    statm >> pages >> resident;
+    return resident * 4096.0 / (1024 * 1024);
+}
+
+static void test_kbtree_lazy_start(benchmark::State& state) {
+    double resident = 0;
+
+    while (state.KeepRunning()) {
+        double before = get_resident_mb();
+        kupid::kbtree id_factory{UINT32_MAX};
+
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            id_factory.next();
+        }
+
+        resident = get_resident_mb() - before;
+    }
+
+    state.counters["RSS_MB"] = resident;
+}
+
+static void test_kbtree_lazy_clear(benchmark::State& state) {
+    kupid::kbtree id_factory{UINT32_MAX};
+
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        std::vector<uint32_t> ids(state.range(0));
+        id_factory.next_n(ids.size(), ids.data());
+        state.ResumeTiming();
+
+        id_factory.clear();
+    }
+}
+
+BENCHMARK(test_kbtree_lazy_start)->Arg(0)->Arg(1 << 20)->Arg(1 << 24)->Iterations(3)->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_lazy_clear)->Arg(1 << 10)->Arg(1 << 20)->Arg(1 << 24)->Unit(benchmark::kMicrosecond);
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - a pool of 2^32 - 1 IDs with arg 1 random IDs used, the high-water mark
+// near the end of the pool, then a clear() down the "any used" layers
+
+static void test_kbtree_sparse_clear(benchmark::State& state) {
+    kupid::kbtree id_factory{UINT32_MAX};
+    std::mt19937 rnd_factory{787350};
+    std::vector<uint32_t> ids(state.range(0));
+
+    for (uint32_t& id : ids) {
+        id = rnd_factory() % UINT32_MAX;
+    }
+
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        for (uint32_t id : ids) {
+            id_factory.use_id(id);
+        }
+        state.ResumeTiming();
+
+        id_factory.clear();
+    }
+}
+
+BENCHMARK(test_kbtree_sparse_clear)->Arg(16)->Arg(1 << 10)->Arg(1 << 16)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(test_kbtree_resize_grow)->Arg(1)->Arg(500)->Iterations(10)->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_resize_reserved)->Arg(1)->Arg(500);
+BENCHMARK(test_kbtree_resize_replay)->Arg(1)->Arg(500)->Iterations(10)->Unit(benchmark::kMillisecond);
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - round-robin next_from() the last ID on, and next_in_range() of 16 partitions,
+// vs. a scan of is_using() in a partition, the state of the IDs is restored
+
+static void test_kbtree_next_from(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+    uint32_t hint = 0;
+
+    while (state.KeepRunning()) {
+        int64_t id = id_factory.next_from(hint);
+        id_factory.free_id(id);
+        hint = id + 1;
+    }
+}
+
+static void test_kbtree_next_in_range(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+    uint32_t part_size = id_factory.size() / 16;
+    uint32_t part = 0;
+
+    while (state.KeepRunning()) {
+        uint32_t low = part * part_size;
+        benchmark::DoNotOptimize(id_factory.next_in_range(low, low + part_size, false));
+        part = (part + 1) % 16;
+    }
+}
+
+static void test_kbtree_next_in_range_scan(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_occupancy(id_factory, state.range(1));
+    uint32_t part_size = id_factory.size() / 16;
+    uint32_t part = 0;
+
+    while (state.KeepRunning()) {
+        uint32_t low = part * part_size;
+        int64_t id = -1;
+
+        for (uint32_t i = low; i < low + part_size; ++i) {
+            if (!id_factory.is_using(i)) {
+                id = i;
+                break;
+            }
+        }
+
+        benchmark::DoNotOptimize(id);
+        part = (part + 1) % 16;
+    }
+}
+
+BENCHMARK(test_kbtree_next_from)->Args({1 << 24, 500})->Args({1 << 24, 999});
+BENCHMARK(test_kbtree_next_in_range)->Args({1 << 24, 500})->Args({1 << 24, 999});
+BENCHMARK(test_kbtree_next_in_range_scan)->Args({1 << 24, 500})->Args({1 << 24, 999});
+
+// -----------------------------------------------------------------------------
+// kupid::kquarantine - churn of 4096 live IDs among 2^20, the oldest one is freed and a new one taken,
+// arg 1: capacity, 0 passes free_id() through to the tree, arg 2: delay in operations,
+// bytes per held ID of the ring, its stamps and the set of the held IDs
+
+static void test_kquarantine_churn(benchmark::State& state) {
+    kupid::kbtree id_factory{1 << 20};
+    kupid::kquarantine<uint32_t> quarantine{id_factory, static_cast<uint32_t>(state.range(0)),
+                                            static_cast<uint64_t>(state.range(1))};
+    std::vector<uint32_t> live(4096);
+    size_t oldest = 0;
+
+    for (auto& id : live) {
+        id = quarantine.next();
+    }
+
+    while (state.KeepRunning()) {
+        quarantine.free_id(live[oldest]);
+        live[oldest] = quarantine.next();
+        oldest = (oldest + 1) % live.size();
+    }
+
+    if (quarantine.capacity() > 0) {
+        state.counters["bytes_per_id"] = static_cast<double>(quarantine.get_bytes()) / quarantine.capacity();
+    }
+}
+
+BENCHMARK(test_kquarantine_churn)->Args({0, 0})->Args({4096, 1024})->Args({65536, 32768});
+
+// -----------------------------------------------------------------------------
+// kupid::kgeneration - validation of random handles of a full factory,
+// vs. a kbtree with the generations in a hash map, and a free and next() of a random handle
+
+static void test_kgeneration_validate(benchmark::State& state) {
+    kupid::kgeneration<> id_factory{static_cast<uint32_t>(state.range(0))};
+    std::vector<uint64_t> handles(id_factory.size());
+    std::mt19937 rnd_factory{787350};
+
+    for (auto& handle : handles) {
+        handle = id_factory.next();
+    }
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id_factory.validate(handles[rnd_factory() % handles.size()]));
+    }
+}
+
+static void test_kgeneration_validate_map(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    std::unordered_map<uint32_t, uint16_t> gens;
+    std::vector<uint64_t> handles(id_factory.size());
+    std::mt19937 rnd_factory{787350};
+
+    for (auto& handle : handles) {
+        uint32_t id = id_factory.next();
+        handle = (uint64_t{++gens[id]} << 32) | id;
+    }
+
+    while (state.KeepRunning()) {
+        uint64_t handle = handles[rnd_factory() % handles.size()];
+        auto it = gens.find(static_cast<uint32_t>(handle));
+        benchmark::DoNotOptimize(it != gens.end() && it->second == handle >> 32);
+    }
+}
+
+static void test_kgeneration_churn(benchmark::State& state) {
+    kupid::kgeneration<> id_factory{static_cast<uint32_t>(state.range(0))};
+    std::vector<uint64_t> handles(id_factory.size());
+    std::mt19937 rnd_factory{787350};
+
+    for (auto& handle : handles) {
+        handle = id_factory.next();
+    }
+
+    while (state.KeepRunning()) {
+        uint64_t& handle = handles[rnd_factory() % handles.size()];
+        id_factory.free(handle);
+        handle = id_factory.next();
+    }
+}
+
+BENCHMARK(test_kgeneration_validate)->Arg(1 << 20)->Arg(1 << 24);
+BENCHMARK(test_kgeneration_validate_map)->Arg(1 << 20)->Arg(1 << 24);
+BENCHMARK(test_kgeneration_churn)->Arg(1 << 20)->Arg(1 << 24);
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - serialize() and deserialize() round trip by occupancy,
+// bytes/s of the data layer and compression ratio: data layer bytes / serialized bytes
+
+// arg 1: used IDs per mille, arg 2: 0 scattered IDs, 1 runs of 256 IDs
+static void test_kbtree_serialize(benchmark::State& state) {
+    uint32_t size = state.range(0);
+    uint32_t per_mille = state.range(1);
+    bool is_clustered = state.range(2);
+
+    kupid::kbtree id_factory{size};
+    kupid::kbtree copy{size};
+    std::mt19937 rnd_factory{787350};
+
+    for (uint32_t first = 0; first < size; first += 256) {
+        if (is_clustered) {
+            if (rnd_factory() % 1000 < per_mille) {
+                id_factory.use_range(first, std::min(256U, size - first));
+            }
+        } else {
+            for (uint32_t id = first; id < std::min(first + 256, size); ++id) {
+                if (rnd_factory() % 1000 < per_mille) {
+                    id_factory.use_id(id);
+                }
+            }
+        }
+    }
+
+    size_t bytes = 0;
+    while (state.KeepRunning()) {
+        std::vector<uint8_t> data = id_factory.serialize();
+        benchmark::DoNotOptimize(copy.deserialize(data.data(), data.size()));
+        bytes = data.size();
+    }
+
+    state.SetBytesProcessed(state.iterations() * (size / 8));
+    state.counters["ratio"] = static_cast<double>(size / 8) / bytes;
+}
+
+BENCHMARK(test_kbtree_serialize)->ArgsProduct({{1 << 24}, {1, 10, 100, 500, 990}, {0, 1}})
+                                ->Unit(benchmark::kMillisecond);
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree - latency of next() and use_id() at 1M and 16M IDs
+
+// all IDs used but the last one
+static void set_up_last_free(kupid::kbtree& id_factory) {
+    id_factory.use_range(0, id_factory.size() - 1);
+}
+
+static void test_kbtree_next_latency(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_last_free(id_factory);
+
+    int64_t id;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id = id_factory.next(false));
+    }
+}
+
+// use_id() and free_id() of scattered IDs, each one fills and frees a data word
+static void test_kbtree_use_id_latency(benchmark::State& state) {
+    kupid::kbtree id_factory{static_cast<uint32_t>(state.range(0))};
+    set_up_last_free(id_factory);
+
+    uint32_t step = 1000003;  // prime, visits every ID
+    uint32_t id = 0;
+
+    while (state.KeepRunning()) {
+        id_factory.free_id(id);
+        id_factory.use_id(id);
+        id = (id + step) % id_factory.size();
+    }
+}
+
+#ifdef UNIT_MS
+BENCHMARK(test_kbtree_next_latency)->Arg(1 << 20)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_use_id_latency)->Arg(1 << 20)->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+#else
+BENCHMARK(test_kbtree_next_latency)->Arg(1 << 20)->Arg(1 << 24);
+BENCHMARK(test_kbtree_use_id_latency)->Arg(1 << 20)->Arg(1 << 24);
+#endif
+
+// -----------------------------------------------------------------------------
+// kupid::kbtree vs. kupid::kbtree_wide - depth, memory and latency at 1M, 16M and 2^32 IDs
+
+// all IDs used but the last one, built once per size
+template <typename T>
+static T& get_full_factory(uint32_t size) {
+    static std::map<uint32_t, std::unique_ptr<T>> factories;
+    auto& id_factory = factories[size];
+
+    if (!id_factory) {
+        id_factory.reset(new T{size});
+
+        for (uint64_t i = 0; i < size; ++i) {
+            id_factory->use_id(i);
+        }
+
+        id_factory->free_id(size - 1);
+    }
+
+    return *id_factory;
+}
+
+template <typename T>
+static void set_depth_counters(benchmark::State& state, T& id_factory) {
+    state.counters["depth"] = id_factory.depth();
+    state.counters["MB"] = T::get_arena_bytes(id_factory.size()) / (1024.0 * 1024.0);
+}
+
+template <typename T>
+static void test_depth_next(benchmark::State& state) {
+    T& id_factory = get_full_factory<T>(state.range(0));
+
+    int64_t id;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id = id_factory.next(false));
+    }
+
+    set_depth_counters(state, id_factory);
+}
+
+// free_id() and use_id() of scattered IDs: every layer is updated
+template <typename T>
+static void test_depth_use_id(benchmark::State& state) {
+    T& id_factory = get_full_factory<T>(state.range(0));
+
+    uint32_t size = id_factory.size() - 1;
+    uint32_t step = 1000003;  // prime, visits every ID
+    uint32_t id = 0;
+
+    while (state.KeepRunning()) {
+        id_factory.free_id(id);
+        id_factory.use_id(id);
+        id = (id + step) % size;
+    }
+
+    set_depth_counters(state, id_factory);
+}
+
+// free_id() of a scattered ID and next() takes it back: the path of next() is not cached
+template <typename T>
+static void test_depth_reclaim(benchmark::State& state) {
+    T& id_factory = get_full_factory<T>(state.range(0));
+
+    uint32_t size = id_factory.size() - 1;
+    uint32_t step = 1000003;  // prime, visits every ID
+    uint32_t id = 0;
+
+    id_factory.use_id(size);
+
+    while (state.KeepRunning()) {
+        id_factory.free_id(id);
+        benchmark::DoNotOptimize(id_factory.next());
+        id = (id + step) % size;
+    }
+
+    id_factory.free_id(size);
+    set_depth_counters(state, id_factory);
+}
+
+// kupid::kbtree_wide with the in-node scan of the best SIMD kernel
+class kbtree_wide_simd : public kupid::kbtree_wide {
+    public:
+        kbtree_wide_simd(uint32_t size) : kupid::kbtree_wide{size} {
+            set_kernel(kupid::kscan::get_best_kernel());
+        }
+};
+
+// 2^32 - 1 IDs take 512 MB per tree and a long set-up, passed as a define: -DBMARK_XLARGE
+static void set_depth_sizes(benchmark::internal::Benchmark* b) {
+    b->Arg(1 << 20)->Arg(1 << 24);
+#ifdef BMARK_XLARGE
+    b->Arg(UINT32_MAX);
+#endif
+#ifdef UNIT_MS
+    b->Unit(benchmark::kMillisecond);
+#endif
+}
+
+BENCHMARK_TEMPLATE(test_depth_next, kupid::kbtree)->Apply(set_depth_sizes);
+BENCHMARK_TEMPLATE(test_depth_next, kupid::kbtree_wide)->Apply(set_depth_sizes);
+BENCHMARK_TEMPLATE(test_depth_next, kbtree_wide_simd)->Apply(set_depth_sizes);
+BENCHMARK_TEMPLATE(test_depth_use_id, kupid::kbtree)->Apply(set_depth_sizes);
+BENCHMARK_TEMPLATE(test_depth_use_id, kupid::kbtree_wide)->Apply(set_depth_sizes);
+BENCHMARK_TEMPLATE(test_depth_use_id, kbtree_wide_simd)->Apply(set_depth_sizes);
+BENCHMARK_TEMPLATE(test_depth_reclaim, kupid::kbtree)->Apply(set_depth_sizes);
+BENCHMARK_TEMPLATE(test_depth_reclaim, kupid::kbtree_wide)->Apply(set_depth_sizes);
+BENCHMARK_TEMPLATE(test_depth_reclaim, kbtree_wide_simd)->Apply(set_depth_sizes);
+
+// -----------------------------------------------------------------------------
+// kupid::kvector
+
+using benchmark_kvector = KFactory<kupid::kvector>;
+
+BENCHMARK_DEFINE_F(benchmark_kvector, test_kvector)(benchmark::State& state) {
+    uint32_t id;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id = _id_factory.next(false));
+    }
+}
+
+#ifdef UNIT_MS
+BENCHMARK_REGISTER_F(benchmark_kvector, test_kvector)->Unit(benchmark::kMillisecond);
+#else
+BENCHMARK_REGISTER_F(benchmark_kvector, test_kvector);
+#endif
+
+// -----------------------------------------------------------------------------
+// kupid::kbset<size>
+
+using benchmark_kbset = KFactory<kupid::kbset<bmark_test_size>>;
+
+BENCHMARK_DEFINE_F(benchmark_kbset, test_kbset)(benchmark::State& state) {
+    uint32_t id;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id = _id_factory.next(false));
+    }
+}
+
+#ifdef UNIT_MS
+BENCHMARK_REGISTER_F(benchmark_kbset, test_kbset)->Unit(benchmark::kMillisecond);
+#else
+BENCHMARK_REGISTER_F(benchmark_kbset, test_kbset);
+#endif
+
+// -----------------------------------------------------------------------------
+// kupid::kscan - first zero bit of a flat bitmap, per kernel: 0 scalar, 1 AVX2, 2 AVX-512,
+// vs. a test of one bit at a time, the next() of kvector and kbset before kscan
+
+static void test_kscan(benchmark::State& state) {
+    auto kernel = static_cast<kupid::kscan::kernel>(state.range(0));
+
+    if (!kupid::kscan::set_kernel(kernel)) {
+        state.SkipWithError("kernel not supported by the CPU");
+        return;
+    }
+
+    std::vector<uint64_t> words((bmark_test_size + 63) / 64, ~uint64_t{0});
+    words.back() &= ~(uint64_t{1} << (bmark_last_id % 64));
+
+    int64_t id;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id = kupid::kscan::find_first_zero(words.data(), bmark_test_size));
+    }
+
+    kupid::kscan::set_kernel(kupid::kscan::get_best_kernel());
+}
+
+static void test_kscan_bit_loop(benchmark::State& state) {
+    std::vector<uint64_t> words((bmark_test_size + 63) / 64, ~uint64_t{0});
+    words.back() &= ~(uint64_t{1} << (bmark_last_id % 64));
+
+    int64_t id;
+    while (state.KeepRunning()) {
+        id = -1;
+
+        for (uint32_t bit = 0; bit < bmark_test_size; ++bit) {
+            if ((words[bit >> 6] & (uint64_t{1} << (bit & 63))) == 0) {
+                id = bit;
+                break;
+            }
+        }
+
+        benchmark::DoNotOptimize(id);
+    }
+}
+
+#ifdef UNIT_MS
+BENCHMARK(test_kscan)->DenseRange(0, 2)->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kscan_bit_loop)->Unit(benchmark::kMillisecond);
+#else
+BENCHMARK(test_kscan)->DenseRange(0, 2);
+BENCHMARK(test_kscan_bit_loop);
+#endif
+
+// -----------------------------------------------------------------------------
+// kupid::kset_inc
+
+using benchmark_kset_inc = KFactory<kupid::kset_inc>;
+
+BENCHMARK_DEFINE_F(benchmark_kset_inc, kset_inc)(benchmark::State& state) {
+    uint32_t id;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id = _id_factory.next(false));
+    }
+}
+
+#ifdef UNIT_MS
+BENCHMARK_REGISTER_F(benchmark_kset_inc, kset_inc)->Unit(benchmark::kMillisecond);
+#else
+BENCHMARK_REGISTER_F(benchmark_kset_inc, kset_inc);
+#endif
+
+// -----------------------------------------------------------------------------
+// kupid::kset_dec
+
+using benchmark_kset_dec = KFactory<kupid::kset_dec>;
+
+BENCHMARK_DEFINE_F(benchmark_kset_dec, kset_dec)(benchmark::State& state) {
+    uint32_t id;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id = _id_factory.next(false));
+    }
+}
+
+#ifdef UNIT_MS
+BENCHMARK_REGISTER_F(benchmark_kset_dec, kset_dec)->Unit(benchmark::kMillisecond);
+#else
+BENCHMARK_REGISTER_F(benchmark_kset_dec, kset_dec);
+#endif
+
+// -----------------------------------------------------------------------------
+// kupid::kveb
+
+using benchmark_kveb = KFactory<kupid::kveb>;
+
+BENCHMARK_DEFINE_F(benchmark_kveb, kveb)(benchmark::State& state) {
+    int64_t id;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id = _id_factory.next(false));
+    }
+}
+
+#ifdef UNIT_MS
+BENCHMARK_REGISTER_F(benchmark_kveb, kveb)->Unit(benchmark::kMillisecond);
+#else
+BENCHMARK_REGISTER_F(benchmark_kveb, kveb);
+#endif
+
+// churn of a live set of up to 1M IDs scattered over the whole ID space:
+// a random live ID is freed, and replaced by next() or by use_id() of a random free ID
+template <typename T>
+static void test_churn(benchmark::State& state) {
+    uint32_t size = state.range(0);
+    uint32_t live_size = std::min(size / 4, uint32_t{1} << 20);
+
+    T id_factory{size};
+    std::mt19937 rnd_factory{787350};
+    std::vector<uint32_t> live(live_size);
+
+    for (auto& id : live) {
+        do {
+            id = rnd_factory() % size;
+        } while (id_factory.is_using(id));
+
+        id_factory.use_id(id);
+    }
+
+    uint64_t count = 0;
+    while (state.KeepRunning()) {
+        uint32_t& id = live[rnd_factory() % live_size];
+        id_factory.free_id(id);
+
+        if (++count % 2 == 0) {
+            id = id_factory.next();
+        } else {
+            do {
+                id = rnd_factory() % size;
+            } while (id_factory.is_using(id));
+
+            id_factory.use_id(id);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(test_churn, kupid::kbtree)->Apply(set_depth_sizes);
+BENCHMARK_TEMPLATE(test_churn, kupid::kbtree_wide)->Apply(set_depth_sizes);
+BENCHMARK_TEMPLATE(test_churn, kupid::kveb)->Apply(set_depth_sizes);
+
+// -----------------------------------------------------------------------------
+// multi-threaded churn: kupid::kbtree_atomic, kupid::kmagazine and kupid::kshard vs. kupid::kbtree behind a mutex
+
+class kbtree_mutex {
+    public:
+        kbtree_mutex(uint32_t size) : _id_factory{size} {};
+
+        int64_t next() {
+            std::lock_guard<std::mutex> lock{_mutex};
+            return _id_factory.next();
+        }
+
+        bool use_id(uint32_t id) {
+            std::lock_guard<std::mutex> lock{_mutex};
+            return _id_factory.use_id(id);
+        }
+
+        bool free_id(uint32_t id) {
+            std::lock_guard<std::mutex> lock{_mutex};
+            return _id_factory.free_id(id);
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _id_factory.clear();
+        }
+
+    private:
+        std::mutex _mutex;
+        kupid::kbtree _id_factory;
+};
+
+static kupid::kbtree_atomic shared_kbtree_atomic{bmark_test_size};
+static kbtree_mutex shared_kbtree_mutex{bmark_test_size};
+
+// the first half is used, every thread takes the lowest free ID and gives it back
+template <typename S, typename T>
+static void churn_threads(benchmark::State& state, S& shared, T& id_factory) {
+    if (state.thread_index() == 0) {
+        shared.clear();
+
+        for (uint32_t i = 0; i < bmark_test_size / 2; ++i) {
+            shared.use_id(i);
+        }
+    }
+
+    int64_t id;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(id = id_factory.next());
+        if (id >= 0) {
+            id_factory.free_id(id);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void test_kbtree_atomic_threads(benchmark::State& state) {
+    churn_threads(state, shared_kbtree_atomic, shared_kbtree_atomic);
+}
+
+static void test_kbtree_mutex_threads(benchmark::State& state) {
+    churn_threads(state, shared_kbtree_mutex, shared_kbtree_mutex);
+}
+
+// every thread owns a magazine in front of the shared kbtree_atomic
+static void test_kmagazine_threads(benchmark::State& state) {
+    kupid::kmagazine<kupid::kbtree_atomic> magazine{shared_kbtree_atomic};
+    churn_threads(state, shared_kbtree_atomic, magazine);
+}
+
+static void test_kmagazine_lifo_threads(benchmark::State& state) {
+    using kmagazine = kupid::kmagazine<kupid::kbtree_atomic>;
+    kmagazine magazine{shared_kbtree_atomic, 64, kmagazine::order::lifo};
+    churn_threads(state, shared_kbtree_atomic, magazine);
+}
+
+// one shard per core, the low shards are used up: their threads steal from the next ones
+static void test_kshard_threads(benchmark::State& state) {
+    // built on first use, its shards are allocated by threads pinned to their cores
+    static kupid::kshard<> shared_kshard{bmark_test_size, static_cast<uint32_t>(bmark_max_threads)};
+    churn_threads(state, shared_kshard, shared_kshard);
+}
+
+// direct single-threaded access, the reference for the magazines
+static void test_kbtree_churn(benchmark::State& state) {
+    kupid::kbtree id_factory{bmark_test_size};
+    churn_threads(state, id_factory, id_factory);
+}
+
+#ifdef UNIT_MS
+BENCHMARK(test_kbtree_atomic_threads)->ThreadRange(1, bmark_max_threads)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_mutex_threads)->ThreadRange(1, bmark_max_threads)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kmagazine_threads)->ThreadRange(1, bmark_max_threads)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kmagazine_lifo_threads)->ThreadRange(1, bmark_max_threads)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kshard_threads)->ThreadRange(1, bmark_max_threads)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(test_kbtree_churn)->Unit(benchmark::kMillisecond);
+#else
+BENCHMARK(test_kbtree_atomic_threads)->ThreadRange(1, bmark_max_threads)->UseRealTime();
+BENCHMARK(test_kbtree_mutex_threads)->ThreadRange(1, bmark_max_threads)->UseRealTime();
+BENCHMARK(test_kmagazine_threads)->ThreadRange(1, bmark_max_threads)->UseRealTime();
+BENCHMARK(test_kmagazine_lifo_threads)->ThreadRange(1, bmark_max_threads)->UseRealTime();
+BENCHMARK(test_kshard_threads)->ThreadRange(1, bmark_max_threads)->UseRealTime();
+BENCHMARK(test_kbtree_churn);
 #endif
 
 // run the benchmark
@@ -0,0 +1,326 @@
+#ifndef KARENA_H
+#define KARENA_H
+
+#include <memory>
+#include <new>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if __cplusplus >= 201703L  // C++17
+#include <memory_resource>
+#endif
+
+namespace kupid {
+    /**
+     * one block of 64-byte aligned zeroed words, owned unless it is a user buffer
+     *
+     * a large arena is mapped from anonymous zero pages with MAP_NORESERVE,
+     * which are committed only when written, optionally on transparent huge pages
+     *
+     * a file arena is a shared mapping of a file: a header of header_bytes, then the words,
+     * it is written back to the file when released, and a flag word of the header
+     * is set on a clean release
+     *
+     * see:
+     *      https://man7.org/linux/man-pages/man2/mmap.2.html
+     *      https://man7.org/linux/man-pages/man2/madvise.2.html
+     */
+
+    class karena {
+        public:
+            karena() = default;
+            karena(const karena& copy) = delete;
+            karena& operator=(const karena& copy) = delete;
+
+            karena(karena&& move) noexcept {
+                take(move);
+            }
+
+            karena& operator=(karena&& move) noexcept {
+                if (this != &move) {
+                    release();
+                    take(move);
+                }
+
+                return *this;
+            }
+
+            ~karena() {
+                release();
+            }
+
+            // a large arena is mapped from the zero pages without committing them
+            void allocate(size_t bytes, bool is_huge_page) {
+                _bytes = bytes;
+                _is_huge_page = is_huge_page;
+#if defined(__unix__) || defined(__APPLE__)
+                if (bytes >= mapped_min_bytes) {
+                    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+                    if (ptr == MAP_FAILED) {
+                        throw std::bad_alloc();
+                    }
+    #ifdef MADV_HUGEPAGE
+                    if (is_huge_page) {
+                        madvise(ptr, bytes, MADV_HUGEPAGE);
+                    }
+    #endif
+                    _words = static_cast<uint64_t*>(ptr);
+                    _source = source::mapped;
+                    return;
+                }
+#endif
+                size_t space = bytes + alignment;
+                _raw = ::operator new(space);
+
+                void* ptr = _raw;
+                std::align(alignment, bytes, ptr, space);
+
+                _words = static_cast<uint64_t*>(ptr);
+                _source = source::heap;
+                std::memset(_words, 0, bytes);
+            }
+
+            void assign(void* buffer, size_t bytes, size_t needed) {
+                if (buffer == nullptr || bytes < needed) {
+                    throw std::invalid_argument("karena: buffer too small");
+                }
+
+                if (reinterpret_cast<uintptr_t>(buffer) % alignment != 0) {
+                    throw std::invalid_argument("karena: buffer not aligned to 64 bytes");
+                }
+
+                _bytes = needed;
+                _words = static_cast<uint64_t*>(buffer);
+                _source = source::buffer;
+                std::memset(_words, 0, needed);
+            }
+
+#if defined(__unix__) || defined(__APPLE__)
+            // map the file, created with zero words if missing, true if it was created
+            bool map_file(const char* path, size_t bytes, size_t header_bytes) {
+                int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+                if (fd < 0) {
+                    throw std::system_error(errno, std::generic_category(), "karena: open");
+                }
+
+                struct stat status;
+                size_t file_bytes = header_bytes + bytes;
+
+                if (fstat(fd, &status) != 0) {
+                    close_file(fd, "karena: fstat");
+                }
+
+                bool is_created = status.st_size == 0;
+
+                if (is_created) {
+                    // a sparse file, the zero words take no disk space until written
+                    if (ftruncate(fd, file_bytes) != 0) {
+                        close_file(fd, "karena: ftruncate");
+                    }
+                } else if (static_cast<size_t>(status.st_size) != file_bytes) {
+                    close(fd);
+                    throw std::runtime_error("karena: file size mismatch");
+                }
+
+                void* ptr = mmap(nullptr, file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+                if (ptr == MAP_FAILED) {
+                    close_file(fd, "karena: mmap");
+                }
+
+                // the mapping keeps the file open
+                close(fd);
+
+                _header = static_cast<uint8_t*>(ptr);
+                _header_bytes = header_bytes;
+                _bytes = bytes;
+                _words = reinterpret_cast<uint64_t*>(_header + header_bytes);
+                _source = source::file;
+                return is_created;
+            }
+
+            // write the pages of a file arena back to the file, false if it failed or there is no file
+            bool sync() {
+                return _source == source::file &&
+                       msync(_header, _header_bytes + _bytes, MS_SYNC) == 0;
+            }
+#endif
+
+            // the header of a file arena, or nullptr
+            uint8_t* header() const {
+                return _source == source::file ? _header : nullptr;
+            }
+
+            // a word of the header set to value on a clean release of the file arena
+            void set_clean_flag(uint32_t* flag, uint32_t value) {
+                _clean_flag = flag;
+                _clean_value = value;
+            }
+
+#if __cplusplus >= 201703L  // C++17
+            void allocate(size_t bytes, std::pmr::memory_resource* resource) {
+                _bytes = bytes;
+                _words = static_cast<uint64_t*>(resource->allocate(bytes, alignment));
+                _resource = resource;
+                _source = source::resource;
+                std::memset(_words, 0, bytes);
+            }
+#endif
+
+            // a heap, mapped or memory resource arena may be replaced by a larger one, a file or a user buffer not
+            bool is_growable() const {
+                return _source == source::heap || _source == source::mapped || _source == source::resource;
+            }
+
+            // a new arena of bytes from the source of a growable arena
+            void allocate_like(const karena& other, size_t bytes) {
+#if __cplusplus >= 201703L  // C++17
+                if (other._source == source::resource) {
+                    allocate(bytes, other._resource);
+                    return;
+                }
+#endif
+                allocate(bytes, other._is_huge_page);
+            }
+
+            // a mapped arena gives its pages back instead of writing zeros into them
+            void fill_zero() {
+#ifdef __linux__
+                if (_source == source::mapped && madvise(_words, _bytes, MADV_DONTNEED) == 0) {
+                    return;
+                }
+#endif
+                std::memset(_words, 0, _bytes);
+            }
+
+            // zero count words from words, the whole pages among them of a mapped arena are given back
+            void fill_zero(uint64_t* words, size_t count) {
+#ifdef __linux__
+                if (_source == source::mapped && count * sizeof(uint64_t) >= mapped_min_bytes) {
+                    uintptr_t page = sysconf(_SC_PAGESIZE);
+                    uintptr_t first = reinterpret_cast<uintptr_t>(words);
+                    uintptr_t last = first + count * sizeof(uint64_t);
+                    uintptr_t page_first = (first + page - 1) & ~(page - 1);
+                    uintptr_t page_last = last & ~(page - 1);
+
+                    if (madvise(reinterpret_cast<void*>(page_first), page_last - page_first, MADV_DONTNEED) == 0) {
+                        std::memset(words, 0, page_first - first);
+                        std::memset(reinterpret_cast<void*>(page_last), 0, last - page_last);
+                        return;
+                    }
+                }
+#endif
+                std::memset(words, 0, count * sizeof(uint64_t));
+            }
+
+            uint64_t* words() const {
+                return _words;
+            }
+
+            size_t bytes() const {
+                return _bytes;
+            }
+
+        private:
+            enum class source {
+                none,
+                heap,
+                mapped,
+                file,
+                buffer,
+                resource
+            };
+
+            static constexpr size_t alignment = 64;
+
+            // arenas from 1 MB on are mapped
+            static constexpr size_t mapped_min_bytes = 1 << 20;
+
+            uint64_t* _words = nullptr;
+            size_t _bytes = 0;
+            source _source = source::none;
+            void* _raw = nullptr;
+            uint8_t* _header = nullptr;
+            size_t _header_bytes = 0;
+            uint32_t* _clean_flag = nullptr;
+            uint32_t _clean_value = 0;
+            bool _is_huge_page = false;
+#if __cplusplus >= 201703L  // C++17
+            std::pmr::memory_resource* _resource = nullptr;
+#endif
+
+        private:
+#if defined(__unix__) || defined(__APPLE__)
+            [[noreturn]] static void close_file(int fd, const char* what) {
+                int error = errno;
+                close(fd);
+                throw std::system_error(error, std::generic_category(), what);
+            }
+#endif
+
+            void take(karena& move) {
+                _words = move._words;
+                _bytes = move._bytes;
+                _source = move._source;
+                _raw = move._raw;
+                _header = move._header;
+                _header_bytes = move._header_bytes;
+                _clean_flag = move._clean_flag;
+                _clean_value = move._clean_value;
+                _is_huge_page = move._is_huge_page;
+#if __cplusplus >= 201703L  // C++17
+                _resource = move._resource;
+#endif
+                move._words = nullptr;
+                move._source = source::none;
+            }
+
+            void release() {
+                switch (_source) {
+                    case source::heap:
+                        ::operator delete(_raw);
+                        break;
+#if defined(__unix__) || defined(__APPLE__)
+                    case source::mapped:
+                        munmap(_words, _bytes);
+                        break;
+
+                    // the words reach the file before the flag tells that the summaries match them
+                    case source::file:
+                        if (_clean_flag != nullptr && sync()) {
+                            *_clean_flag = _clean_value;
+                            msync(_header, _header_bytes, MS_SYNC);
+                        }
+
+                        munmap(_header, _header_bytes + _bytes);
+                        break;
+#endif
+#if __cplusplus >= 201703L  // C++17
+                    case source::resource:
+                        _resource->deallocate(_words, _bytes, alignment);
+                        break;
+#endif
+                    default:
+                        break;
+                }
+
+                _words = nullptr;
+                _source = source::none;
+            }
+    };
+}
+
+#endif // KARENA_H
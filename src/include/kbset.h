@@ -1,13 +1,19 @@
 #ifndef KBSET_H
 #define KBSET_H
 
-#include <bitset>
+#include <array>
+#include <cstdint>
+
+#include "kscan.h"
+#include "kcommon.h"
 
 namespace kupid {
     /**
-     * std::bitset
+     * a flat bitmap of N bits in a std::array of 64-bit words, like std::bitset
      * see:
      *      https://en.cppreference.com/w/cpp/utility/bitset
+     *
+     * next() scans the words with kscan, the bits past the last ID stay off
      */
 
     template<size_t N>
@@ -15,22 +21,42 @@ namespace kupid {
         public:
             kbset() = default;
 
-            int next(bool is_using = true) {
-                for (uint32_t id = 0 ; id < _size; ++id) {
-                    if (_data.test(id) == false) {
-                        if (is_using) {
-                            use_id(id);
-                        }
-                        return id;
+            // all IDs used or free
+            kbset(kpreset preset) {
+                if (preset == kpreset::all_used) {
+                    _data.fill(~uint64_t{0});
+
+                    if (N % 64 != 0) {
+                        _data.back() = (uint64_t{1} << (N % 64)) - 1;
                     }
+
+                    _usage.set(N);
                 }
+            }
 
-                return -1;
+            kbset(ksorted_ids<uint32_t> used) {
+                for (uint32_t id : used) {
+                    set_id_state(id, true);
+                }
+            }
+
+            int next(bool is_using = true) {
+                int64_t id = kscan::find_first_zero(_data.data(), N);
+
+                if (id >= 0 && is_using) {
+                    use_id(id);
+                }
+
+                return id;
             }
 
             bool set_id_state(uint32_t id, bool state) {
                 if (id < _size) {
-                    _data.set(id, state);
+                    uint64_t& data = _data[id >> 6];
+                    uint64_t bit = uint64_t{1} << (id & 63);
+                    _usage.update((data & bit) != 0, state);
+                    data = state ? data | bit : data & ~bit;
+
                     return true;
                 } else {
                     return false;
@@ -47,14 +73,34 @@ namespace kupid {
 
             bool is_using(uint32_t id) const {
                 if (id < _size) {
-                    return _data.test(id);
+                    return (_data[id >> 6] & (uint64_t{1} << (id & 63))) != 0;
                 } else {
                     return false;
                 }
             }
 
             void clear() {
-                _data.reset();
+                _data.fill(0);
+                _usage.set(0);
+            }
+
+            // the number of used IDs in O(1)
+            uint32_t used_count() const {
+                return _usage.used();
+            }
+
+            uint32_t free_count() const {
+                return _size - _usage.used();
+            }
+
+            // f(used) once the used IDs rise to used, nullptr removes the watermark
+            void set_high_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_high_watermark(used, std::move(f));
+            }
+
+            // f(used) once the used IDs fall to used, nullptr removes the watermark
+            void set_low_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_low_watermark(used, std::move(f));
             }
 
             uint32_t size() const {
@@ -63,7 +109,8 @@ namespace kupid {
 
         private:
             uint32_t _size{N};
-            std::bitset<N> _data{};
+            std::array<uint64_t, (N + 63) / 64> _data{};
+            kusage _usage;
     };
 }
 
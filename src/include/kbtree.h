@@ -2,11 +2,26 @@
 #define KBTREE_H
 
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <memory>
+#include <new>
 #include <cstring>
+#include <cstdint>
+#include <string>
+#include <stdexcept>
+#include <iterator>
+#include <cstddef>
+
+#include "karena.h"
+#include "kcommon.h"
+#include "kjournal.h"
+#include "kscan.h"
 
 #if __cplusplus > 201703L  // C++20
 #include <bit>
+#include <span>
+#include <ranges>
 #endif
 
 namespace kupid {
@@ -27,53 +42,162 @@ namespace kupid {
      * De Bruijn multiplication
      * see:
      *      https://www.chessprogramming.org/BitScan#DeBruijnMultiplation
+     *
+     * T is the type of IDs and sizes: uint32_t, or uint64_t beyond 2^32 IDs,
+     * IDs of the 64-bit tree must fit into the int64_t returned by next()
+     *
+     * a bit of an upper layer is on when its word of the lower layer is full,
+     * a bit of an "any used" layer is on when its word of the lower layer is not empty
+     *
+     * all layers live in a single arena of 64-byte aligned words, from the top
+     * layer down to the data layer, followed by the run summaries, the "any used" layers,
+     * the used counts of the words of the upper layers and the free runs of their subtrees
+     *
+     * the run summaries and the used counts are recomputed on demand once modified,
+     * a modified block of 4096 IDs marks the counts and runs above it only if it was clean
+     *
+     * a large arena is mapped from anonymous zero pages which are committed
+     * only when written, the memory of a large tree grows with the IDs in use,
+     * optionally the arena is given to a user buffer or a std::pmr::memory_resource
+     *
+     * the arena may also be a shared mapping of a file, reopened without copying,
+     * as a header of 64 bytes and the arena words, little-endian
+     *
+     * an attached kjournal records every change of state after the construction
+     *
+     * the number of used IDs is kept by every change of state, with optional watermark callbacks
      */
 
-    class kbtree {
+    template<typename T>
+    class basic_kbtree {
         public:
             struct div_mod {
-                uint32_t div;
-                uint32_t mod;
+                T div;
+                T mod;
             };
 
-            kbtree(uint32_t size)
-                : _size{size}
+            // is_huge_page: advise transparent huge pages for a mapped arena
+            basic_kbtree(T size, bool is_huge_page = false)
+                : _size{size},
+                  _capacity{size}
             {
-                uint32_t slice = size;
-                div_mod dm;
+                set_up_layout();
+                _arena.allocate(get_arena_bytes(size), is_huge_page);
+                place_layers();
+            }
 
-                // max 6 data layers: 2^32 = (2^6)^5 x (2^2)
-                _data.reserve(6);
+            // all IDs used or free
+            basic_kbtree(T size, kpreset preset, bool is_huge_page = false)
+                : basic_kbtree{size, is_huge_page}
+            {
+                if (preset == kpreset::all_used) {
+                    use_range(0, size);
+                }
+            }
 
-                do {
-                    dm = get_div_and_mod_by_64(slice);
-                    slice = get_div_or_plus_1(dm);
+            // the used IDs set word by word, then each upper layer derived in one pass
+            basic_kbtree(T size, ksorted_ids<T> used, bool is_huge_page = false)
+                : basic_kbtree{size, is_huge_page}
+            {
+                T index = 0;
+                uint64_t data = 0;
+                uint64_t count = 0;
 
-                    if (_slice == 0) {
-                        _slice = slice;
+                // the IDs of a word are gathered in a register, the word is written once
+                for (T id : used) {
+                    if (id >= _size) {
+                        break;
                     }
 
-#if __cplusplus == 201103L  // C++11
-                    _data.push_back(std::unique_ptr<uint64_t[]>(new uint64_t[slice]()));
-#else
-                    _data.push_back(std::make_unique<uint64_t[]>(slice));
+                    div_mod id_dm = get_div_and_mod_by_64(id);
+
+                    if (id_dm.div != index) {
+                        _layers[0][index] |= data;
+                        count += get_used_bit_count(data);
+                        index = id_dm.div;
+                        data = 0;
+                    }
+
+                    set_bit_on(data, id_dm.mod);
+                }
+
+                if (_slice > 0) {
+                    _layers[0][index] |= data;
+                    count += get_used_bit_count(data);
+                    _high = index + 1;
+                }
+
+                build_summaries();
+                _usage.set(count);
+            }
+
+            // the arena is the user buffer: 64-byte aligned, at least get_arena_bytes(size) long, outliving the tree
+            basic_kbtree(T size, void* buffer, size_t bytes)
+                : _size{size},
+                  _capacity{size}
+            {
+                set_up_layout();
+                _arena.assign(buffer, bytes, get_arena_bytes(size));
+                place_layers();
+            }
+
+#if __cplusplus >= 201703L  // C++17
+            basic_kbtree(T size, std::pmr::memory_resource* resource)
+                : _size{size},
+                  _capacity{size}
+            {
+                set_up_layout();
+                _arena.allocate(get_arena_bytes(size), resource);
+                place_layers();
+            }
 #endif
-                } while (dm.div > 0);
 
-                _data.shrink_to_fit();
+#if defined(__unix__) || defined(__APPLE__)
+            /**
+             * the arena is a shared mapping of the file at path
+             *
+             * a new file starts with all IDs free, an existing file is validated and mapped as is,
+             * if it was not closed cleanly the upper layers are rebuilt from the data layer,
+             * throws std::system_error if the file cannot be mapped, std::runtime_error if it does not match
+             */
+            basic_kbtree(T size, const char* path)
+                : _size{size},
+                  _capacity{size}
+            {
+                set_up_layout();
+                open_file(path);
+            }
+
+            basic_kbtree(T size, const std::string& path)
+                : basic_kbtree{size, path.c_str()}
+            {}
+
+            // write the arena back to its file, false without a file
+            bool sync() {
+                return _arena.sync();
             }
+#endif
 
-            kbtree() = delete;                                  // default constructor
-            kbtree(const kbtree& copy) = delete;                // copy constructor
-            kbtree& operator=(const kbtree& copy) = delete;     // copy assignment
-            kbtree(kbtree&& move) = default;                    // move constructor
-            kbtree& operator=(kbtree&& move) = default;         // move assignment
+            basic_kbtree() = delete;                                  // default constructor
+            basic_kbtree(const basic_kbtree& copy) = delete;                // copy constructor
+            basic_kbtree& operator=(const basic_kbtree& copy) = delete;     // copy assignment
+            basic_kbtree(basic_kbtree&& move) = default;                    // move constructor
+            basic_kbtree& operator=(basic_kbtree&& move) = default;         // move assignment
+
+            // the used count of a file arena reaches the file with its clean flag
+            ~basic_kbtree() {
+                file_header* header = reinterpret_cast<file_header*>(_arena.header());
+
+                if (header != nullptr) {
+                    header->used = _usage.used();
+                }
+            }
 
             int64_t next(bool is_using = true) {
-                uint32_t rank = 0;
+                T rank = 0;
 
-                for (auto it = _data.rbegin(); it != _data.rend(); ++it) {
-                    uint64_t data = (*it)[rank];
+                for (size_t layer = _depth; layer > 0; --layer) {
+                    uint64_t data = _layers[layer - 1][rank];
                     int32_t offset = find_first_free_bit(data);
 
                     if (offset < 0) {
@@ -95,217 +219,2208 @@ namespace kupid {
                 return rank;
             }
 
-            bool use_id(uint32_t id) {
-                return set_id_state(id, true);
+            /**
+             * claim up to count free IDs in increasing order, returns the number of IDs written to out
+             *
+             * the free bits of a data word are claimed at once,
+             * therefore the layers are walked once per word instead of once per ID
+             */
+            size_t next_n(size_t count, T* out) {
+                size_t n = 0;
+
+                while (n < count) {
+                    int64_t index = find_first_free_word();
+
+                    // a word past the last ID, after a shrink
+                    if (index < 0 || static_cast<T>(index) >= _slice) {
+                        break;
+                    }
+
+                    uint64_t& data = _layers[0][index];
+                    T base = index * 64;
+                    uint64_t free_bits = ~data;
+
+                    if (static_cast<T>(index) >= _high) {
+                        _high = index + 1;
+                    }
+
+                    // the bits past the last ID of a partial word are never handed out
+                    if (_size - base < 64) {
+                        free_bits &= get_on_64_bit(_size - base) - 1;
+                    }
+
+                    if (free_bits == 0) {
+                        break;
+                    }
+
+                    uint64_t bits = free_bits;
+                    bool was_empty = data == 0;
+
+                    while (bits != 0 && n < count) {
+                        // ~bits has its first zero at the lowest free bit
+                        out[n++] = base + find_first_free_bit(~bits);
+                        bits &= bits - 1;
+                    }
+
+                    data |= free_bits ^ bits;
+                    set_block_dirty(index >> 6);
+
+                    if (was_empty) {
+                        mark_any(1, index, true);
+                    }
+
+                    if (_journal != nullptr) {
+                        for (uint64_t claimed = free_bits ^ bits; claimed != 0; claimed &= claimed - 1) {
+                            _journal->append_use(base + find_first_free_bit(~claimed));
+                        }
+                    }
+
+                    if (is_full(data)) {
+                        mark_full(1, index);
+                    }
+                }
+
+                _usage.set(_usage.used() + n);
+                return n;
             }
 
-            bool free_id(uint32_t id) {
-                return set_id_state(id, false);
+#if __cplusplus > 201703L  // C++20
+            size_t next_n(size_t count, std::span<T> out) {
+                return next_n(std::min(count, out.size()), out.data());
             }
+#endif
 
+            /**
+             * the first free ID from hint on, else from 0 on: round-robin instead of the lowest free ID
+             *
+             * as find_free(): up the layers from the data word of hint to the first word with a free
+             * bit after it, then down again, O(depth) masked words and at most one wraparound
+             */
+            int64_t next_from(T hint, bool is_using = true) {
+                T from = hint < _size ? hint : 0;
+                int64_t id = find_next(from, false);
 
-            bool is_using(uint32_t id) const {
-                if (id < _size) {
-                    div_mod id_dm = get_div_and_mod_by_64(id);
-                    return is_bit_on(_data[0][id_dm.div], id_dm.mod);
-                } else {
-                    return false;
+                if (id < 0 && from > 0) {
+                    id = find_next(0, false);
+                }
+
+                if (id >= 0 && is_using) {
+                    use_id(id);
                 }
+
+                return id;
             }
 
-            void clear() {
-                uint32_t slice = _slice;
-                for (auto it = _data.begin(); it != _data.end(); ++it) {
-                    auto arr = (*it).get();
+            // the lowest free ID in [low, high), or -1
+            int64_t next_in_range(T low, T high, bool is_using = true) {
+                if (low >= std::min(high, _size)) {
+                    return -1;
+                }
 
-                    std::memset(arr, 0, slice * sizeof(arr[0]));
+                int64_t id = find_next(low, false);
 
-                    div_mod dm = get_div_and_mod_by_64(slice);
-                    slice = get_div_or_plus_1(dm);
+                if (id < 0 || static_cast<T>(id) >= high) {
+                    return -1;
                 }
-            }
 
-            uint32_t size() const {
-                return _size;
-            }
+                if (is_using) {
+                    use_id(id);
+                }
 
-            uint32_t slice() const {
-                return _slice;
+                return id;
             }
 
-        // public only for unit tests
-        public:
-            int64_t get_data(uint32_t id, bool is_index = true) const {
-                if (is_index) {
-                    if (id < _slice) {
-                        return _data[0][id];
-                    } else {
-                        return -2;
+            /**
+             * claim the first run of len consecutive free IDs, returns its first ID or -1
+             *
+             * every block of 4096 IDs, i.e. the subtree of a word on the second layer, and every
+             * word of the upper layers below the top word keeps the lengths of the free runs at both
+             * ends of its subtree and of its longest free run: the search descends only into
+             * the subtrees which can hold the run, or complete it with the free IDs before them
+             */
+            int64_t next_range(T len, bool is_using = true) {
+                if (len == 0 || len > _size) {
+                    return -1;
+                }
+
+                T run = 0;  // free IDs just before the current subtree
+                int64_t first = -1;
+
+                // the words below the top word, the blocks of a tree of at most 3 layers
+                if (_depth > 3) {
+                    T nodes = get_run_nodes(_depth - 2);
+
+                    for (T index = 0; index < nodes && first < 0; ++index) {
+                        first = find_range(_depth - 2, index, len, run);
                     }
                 } else {
-                    if (id < _size) {
-                        div_mod id_dm = get_div_and_mod_by_64(id);
-                        return _data[0][id_dm.div];
-                    } else {
-                        return -4;
-                    }
+                    first = find_block_range(0, _blocks, len, run);
                 }
-            }
 
-            // 64 = 2**6, 63 = 64 - 1
-            static inline div_mod get_div_and_mod_by_64(uint32_t bits) {
-#if __cplusplus > 201703L  // C++20
-                return div_mod{ .div = bits >> 6,
-                                .mod = bits & 63 };
-#else
-                div_mod dm{};
-                dm.div = bits >> 6;
-                dm.mod = bits & 63;
-                return dm;
-#endif
+                return first >= 0 ? claim_range(first, len, is_using) : -1;
             }
 
-            static inline uint32_t get_div_or_plus_1(div_mod& dm) {
-                return dm.mod > 0 ? dm.div + 1 : dm.div;
-            }
+            // use len IDs starting from first, a word at a time
+            bool use_range(T first, T len) {
+                if (len > _size || first > _size - len) {
+                    return false;
+                }
 
-            static inline bool is_bit_on(uint64_t bits, uint8_t i) {
-                return (bits & get_on_64_bit(i)) > 0;
-            }
+                if (len > 0) {
+                    set_range_state(first, len, true);
+                }
 
-            static inline void set_bit_on(uint64_t& bits, uint8_t i) {
-                bits |= get_on_64_bit(i);
+                return true;
             }
 
-            static inline void set_bit_off(uint64_t& bits, uint8_t i) {
-                bits &= get_off_64_bit(i);
+            // free len IDs starting from first, a word at a time
+            bool free_range(T first, T len) {
+                if (len > _size || first > _size - len) {
+                    return false;
+                }
+
+                if (len > 0) {
+                    set_range_state(first, len, false);
+                }
+
+                return true;
             }
 
-            static inline void set_bit(uint64_t& bits, uint8_t i, bool on) {
-                on ? set_bit_on(bits, i) : set_bit_off(bits, i);
+            bool use_id(T id) {
+                return set_id_state(id, true);
             }
 
-            static inline bool is_full(uint64_t bits) {
-#if __cplusplus > 201703L  // C++20
-                return std::popcount(bits) == 64;
-#else
-    #ifndef DE_BRUIJN_SEQUENCE
-                return __builtin_popcountll(bits) == 64;
-    #else
-                return bits == 0xFFFFFFFFFFFFFFFF;
-    #endif
-#endif
+            bool free_id(T id) {
+                return set_id_state(id, false);
             }
 
-            static inline int32_t find_first_free_bit(uint64_t bits) {
-#if __cplusplus > 201703L  // C++20
-                return std::countr_one(bits);
-#else
-    #ifndef DE_BRUIJN_SEQUENCE
-                return __builtin_ffsll(~bits) - 1;
-    #else
-                static constexpr std::array<uint8_t, 64> de_bruijn_64 = {
-                     0,  1, 48,  2, 57, 49, 28,  3,
-                    61, 58, 50, 42, 38, 29, 17,  4,
-                    62, 55, 59, 36, 53, 51, 43, 22,
-                    45, 39, 33, 30, 24, 18, 12,  5,
-                    63, 47, 56, 27, 60, 41, 37, 16,
-                    54, 35, 52, 21, 44, 32, 23, 11,
-                    46, 26, 40, 15, 34, 20, 31, 10,
-                    25, 14, 19,  9, 13,  8,  7,  6
-                };
+            // free the IDs of the bits of the data word at index, one walk up the layers for all of them
+            bool free_word(T index, uint64_t bits) {
+                if (index >= _slices[0]) {
+                    return false;
+                }
 
-                static constexpr uint64_t de_bruijn_magic = 0x03F79D71B4CB0A89;
+                uint64_t& data = _layers[0][index];
+                bits &= data;
 
-                bits  = ~bits;
-                bits &= -bits;
-                bits *=  de_bruijn_magic;
-                uint8_t v = bits >> 58;
+                if (bits == 0) {
+                    return true;
+                }
 
-                return de_bruijn_64[v];
-    #endif
-#endif
+                set_block_dirty(index >> 6);
+
+                if (_journal != nullptr) {
+                    for (uint64_t rest = bits; rest != 0; rest &= rest - 1) {
+                        _journal->append_free(uint64_t{index} * 64 + find_first_free_bit(~rest));
+                    }
+                }
+
+                data &= ~bits;
+                mark_free(1, index);
+
+                if (data == 0) {
+                    mark_any(1, index, false);
+                }
+
+                _usage.set(_usage.used() - get_used_bit_count(bits));
+
+                return true;
             }
 
-        private:
-            uint32_t _size;
-            uint32_t _slice = 0;  // initial value
-            std::vector<std::unique_ptr<uint64_t[]>> _data;
+            bool is_using(T id) const {
+                if (id < _size) {
+                    div_mod id_dm = get_div_and_mod_by_64(id);
+                    return is_bit_on(_layers[0][id_dm.div], id_dm.mod);
+                } else {
+                    return false;
+                }
+            }
 
-        private:
-            static uint64_t get_on_64_bit(uint8_t i) {
-                // { 1UL << i, i = [0, 64) }
-                static constexpr std::array<uint64_t, 64> on_64 = {
-                    1UL << 0,  1UL << 1,  1UL << 2,  1UL << 3,
-                    1UL << 4,  1UL << 5,  1UL << 6,  1UL << 7,
-                    1UL << 8,  1UL << 9,  1UL << 10, 1UL << 11,
-                    1UL << 12, 1UL << 13, 1UL << 14, 1UL << 15,
-                    1UL << 16, 1UL << 17, 1UL << 18, 1UL << 19,
-                    1UL << 20, 1UL << 21, 1UL << 22, 1UL << 23,
-                    1UL << 24, 1UL << 25, 1UL << 26, 1UL << 27,
-                    1UL << 28, 1UL << 29, 1UL << 30, 1UL << 31,
-                    1UL << 32, 1UL << 33, 1UL << 34, 1UL << 35,
-                    1UL << 36, 1UL << 37, 1UL << 38, 1UL << 39,
-                    1UL << 40, 1UL << 41, 1UL << 42, 1UL << 43,
-                    1UL << 44, 1UL << 45, 1UL << 46, 1UL << 47,
-                    1UL << 48, 1UL << 49, 1UL << 50, 1UL << 51,
-                    1UL << 52, 1UL << 53, 1UL << 54, 1UL << 55,
-                    1UL << 56, 1UL << 57, 1UL << 58, 1UL << 59,
-                    1UL << 60, 1UL << 61, 1UL << 62, 1UL << 63
-                };
+            /**
+             * call f(id) for every used ID in increasing order
+             *
+             * the bits of a data word are visited by ctz, an empty subtree is skipped on
+             * the "any used" layers, whose bit is on when its word of the lower layer is not empty
+             */
+            template<typename F>
+            void for_each_used(F f) const {
+                for_each(true, f);
+            }
 
-                return on_64[i];
+            // call f(id) for every free ID in increasing order, a full subtree is skipped on the upper layers
+            template<typename F>
+            void for_each_free(F f) const {
+                for_each(false, f);
             }
 
-            static uint64_t get_off_64_bit(uint8_t i) {
-                // { ~(1UL << i), i = [0, 64) }
-                static constexpr std::array<uint64_t, 64> off_64 = {
-                    ~(1UL << 0),  ~(1UL << 1),  ~(1UL << 2),  ~(1UL << 3),
-                    ~(1UL << 4),  ~(1UL << 5),  ~(1UL << 6),  ~(1UL << 7),
-                    ~(1UL << 8),  ~(1UL << 9),  ~(1UL << 10), ~(1UL << 11),
-                    ~(1UL << 12), ~(1UL << 13), ~(1UL << 14), ~(1UL << 15),
-                    ~(1UL << 16), ~(1UL << 17), ~(1UL << 18), ~(1UL << 19),
-                    ~(1UL << 20), ~(1UL << 21), ~(1UL << 22), ~(1UL << 23),
-                    ~(1UL << 24), ~(1UL << 25), ~(1UL << 26), ~(1UL << 27),
-                    ~(1UL << 28), ~(1UL << 29), ~(1UL << 30), ~(1UL << 31),
-                    ~(1UL << 32), ~(1UL << 33), ~(1UL << 34), ~(1UL << 35),
-                    ~(1UL << 36), ~(1UL << 37), ~(1UL << 38), ~(1UL << 39),
-                    ~(1UL << 40), ~(1UL << 41), ~(1UL << 42), ~(1UL << 43),
-                    ~(1UL << 44), ~(1UL << 45), ~(1UL << 46), ~(1UL << 47),
-                    ~(1UL << 48), ~(1UL << 49), ~(1UL << 50), ~(1UL << 51),
-                    ~(1UL << 52), ~(1UL << 53), ~(1UL << 54), ~(1UL << 55),
-                    ~(1UL << 56), ~(1UL << 57), ~(1UL << 58), ~(1UL << 59),
-                    ~(1UL << 60), ~(1UL << 61), ~(1UL << 62), ~(1UL << 63)
-                };
+            // the lowest used ID from id on, or -1
+            int64_t find_used(T id) const {
+                return find_next(id, true);
+            }
 
-                return off_64[i];
+            // the lowest free ID from id on, or -1
+            int64_t find_free(T id) const {
+                return find_next(id, false);
             }
 
-            bool set_id_state(uint32_t index, bool state) const {
-                if (index < _size) {
-                    uint32_t val = index;
-                    div_mod index_dm;
+            /**
+             * used IDs below id, from the used counts of the words before it on each layer
+             *
+             * the used counts of the blocks of 4096 IDs and of the words above them are kept
+             * in the arena, under 1% of the data layer, and recomputed on demand once modified
+             */
+            T rank_used(T id) {
+                if (id >= _size) {
+                    return used_count();
+                }
 
-                    // start from the data layer (first layer)
-                    for (auto it = _data.begin(); it != _data.end(); ++it) {
-                        index_dm = get_div_and_mod_by_64(val);
-                        uint64_t& data = (*it)[index_dm.div];
-                        set_bit(data, index_dm.mod, state);
+                T rank = 0;
 
-                        // if removed and made available or 64 bits are fully used, mark this on the next level
-                        if (!state || is_full(data)) {
-                            val = index_dm.div;
-                        } else {
-                            break;
+                // the words before the one of id under the same word of the layer above,
+                // or the used IDs of that word less the words from the one of id on
+                for (size_t layer = _depth - 1; layer > 0; --layer) {
+                    T word = id >> (6 * layer);
+                    T first = word & ~T{63};
+                    T last = std::min(_slices[layer - 1], first + 64);
+
+                    if (word - first <= last - word) {
+                        for (T sibling = first; sibling < word; ++sibling) {
+                            rank += get_used(layer - 1, sibling);
                         }
-                    }
+                    } else {
+                        rank += layer + 1 < _depth ? get_used(layer, word >> 6) : used_count();
 
-                    return true;
-                } else {
-                    return false;
+                        for (T sibling = word; sibling < last; ++sibling) {
+                            rank -= get_used(layer - 1, sibling);
+                        }
+                    }
                 }
+
+                return rank + get_used_bit_count(_layers[0][id >> 6] & (get_on_64_bit(id & 63) - 1));
             }
-    };
+
+            // free IDs below id
+            T rank_free(T id) {
+                return std::min(id, _size) - rank_used(id);
+            }
+
+            // the used ID of rank k, from 0, or -1
+            int64_t select_used(T k) {
+                return k < used_count() ? find_kth(k, true) : -1;
+            }
+
+            // the free ID of rank k, from 0, or -1
+            int64_t select_free(T k) {
+                return k < free_count() ? find_kth(k, false) : -1;
+            }
+
+            /**
+             * the used or free IDs as a forward range: for (auto id : id_factory.used_ids())
+             * each step is a find_used() or find_free(), the view is invalidated by a change of the tree
+             */
+            class id_view
+#if __cplusplus > 201703L  // C++20
+                : public std::ranges::view_base
+#endif
+            {
+                public:
+                    class iterator {
+                        public:
+                            using iterator_category = std::forward_iterator_tag;
+                            using value_type = T;
+                            using difference_type = std::ptrdiff_t;
+                            using pointer = const T*;
+                            using reference = T;
+
+                            iterator() = default;
+
+                            iterator(const basic_kbtree* tree, int64_t id, bool is_used)
+                                : _tree{tree},
+                                  _id{id},
+                                  _is_used{is_used}
+                            {
+                                load_bits();
+                            }
+
+                            T operator*() const {
+                                return _id;
+                            }
+
+                            // the next candidate of the word, else a find from the next word
+                            iterator& operator++() {
+                                if (_bits != 0) {
+                                    _id = (_id & ~int64_t{63}) + find_first_free_bit(~_bits);
+                                    _bits &= _bits - 1;
+                                } else {
+                                    uint64_t next = (static_cast<uint64_t>(_id) | 63) + 1;
+                                    _id = next < _tree->_size ? _tree->find_next(next, _is_used) : -1;
+                                    load_bits();
+                                }
+
+                                return *this;
+                            }
+
+                            iterator operator++(int) {
+                                iterator prev = *this;
+                                ++*this;
+                                return prev;
+                            }
+
+                            bool operator==(const iterator& other) const {
+                                return _id == other._id;
+                            }
+
+                            bool operator!=(const iterator& other) const {
+                                return _id != other._id;
+                            }
+
+                        private:
+                            const basic_kbtree* _tree = nullptr;
+                            int64_t _id = -1;
+                            uint64_t _bits = 0;     // the candidates of the word past _id
+                            bool _is_used = true;
+
+                        private:
+                            void load_bits() {
+                                if (_id >= 0) {
+                                    _bits = _tree->get_candidates(0, _id >> 6, _is_used) & ~(get_on_64_bit(_id & 63) - 1);
+                                    _bits &= _bits - 1;
+                                }
+                            }
+                    };
+
+                    id_view() = default;
+
+                    id_view(const basic_kbtree* tree, bool is_used)
+                        : _tree{tree},
+                          _is_used{is_used}
+                    {}
+
+                    iterator begin() const {
+                        return iterator{_tree, _tree->find_next(0, _is_used), _is_used};
+                    }
+
+                    iterator end() const {
+                        return iterator{_tree, -1, _is_used};
+                    }
+
+                private:
+                    const basic_kbtree* _tree = nullptr;
+                    bool _is_used = true;
+            };
+
+            id_view used_ids() const {
+                return id_view{this, true};
+            }
+
+            id_view free_ids() const {
+                return id_view{this, false};
+            }
+
+            // up to count used IDs in increasing order written to out, returns the number of IDs written
+            size_t export_used(T* out, size_t count) const {
+                size_t n = 0;
+
+                for_each_word(true, [out, count, &n](T base, uint64_t bits) {
+                    for (; bits != 0 && n < count; bits &= bits - 1) {
+                        out[n++] = base + find_first_free_bit(~bits);
+                    }
+
+                    return n < count;
+                });
+
+                return n;
+            }
+
+#if __cplusplus > 201703L  // C++20
+            size_t export_used(std::span<T> out) const {
+                return export_used(out.data(), out.size());
+            }
+#endif
+
+            /**
+             * every ID free
+             *
+             * only the words with a used ID differ from a new tree, the summaries of the others
+             * are of free IDs: with few used IDs those words are zeroed down the "any used" layers,
+             * in O(words in use), else every word up to the high-water mark is zeroed on each
+             * layer and the pages of a mapped arena among them are given back
+             */
+            void clear() {
+                if (uint64_t{_usage.used()} * 8 < _high) {
+                    clear_used(_depth - 1, 0);
+                } else {
+                    clear_high();
+                }
+
+                _high = 0;
+                _usage.set(0);
+
+                if (_journal != nullptr && _size > 0) {
+                    _journal->append_range(0, _size, false);
+                }
+            }
+
+            // the number of used IDs in O(1)
+            T used_count() const {
+                return _usage.used();
+            }
+
+            T free_count() const {
+                return _size - _usage.used();
+            }
+
+            // f(used) once the used IDs rise to used, nullptr removes the watermark
+            void set_high_watermark(T used, kusage::callback f) {
+                _usage.set_high_watermark(used, std::move(f));
+            }
+
+            // f(used) once the used IDs fall to used, nullptr removes the watermark
+            void set_low_watermark(T used, kusage::callback f) {
+                _usage.set_low_watermark(used, std::move(f));
+            }
+
+            // the journal records the changes from now on, nullptr detaches it
+            void attach(kjournal* journal) {
+                _journal = journal;
+            }
+
+            /**
+             * the used IDs in a compact little-endian format, to ship the state of the tree
+             *
+             * a header of 32 bytes, then one container per block of 65536 IDs with a used ID, as in Roaring:
+             * its key, its type and for a partly used block the smallest of a sorted array of the low 16 bits,
+             * a list of runs or the data words, a full or empty block is found on the upper layers without its data words
+             *
+             * Roaring bitmaps
+             * see:
+             *      https://roaringbitmap.org/
+             *      https://arxiv.org/abs/1603.06549
+             */
+            std::vector<uint8_t> serialize() const {
+                std::vector<uint8_t> out(serial_header_bytes);
+                uint8_t* header = out.data();
+
+                std::memcpy(header, serial_magic, sizeof(serial_magic));
+                header = put_little_endian(header + sizeof(serial_magic), serial_version, 4);
+                header = put_little_endian(header, sizeof(T) * 8, 4);
+                header = put_little_endian(header, _size, 8);
+
+                uint64_t containers = 0;
+
+                for (T key = 0; key < get_container_count(); ++key) {
+                    const uint64_t* data = _layers[0] + key * container_words;
+                    T words = get_container_words(key);
+                    uint64_t used = get_container_ids(key);
+                    uint64_t runs = 1;
+                    uint8_t type = container_full;
+
+                    if (!is_container_full(key)) {
+                        if (is_container_empty(key)) {
+                            continue;
+                        }
+
+                        used = 0;
+                        runs = 0;
+                        uint64_t carry = 0;
+
+                        // a run starts at a used bit after a free one
+                        for (T i = 0; i < words; ++i) {
+                            uint64_t bits = data[i];
+
+                            if (bits != 0) {
+                                used += get_used_bit_count(bits);
+                                runs += get_used_bit_count(bits & ~((bits << 1) | carry));
+                            }
+
+                            carry = bits >> 63;
+                        }
+
+                        if (used < get_container_ids(key)) {
+                            type = get_container_type(used, runs, words);
+                        }
+                    }
+
+                    size_t offset = out.size();
+                    out.resize(offset + sizeof(T) + 1 + get_container_bytes(type, used, runs, words));
+
+                    uint8_t* pos = put_little_endian(out.data() + offset, key, sizeof(T));
+                    *pos++ = type;
+                    put_container(pos, type, data, words, used, runs);
+                    ++containers;
+                }
+
+                put_little_endian(out.data() + serial_header_bytes - 8, containers, 8);
+                return out;
+            }
+
+            /**
+             * the state of a serialized tree of the same size replaces the state of this tree,
+             * false and the tree unchanged if the bytes are not a serialized tree of this size,
+             * as a restore of a snapshot it is not recorded by an attached journal
+             */
+            bool deserialize(const uint8_t* data, size_t bytes) {
+                if (!read_containers(data, bytes, false)) {
+                    return false;
+                }
+
+                _arena.fill_zero();
+                read_containers(data, bytes, true);
+                _high = _slice;
+                build_summaries();
+                _high = get_last_used_word();
+                _usage.set(get_used_count());
+
+                return true;
+            }
+
+            /**
+             * change the number of IDs, false if an ID from size on is used or the arena cannot grow
+             *
+             * the IDs past the size are free words on every layer, within the capacity only the run
+             * summaries of the blocks between both sizes change, no word is copied,
+             * past the capacity the arena grows to twice the capacity, at least to size
+             *
+             * a file arena has a fixed size, a user buffer a fixed capacity, a resize is not journaled
+             */
+            bool resize(T size) {
+                if (_arena.header() != nullptr) {
+                    return false;
+                }
+
+                if (size < _size && find_next(size, true) >= 0) {
+                    return false;
+                }
+
+                if (size > _capacity) {
+                    T grown = _capacity > (~T{0} >> 1) ? ~T{0} : _capacity * 2;
+
+                    if (!reserve(std::max(size, grown))) {
+                        return false;
+                    }
+                }
+
+                T low = std::min(size, _size);
+                T high = std::max(size, _size);
+
+                _size = size;
+                set_up_size();
+
+                // the free runs at the end of the block of the old or the new last ID
+                for (T block = low >> 12; high > low && block <= (high - 1) >> 12; ++block) {
+                    set_block_dirty(block);
+                }
+
+                return true;
+            }
+
+            /**
+             * room for capacity IDs, false if the arena cannot grow: a file or a user buffer
+             *
+             * a word of a layer covers the same IDs at any capacity: the words which are not zero
+             * are copied at their indexes into the new arena, its new upper layers have only
+             * the path of the old top word, the used counts above are recomputed on demand
+             */
+            bool reserve(T capacity) {
+                if (capacity <= _capacity) {
+                    return true;
+                }
+
+                if (!_arena.is_growable()) {
+                    return false;
+                }
+
+                basic_kbtree grown{capacity, nullptr};
+                grown._arena.allocate_like(_arena, grown._words * sizeof(uint64_t));
+                grown.place_layers();
+
+                for (size_t layer = 0; layer < _depth; ++layer) {
+                    copy_words(_layers[layer], _slices[layer], grown._layers[layer]);
+
+                    if (layer > 0) {
+                        copy_words(_any[layer], _slices[layer], grown._any[layer]);
+                        copy_words(reinterpret_cast<uint64_t*>(_counts[layer]), get_count_words(layer),
+                                   reinterpret_cast<uint64_t*>(grown._counts[layer]));
+                    }
+                }
+
+                // the free runs of the subtrees are not copied, they are recomputed on demand
+                copy_words(reinterpret_cast<uint64_t*>(_runs), get_run_words(), reinterpret_cast<uint64_t*>(grown._runs));
+
+                if (_slices[0] > 0 && grown._depth > _depth) {
+                    if (is_full(_layers[_depth - 1][0])) {
+                        grown.mark_full(_depth, 0);
+                    }
+
+                    if (_any[_depth - 1][0] != 0) {
+                        grown.mark_any(_depth, 0, true);
+                    }
+                }
+
+                _capacity = capacity;
+                _depth = grown._depth;
+                _words = grown._words;
+                _slices = grown._slices;
+                _offsets = grown._offsets;
+                _any_offsets = grown._any_offsets;
+                _count_offsets = grown._count_offsets;
+                _subtree_run_offsets = grown._subtree_run_offsets;
+                _arena = std::move(grown._arena);
+                place_layers();
+
+                return true;
+            }
+
+            T size() const {
+                return _size;
+            }
+
+            // IDs without a copy of the arena
+            T capacity() const {
+                return _capacity;
+            }
+
+            // one past the last ID used since the last clear, rounded up to a data word: no memory past it is touched
+            T high_water() const {
+                return _high < _slice ? _high * 64 : _size;
+            }
+
+            // number of data layers
+            size_t depth() const {
+                return _depth;
+            }
+
+            T slice() const {
+                return _slice;
+            }
+
+            // bytes of the arena of a tree of size IDs
+            static size_t get_arena_bytes(T size) {
+                basic_kbtree layout{size, nullptr};
+                return layout._words * sizeof(uint64_t);
+            }
+
+        // public only for unit tests
+        public:
+            int64_t get_data(T id, bool is_index = true) const {
+                if (is_index) {
+                    if (id < _slice) {
+                        return _layers[0][id];
+                    } else {
+                        return -2;
+                    }
+                } else {
+                    if (id < _size) {
+                        div_mod id_dm = get_div_and_mod_by_64(id);
+                        return _layers[0][id_dm.div];
+                    } else {
+                        return -4;
+                    }
+                }
+            }
+
+            // 64 = 2**6, 63 = 64 - 1
+            static inline div_mod get_div_and_mod_by_64(T bits) {
+#if __cplusplus > 201703L  // C++20
+                return div_mod{ .div = bits >> 6,
+                                .mod = bits & 63 };
+#else
+                div_mod dm{};
+                dm.div = bits >> 6;
+                dm.mod = bits & 63;
+                return dm;
+#endif
+            }
+
+            static inline T get_div_or_plus_1(div_mod& dm) {
+                return dm.mod > 0 ? dm.div + 1 : dm.div;
+            }
+
+            static inline bool is_bit_on(uint64_t bits, uint8_t i) {
+                return (bits & get_on_64_bit(i)) > 0;
+            }
+
+            static inline void set_bit_on(uint64_t& bits, uint8_t i) {
+                bits |= get_on_64_bit(i);
+            }
+
+            static inline void set_bit_off(uint64_t& bits, uint8_t i) {
+                bits &= get_off_64_bit(i);
+            }
+
+            static inline void set_bit(uint64_t& bits, uint8_t i, bool on) {
+                on ? set_bit_on(bits, i) : set_bit_off(bits, i);
+            }
+
+            static inline bool is_full(uint64_t bits) {
+#if __cplusplus > 201703L  // C++20
+                return std::popcount(bits) == 64;
+#else
+    #ifndef DE_BRUIJN_SEQUENCE
+                return __builtin_popcountll(bits) == 64;
+    #else
+                return bits == 0xFFFFFFFFFFFFFFFF;
+    #endif
+#endif
+            }
+
+            static inline int32_t find_first_free_bit(uint64_t bits) {
+#if __cplusplus > 201703L  // C++20
+                int32_t offset = std::countr_one(bits);
+                return offset < 64 ? offset : -1;
+#else
+    #ifndef DE_BRUIJN_SEQUENCE
+                return __builtin_ffsll(~bits) - 1;
+    #else
+                static constexpr std::array<uint8_t, 64> de_bruijn_64 = {
+                     0,  1, 48,  2, 57, 49, 28,  3,
+                    61, 58, 50, 42, 38, 29, 17,  4,
+                    62, 55, 59, 36, 53, 51, 43, 22,
+                    45, 39, 33, 30, 24, 18, 12,  5,
+                    63, 47, 56, 27, 60, 41, 37, 16,
+                    54, 35, 52, 21, 44, 32, 23, 11,
+                    46, 26, 40, 15, 34, 20, 31, 10,
+                    25, 14, 19,  9, 13,  8,  7,  6
+                };
+
+                static constexpr uint64_t de_bruijn_magic = 0x03F79D71B4CB0A89;
+
+                if (bits == 0xFFFFFFFFFFFFFFFF) {
+                    return -1;
+                }
+
+                bits  = ~bits;
+                bits &= -bits;
+                bits *=  de_bruijn_magic;
+                uint8_t v = bits >> 58;
+
+                return de_bruijn_64[v];
+    #endif
+#endif
+            }
+
+        private:
+            // free runs of a block of 4096 IDs, recomputed on demand once the block is modified
+            struct run_summary {
+                uint16_t prefix;
+                uint16_t suffix;
+                uint16_t longest;
+                uint16_t is_clean;  // clean_runs, clean_count, zero: modified since computed
+            };
+
+            // free runs of the subtree of a word of the third layer up, below the top word
+            struct subtree_runs {
+                T prefix;
+                T suffix;
+                T longest;
+                T is_clean;         // clean_runs, zero: modified since computed
+            };
+
+            // the free runs of a block or of a subtree, as read by the search
+            struct run_lengths {
+                T prefix;
+                T suffix;
+                T longest;
+            };
+
+            static constexpr uint16_t clean_runs = 1;
+            static constexpr uint16_t clean_count = 2;    // the used count of the block on the second layer
+
+            // the top bit of a used count of the third layer up: not modified since computed
+            static constexpr T count_clean = T{1} << (sizeof(T) * 8 - 1);
+
+            // max 6 data layers: 2^32 = (2^6)^5 x (2^2)
+            // max 11 data layers: 2^64 = (2^6)^10 x (2^4)
+            static constexpr size_t max_depth = sizeof(T) == 4 ? 6 : 11;
+
+            T _size;
+            T _capacity;    // IDs of the layout of the arena, the IDs from _size on are free and never handed out
+            T _slice = 0;   // data words of _size IDs
+            T _blocks = 0;  // blocks of _size IDs
+            T _high = 0;    // one past the last data word used since the last clear: the high-water mark
+            size_t _depth = 0;
+            size_t _words = 0;
+            std::array<T, max_depth> _slices;
+            std::array<size_t, max_depth> _offsets;
+            std::array<uint64_t*, max_depth> _layers;
+            std::array<size_t, max_depth> _any_offsets;
+            std::array<uint64_t*, max_depth> _any;     // the data layer, then the "any used" layers
+            std::array<size_t, max_depth> _count_offsets;
+            std::array<T*, max_depth> _counts;         // used IDs under each word of the upper layers
+            std::array<size_t, max_depth> _subtree_run_offsets;
+            std::array<subtree_runs*, max_depth> _subtree_runs;    // from the third layer up, below the top word
+            run_summary* _runs = nullptr;
+            karena _arena;
+            kjournal* _journal = nullptr;
+            kusage _usage;
+
+            // the header of a file arena, little-endian
+            struct file_header {
+                char magic[8];
+                uint32_t version;
+                uint32_t id_bits;       // 32 or 64
+                uint64_t size;
+                uint64_t arena_bytes;
+                uint32_t state;         // file_clean or file_dirty
+                uint32_t unused;
+                uint64_t used;          // the used count of a clean close, or no_used_count
+                uint8_t reserved[16];
+            };
+
+            static_assert(sizeof(file_header) == 64, "a file header of one cache line");
+
+            static constexpr char file_magic[8] = "KUPIDBT";
+            static constexpr uint32_t file_version = 5;
+            static constexpr uint32_t file_clean = 1;
+            static constexpr uint32_t file_dirty = 2;
+            static constexpr uint64_t no_used_count = UINT64_MAX;
+
+            // a serialized tree: magic, version, bits of an ID, size and number of containers
+            static constexpr char serial_magic[8] = "KUPIDSR";
+            static constexpr uint32_t serial_version = 1;
+            static constexpr size_t serial_header_bytes = 32;
+
+            // a container of 65536 IDs: 1024 data words, 16 words on the second layer
+            static constexpr T container_ids = 65536;
+            static constexpr T container_words = 1024;
+
+            // full: no payload
+            // array: count - 1, then the sorted used IDs, 2 bytes each
+            // runs: count - 1, then the first ID and the length - 1 of each run, 2 bytes each
+            // bitmap: the data words, 8 bytes each
+            static constexpr uint8_t container_full = 0;
+            static constexpr uint8_t container_array = 1;
+            static constexpr uint8_t container_runs = 2;
+            static constexpr uint8_t container_bitmap = 3;
+            static constexpr uint64_t container_array_max = 4096;
+
+        private:
+            // only the layout, without an arena
+            basic_kbtree(T size, std::nullptr_t)
+                : _size{size},
+                  _capacity{size}
+            {
+                set_up_layout();
+            }
+
+#if defined(__unix__) || defined(__APPLE__)
+            void open_file(const char* path) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+                throw std::runtime_error("kbtree: a file arena needs a little-endian host");
+#endif
+                bool is_created = _arena.map_file(path, get_arena_bytes(_size), sizeof(file_header));
+                file_header* header = reinterpret_cast<file_header*>(_arena.header());
+
+                if (is_created) {
+                    std::memcpy(header->magic, file_magic, sizeof(file_magic));
+                    header->version = file_version;
+                    header->id_bits = sizeof(T) * 8;
+                    header->size = _size;
+                    header->arena_bytes = get_arena_bytes(_size);
+                    header->state = file_clean;
+                    header->used = 0;
+                } else if (std::memcmp(header->magic, file_magic, sizeof(file_magic)) != 0) {
+                    throw std::runtime_error("kbtree: not a kbtree file");
+                } else if (header->version != file_version) {
+                    throw std::runtime_error("kbtree: unsupported file version");
+                } else if (header->id_bits != sizeof(T) * 8 || header->size != _size ||
+                           header->arena_bytes != get_arena_bytes(_size)) {
+                    throw std::runtime_error("kbtree: file of another tree size");
+                }
+
+                place_layers();
+
+                // dirty on disk until a clean close, a crash in between leaves it dirty,
+                // the destructor writes the used count before the clean flag
+                bool is_clean = header->state == file_clean;
+                uint64_t used = header->used;
+                header->state = file_dirty;
+                header->used = no_used_count;
+                _arena.sync();
+                _arena.set_clean_flag(&header->state, file_clean);
+
+                if (!is_clean) {
+                    _high = _slice;
+                    rebuild_summaries();
+                }
+
+                // a count in O(1), a scan of the data layer only if the file was not closed cleanly
+                _high = get_last_used_word();
+                _usage.set(is_clean && used != no_used_count ? used : get_used_count());
+            }
+#endif
+
+            // the upper layers and the run summaries from the data layer only
+            void rebuild_summaries() {
+                for (size_t layer = 1; layer < _depth; ++layer) {
+                    std::memset(_layers[layer], 0, get_aligned_words(_slices[layer]) * sizeof(uint64_t));
+                    std::memset(_any[layer], 0, get_aligned_words(_slices[layer]) * sizeof(uint64_t));
+                }
+
+                std::memset(_runs, 0, get_run_words() * sizeof(uint64_t));
+
+                for (size_t layer = 1; layer < _depth; ++layer) {
+                    std::memset(_counts[layer], 0, get_count_words(layer) * sizeof(uint64_t));
+                }
+
+                for (size_t layer = 2; layer + 1 < _depth; ++layer) {
+                    std::memset(_subtree_runs[layer], 0, get_subtree_run_words(layer) * sizeof(uint64_t));
+                }
+
+                build_summaries();
+            }
+
+            // slices of the layers of the capacity and their offsets in the arena: the top layer first, 64-byte aligned
+            void set_up_layout() {
+                T slice = _capacity;
+                div_mod dm;
+
+                do {
+                    dm = get_div_and_mod_by_64(slice);
+                    slice = get_div_or_plus_1(dm);
+                    _slices[_depth++] = slice;
+                } while (dm.div > 0);
+
+                set_up_size();
+
+                for (size_t layer = _depth; layer > 0; --layer) {
+                    _offsets[layer - 1] = _words;
+                    _words += get_aligned_words(_slices[layer - 1]);
+                }
+
+                // the run summaries follow the data layer, one word each
+                _words += get_run_words();
+
+                // then the "any used" layers, from the second layer up
+                for (size_t layer = 1; layer < _depth; ++layer) {
+                    _any_offsets[layer] = _words;
+                    _words += get_aligned_words(_slices[layer]);
+                }
+
+                // then the used counts, from the second layer up
+                for (size_t layer = 1; layer < _depth; ++layer) {
+                    _count_offsets[layer] = _words;
+                    _words += get_count_words(layer);
+                }
+
+                // then the free runs of the subtrees, from the third layer up to below the top word
+                for (size_t layer = 2; layer + 1 < _depth; ++layer) {
+                    _subtree_run_offsets[layer] = _words;
+                    _words += get_subtree_run_words(layer);
+                }
+            }
+
+            // the data words and the blocks of _size IDs
+            void set_up_size() {
+                div_mod slice_dm = get_div_and_mod_by_64(_size);
+                _slice = get_div_or_plus_1(slice_dm);
+
+                div_mod block_dm = get_div_and_mod_by_64(_slice);
+                _blocks = get_div_or_plus_1(block_dm);
+            }
+
+            // a run summary per block of the capacity, in 64-byte aligned words
+            size_t get_run_words() const {
+                div_mod block_dm = get_div_and_mod_by_64(_slices[0]);
+                return get_aligned_words(get_div_or_plus_1(block_dm));
+            }
+
+            // a T per word of the layer, in 64-byte aligned words
+            size_t get_count_words(size_t layer) const {
+                return get_aligned_words((_slices[layer] * sizeof(T) + 7) / 8);
+            }
+
+            // a subtree_runs per word of the layer, in 64-byte aligned words
+            size_t get_subtree_run_words(size_t layer) const {
+                return get_aligned_words(_slices[layer] * sizeof(subtree_runs) / 8);
+            }
+
+            void place_layers() {
+                uint64_t* words = _arena.words();
+
+                for (size_t layer = 0; layer < _depth; ++layer) {
+                    _layers[layer] = words + _offsets[layer];
+                }
+
+                _runs = reinterpret_cast<run_summary*>(words + _offsets[0] + get_aligned_words(_slices[0]));
+                _any[0] = _layers[0];
+
+                for (size_t layer = 1; layer < _depth; ++layer) {
+                    _any[layer] = words + _any_offsets[layer];
+                    _counts[layer] = reinterpret_cast<T*>(words + _count_offsets[layer]);
+                }
+
+                for (size_t layer = 2; layer + 1 < _depth; ++layer) {
+                    _subtree_runs[layer] = reinterpret_cast<subtree_runs*>(words + _subtree_run_offsets[layer]);
+                }
+            }
+
+            // only the words which are not zero: the pages of a mapped arena stay uncommitted
+            static void copy_words(const uint64_t* from, size_t words, uint64_t* to) {
+                for (size_t i = 0; i < words; ++i) {
+                    if (from[i] != 0) {
+                        to[i] = from[i];
+                    }
+                }
+            }
+
+            // 8 words = 64 bytes
+            static size_t get_aligned_words(size_t words) {
+                return (words + 7) & ~size_t{7};
+            }
+
+            static uint64_t get_on_64_bit(uint8_t i) {
+                // { 1UL << i, i = [0, 64) }
+                static constexpr std::array<uint64_t, 64> on_64 = {
+                    1UL << 0,  1UL << 1,  1UL << 2,  1UL << 3,
+                    1UL << 4,  1UL << 5,  1UL << 6,  1UL << 7,
+                    1UL << 8,  1UL << 9,  1UL << 10, 1UL << 11,
+                    1UL << 12, 1UL << 13, 1UL << 14, 1UL << 15,
+                    1UL << 16, 1UL << 17, 1UL << 18, 1UL << 19,
+                    1UL << 20, 1UL << 21, 1UL << 22, 1UL << 23,
+                    1UL << 24, 1UL << 25, 1UL << 26, 1UL << 27,
+                    1UL << 28, 1UL << 29, 1UL << 30, 1UL << 31,
+                    1UL << 32, 1UL << 33, 1UL << 34, 1UL << 35,
+                    1UL << 36, 1UL << 37, 1UL << 38, 1UL << 39,
+                    1UL << 40, 1UL << 41, 1UL << 42, 1UL << 43,
+                    1UL << 44, 1UL << 45, 1UL << 46, 1UL << 47,
+                    1UL << 48, 1UL << 49, 1UL << 50, 1UL << 51,
+                    1UL << 52, 1UL << 53, 1UL << 54, 1UL << 55,
+                    1UL << 56, 1UL << 57, 1UL << 58, 1UL << 59,
+                    1UL << 60, 1UL << 61, 1UL << 62, 1UL << 63
+                };
+
+                return on_64[i];
+            }
+
+            static uint64_t get_off_64_bit(uint8_t i) {
+                // { ~(1UL << i), i = [0, 64) }
+                static constexpr std::array<uint64_t, 64> off_64 = {
+                    ~(1UL << 0),  ~(1UL << 1),  ~(1UL << 2),  ~(1UL << 3),
+                    ~(1UL << 4),  ~(1UL << 5),  ~(1UL << 6),  ~(1UL << 7),
+                    ~(1UL << 8),  ~(1UL << 9),  ~(1UL << 10), ~(1UL << 11),
+                    ~(1UL << 12), ~(1UL << 13), ~(1UL << 14), ~(1UL << 15),
+                    ~(1UL << 16), ~(1UL << 17), ~(1UL << 18), ~(1UL << 19),
+                    ~(1UL << 20), ~(1UL << 21), ~(1UL << 22), ~(1UL << 23),
+                    ~(1UL << 24), ~(1UL << 25), ~(1UL << 26), ~(1UL << 27),
+                    ~(1UL << 28), ~(1UL << 29), ~(1UL << 30), ~(1UL << 31),
+                    ~(1UL << 32), ~(1UL << 33), ~(1UL << 34), ~(1UL << 35),
+                    ~(1UL << 36), ~(1UL << 37), ~(1UL << 38), ~(1UL << 39),
+                    ~(1UL << 40), ~(1UL << 41), ~(1UL << 42), ~(1UL << 43),
+                    ~(1UL << 44), ~(1UL << 45), ~(1UL << 46), ~(1UL << 47),
+                    ~(1UL << 48), ~(1UL << 49), ~(1UL << 50), ~(1UL << 51),
+                    ~(1UL << 52), ~(1UL << 53), ~(1UL << 54), ~(1UL << 55),
+                    ~(1UL << 56), ~(1UL << 57), ~(1UL << 58), ~(1UL << 59),
+                    ~(1UL << 60), ~(1UL << 61), ~(1UL << 62), ~(1UL << 63)
+                };
+
+                return off_64[i];
+            }
+
+            // index of the first data word with a free bit, or -1
+            int64_t find_first_free_word() const {
+                T rank = 0;
+
+                for (size_t layer = _depth - 1; layer > 0; --layer) {
+                    int32_t offset = find_first_free_bit(_layers[layer][rank]);
+
+                    if (offset < 0) {
+                        return -1;
+                    }
+
+                    rank *= 64;
+                    rank += offset;
+
+                    // the first free bit is past the last word of the lower layer
+                    if (rank >= _slices[layer - 1]) {
+                        return -1;
+                    }
+                }
+
+                return _slices[0] > 0 ? rank : -1;
+            }
+
+            // the bits of the upper layers from the data layer, bottom-up, a word of a layer at a time, up to the high-water mark
+            void build_summaries() {
+                T high = _high;
+
+                for (size_t layer = 1; layer < _depth; ++layer) {
+                    const uint64_t* lower = _layers[layer - 1];
+                    const uint64_t* lower_any = _any[layer - 1];
+                    T slice = std::min(_slices[layer - 1], high);
+                    high = high / 64 + (high % 64 > 0 ? 1 : 0);
+
+                    for (T index = 0; index < high; ++index) {
+                        T first = index * 64;
+                        T last = std::min(slice, first + 64);
+                        uint64_t full = 0;
+                        uint64_t any = 0;
+
+                        for (T child = first; child < last; ++child) {
+                            full |= uint64_t{lower[child] == ~uint64_t{0}} << (child - first);
+                            any |= uint64_t{lower_any[child] != 0} << (child - first);
+                        }
+
+                        // the zero words of a mapped arena are not written, their pages stay uncommitted
+                        if (full != 0) {
+                            _layers[layer][index] = full;
+                        }
+
+                        if (any != 0) {
+                            _any[layer][index] = any;
+                        }
+                    }
+                }
+            }
+
+            // the word at index of the lower layer is full, mark it on this layer and upwards
+            void mark_full(size_t layer, T index) {
+                for (; layer < _depth; ++layer) {
+                    div_mod index_dm = get_div_and_mod_by_64(index);
+                    uint64_t& data = _layers[layer][index_dm.div];
+                    set_bit_on(data, index_dm.mod);
+
+                    if (!is_full(data)) {
+                        break;
+                    }
+
+                    index = index_dm.div;
+                }
+            }
+
+            // the word at index of the lower layer has a free bit, mark it on this layer and upwards
+            void mark_free(size_t layer, T index) {
+                for (; layer < _depth; ++layer) {
+                    div_mod index_dm = get_div_and_mod_by_64(index);
+                    set_bit_off(_layers[layer][index_dm.div], index_dm.mod);
+                    index = index_dm.div;
+                }
+            }
+
+            // the word at index of the lower layer became empty or not, mark it on the "any used" layers upwards
+            void mark_any(size_t layer, T index, bool is_any) {
+                for (; layer < _depth; ++layer) {
+                    div_mod index_dm = get_div_and_mod_by_64(index);
+                    uint64_t& data = _any[layer][index_dm.div];
+                    bool was_empty = data == 0;
+                    set_bit(data, index_dm.mod, is_any);
+
+                    // the word itself stays empty or not empty: nothing changes above
+                    if (is_any ? !was_empty : data != 0) {
+                        break;
+                    }
+
+                    index = index_dm.div;
+                }
+            }
+
+            /**
+             * the used or free candidates of the word at index of the layer:
+             * used IDs or words which are not empty, free IDs or words which are not full,
+             * without the bits past the last ID or word
+             */
+            uint64_t get_candidates(size_t layer, T index, bool is_used) const {
+                uint64_t bits = is_used ? _any[layer][index] : ~_layers[layer][index];
+                T count = layer == 0 ? _size : _slices[layer - 1];
+                T first = index * 64;
+
+                if (count - first < 64) {
+                    bits &= get_on_64_bit(count - first) - 1;
+                } else if (first > count) {
+                    bits = 0;   // a word past the last ID, after a shrink
+                }
+
+                return bits;
+            }
+
+            // the lowest used or free ID from id on, or -1: up the layers to a candidate, then down its first one
+            int64_t find_next(T id, bool is_used) const {
+                if (id >= _size) {
+                    return -1;
+                }
+
+                // past the high-water mark no ID is used, and every one is free
+                if ((id >> 6) >= _high) {
+                    return is_used ? -1 : static_cast<int64_t>(id);
+                }
+
+                size_t layer = 0;
+                T pos = id;
+
+                for (;;) {
+                    div_mod pos_dm = get_div_and_mod_by_64(pos);
+                    uint64_t bits = 0;
+
+                    if (pos_dm.div < _slices[layer]) {
+                        bits = get_candidates(layer, pos_dm.div, is_used) & ~(get_on_64_bit(pos_dm.mod) - 1);
+                    }
+
+                    if (bits != 0) {
+                        pos = pos_dm.div * 64 + find_first_free_bit(~bits);
+                        break;
+                    }
+
+                    // the rest of the word has no candidate, on to the next word of this layer
+                    if (++layer == _depth) {
+                        return -1;
+                    }
+
+                    pos = pos_dm.div + 1;
+                }
+
+                while (layer-- > 0) {
+                    uint64_t bits = get_candidates(layer, pos, is_used);
+
+                    // a partial last word is never full: the free bits may all be past the last ID
+                    if (bits == 0) {
+                        return -1;
+                    }
+
+                    pos = pos * 64 + find_first_free_bit(~bits);
+                }
+
+                return pos;
+            }
+
+            // f(base, bits) for every data word with a used or free ID, until f returns false
+            template<typename F>
+            void for_each_word(bool is_used, F f) const {
+                int64_t id = find_next(0, is_used);
+
+                while (id >= 0) {
+                    T index = id >> 6;
+                    uint64_t bits = index < _high ? get_candidates(0, index, is_used) : get_tail_mask(index);
+                    bits &= ~(get_on_64_bit(id & 63) - 1);
+
+                    if (!f(index * 64, bits)) {
+                        return;
+                    }
+
+                    uint64_t next = (uint64_t{index} + 1) * 64;
+                    id = next < _size ? find_next(next, is_used) : -1;
+                }
+            }
+
+            template<typename F>
+            void for_each(bool is_used, F& f) const {
+                for_each_word(is_used, [&f](T base, uint64_t bits) {
+                    for (; bits != 0; bits &= bits - 1) {
+                        f(base + find_first_free_bit(~bits));
+                    }
+
+                    return true;
+                });
+            }
+
+            // the bits of the IDs of the data word at index, up to the last ID
+            uint64_t get_tail_mask(T index) const {
+                T base = index * 64;
+                return _size - base < 64 ? get_on_64_bit(_size - base) - 1 : ~uint64_t{0};
+            }
+
+            // one past the last data word with a used ID, down the "any used" layers
+            T get_last_used_word() const {
+                if (_slices[0] == 0 || _any[_depth - 1][0] == 0) {
+                    return 0;
+                }
+
+                T index = 0;
+
+                for (size_t layer = _depth - 1; layer > 0; --layer) {
+                    index = index * 64 + find_last_used_bit(_any[layer][index]);
+                }
+
+                return index + 1;
+            }
+
+            // every word up to the high-water mark zeroed on each layer
+            void clear_high() {
+                T words = _high;
+
+                for (size_t layer = 0; layer < _depth; ++layer) {
+                    _arena.fill_zero(_layers[layer], words);
+
+                    if (layer > 0) {
+                        _arena.fill_zero(_any[layer], words);
+                        _arena.fill_zero(reinterpret_cast<uint64_t*>(_counts[layer]), (words * sizeof(T) + 7) / 8);
+                    }
+
+                    if (layer >= 2 && layer + 1 < _depth) {
+                        _arena.fill_zero(reinterpret_cast<uint64_t*>(_subtree_runs[layer]), words * sizeof(subtree_runs) / 8);
+                    }
+
+                    words = words / 64 + (words % 64 > 0 ? 1 : 0);
+
+                    // a run summary per word of the second layer
+                    if (layer == 0) {
+                        _arena.fill_zero(reinterpret_cast<uint64_t*>(_runs), words);
+                    }
+                }
+            }
+
+            /**
+             * the word at index of the layer zeroed, with its count and run summary, and the words
+             * under it with a used ID: a full bit is only above a word with a used ID
+             */
+            void clear_used(size_t layer, T index) {
+                if (layer == 0) {
+                    _layers[0][index] = 0;
+                    return;
+                }
+
+                for (uint64_t bits = _any[layer][index]; bits != 0; bits &= bits - 1) {
+                    clear_used(layer - 1, index * 64 + find_first_free_bit(~bits));
+                }
+
+                _layers[layer][index] = 0;
+                _any[layer][index] = 0;
+                _counts[layer][index] = 0;
+
+                if (layer == 1) {
+                    _runs[index] = run_summary{};
+                } else if (layer + 1 < _depth) {
+                    _subtree_runs[layer][index] = subtree_runs{};
+                }
+            }
+
+            // data word with the bits past the last ID on
+            uint64_t get_padded_data(T index) const {
+                uint64_t data = _layers[0][index];
+                T base = index * 64;
+
+                if (_size - base < 64) {
+                    data |= ~(get_on_64_bit(_size - base) - 1);
+                } else if (base > _size) {
+                    data = ~uint64_t{0};
+                }
+
+                return data;
+            }
+
+            // the block was modified, so are the used counts and the free runs above it which were clean
+            void set_block_dirty(T block) {
+                run_summary& runs = _runs[block];
+
+                if (runs.is_clean != 0) {
+                    runs.is_clean = 0;
+
+                    for (size_t layer = 2; layer < _depth; ++layer) {
+                        block >>= 6;
+                        T& count = _counts[layer][block];
+                        subtree_runs* subtree = layer + 1 < _depth ? &_subtree_runs[layer][block] : nullptr;
+
+                        // a modified count has no clean count above it, so have modified runs
+                        if ((count & count_clean) == 0 && (subtree == nullptr || subtree->is_clean == 0)) {
+                            break;
+                        }
+
+                        count = 0;
+
+                        if (subtree != nullptr) {
+                            subtree->is_clean = 0;
+                        }
+                    }
+                }
+            }
+
+            // IDs under the word at index of the layer
+            T get_subtree_ids(size_t layer, T index) const {
+                T first = index << (6 * (layer + 1));
+                T ids = T{1} << (6 * (layer + 1));
+
+                if (first >= _size) {
+                    return 0;
+                }
+
+                return _size - first < ids ? _size - first : ids;
+            }
+
+            // used IDs under the word at index of the layer, an empty or a full word without its counts
+            T get_used(size_t layer, T index) {
+                if (_any[layer][index] == 0) {
+                    return 0;
+                } else if (layer == 0) {
+                    return get_used_bit_count(_layers[0][index]);
+                } else if (is_full(_layers[layer][index])) {
+                    return T{1} << (6 * (layer + 1));
+                } else {
+                    return get_count(layer, index);
+                }
+            }
+
+            /**
+             * the used count of the word at index of an upper layer, recomputed from the layer below
+             * if modified, every count below a clean count is clean: a modified block walks up
+             * only until a modified count
+             */
+            T get_count(size_t layer, T index) {
+                if (layer == 1) {
+                    run_summary& runs = _runs[index];
+
+                    if ((runs.is_clean & clean_count) == 0) {
+                        T used = 0;
+                        T last = std::min(_slice, (index + 1) * 64);
+
+                        for (T word = index * 64; word < last; ++word) {
+                            used += get_used_bit_count(_layers[0][word]);
+                        }
+
+                        _counts[1][index] = used;
+                        runs.is_clean |= clean_count;
+                    }
+
+                    return _counts[1][index];
+                }
+
+                T& count = _counts[layer][index];
+
+                if ((count & count_clean) == 0) {
+                    T used = 0;
+                    T last = std::min(_slices[layer - 1], (index + 1) * 64);
+
+                    for (T child = index * 64; child < last; ++child) {
+                        used += get_count(layer - 1, child);
+                    }
+
+                    count = used | count_clean;
+                }
+
+                return count & ~count_clean;
+            }
+
+            // used or free IDs under the word at index of the layer
+            T get_kind_count(size_t layer, T index, bool is_used) {
+                T used = get_used(layer, index);
+                return is_used ? used : get_subtree_ids(layer, index) - used;
+            }
+
+            /**
+             * the k-th used or free ID, k below their number, one word per layer down,
+             * the children of a word are counted from the end nearer to k
+             */
+            int64_t find_kth(T k, bool is_used) {
+                T word = 0;
+                T rest = is_used ? used_count() : free_count();   // of the kind under the word
+
+                for (size_t layer = _depth - 1; layer > 0; --layer) {
+                    T first = word * 64;
+                    T last = std::min(_slices[layer - 1], first + 64);
+                    T child;
+
+                    // the last child to count holds the rest
+                    if (k < rest / 2) {
+                        for (child = first; child + 1 < last; ++child) {
+                            T count = get_kind_count(layer - 1, child, is_used);
+
+                            if (k < count) {
+                                rest = count;
+                                break;
+                            }
+
+                            k -= count;
+                            rest -= count;
+                        }
+                    } else {
+                        T r = rest - 1 - k;     // from the end
+
+                        for (child = last - 1; child > first; --child) {
+                            T count = get_kind_count(layer - 1, child, is_used);
+
+                            if (r < count) {
+                                rest = count;
+                                break;
+                            }
+
+                            r -= count;
+                            rest -= count;
+                        }
+
+                        k = rest - 1 - r;
+                    }
+
+                    word = child;
+                }
+
+                uint64_t bits = is_used ? _layers[0][word] : ~get_padded_data(word);
+                return word * 64 + kscan::select_bit(bits, k);
+            }
+
+            // words of the layer, the second layer up, under the _size IDs
+            T get_run_nodes(size_t layer) const {
+                return _blocks == 0 ? 0 : ((_blocks - 1) >> (6 * (layer - 1))) + 1;
+            }
+
+            /**
+             * the first ID of the first run of len free IDs which ends in the subtree of the word
+             * at index of the layer, the third layer up, or -1, run: the free IDs just before
+             * the subtree, then at its end
+             *
+             * a subtree which can neither complete the run nor hold it is skipped, the summary
+             * of a subtree is only read below the high-water mark, the IDs past it are free
+             */
+            int64_t find_range(size_t layer, T index, T len, T& run) {
+                T first = index << (6 * (layer + 1));
+                T ids = get_subtree_ids(layer, index);
+
+                if ((index << (6 * layer)) >= _high) {
+                    if (run + ids >= len) {
+                        return first - run;
+                    }
+
+                    run += ids;
+                    return -1;
+                }
+
+                // a subtree across the mark is searched in its children
+                if (std::min(_slice, (index + 1) << (6 * layer)) <= _high) {
+                    const subtree_runs& runs = get_subtree_runs(layer, index);
+
+                    if (run + runs.prefix >= len) {
+                        return first - run;
+                    }
+
+                    if (runs.longest < len) {
+                        run = runs.prefix == ids ? run + runs.prefix : runs.suffix;
+                        return -1;
+                    }
+                }
+
+                T last = std::min(get_run_nodes(layer - 1), (index + 1) * 64);
+
+                if (layer == 2) {
+                    return find_block_range(index * 64, last, len, run);
+                }
+
+                for (T child = index * 64; child < last; ++child) {
+                    int64_t found = find_range(layer - 1, child, len, run);
+
+                    if (found >= 0) {
+                        return found;
+                    }
+                }
+
+                return -1;
+            }
+
+            // find_range() over the blocks [first_block, last_block)
+            int64_t find_block_range(T first_block, T last_block, T len, T& run) {
+                for (T block = first_block; block < last_block; ++block) {
+                    T first = block * 4096;
+                    T ids = _size - first < 4096 ? _size - first : 4096;
+
+                    // the IDs past the high-water mark are free, their blocks are not read
+                    if (block * 64 >= _high) {
+                        if (run + ids >= len) {
+                            return first - run;
+                        }
+
+                        run += ids;
+                        continue;
+                    }
+
+                    const run_summary& runs = get_runs(block);
+
+                    if (run + runs.prefix >= len) {
+                        return first - run;
+                    }
+
+                    if (runs.longest >= len) {
+                        return find_run(block, len);
+                    }
+
+                    run = runs.prefix == ids ? run + runs.prefix : runs.suffix;
+                }
+
+                return -1;
+            }
+
+            run_lengths get_run_lengths(size_t layer, T index) {
+                if (layer == 1) {
+                    const run_summary& runs = get_runs(index);
+                    return run_lengths{runs.prefix, runs.suffix, runs.longest};
+                }
+
+                const subtree_runs& runs = get_subtree_runs(layer, index);
+                return run_lengths{runs.prefix, runs.suffix, runs.longest};
+            }
+
+            // free runs of the subtree of a word of the third layer up, joined from its children if modified
+            const subtree_runs& get_subtree_runs(size_t layer, T index) {
+                subtree_runs& runs = _subtree_runs[layer][index];
+
+                if (runs.is_clean & clean_runs) {
+                    return runs;
+                }
+
+                T run = 0;
+                T longest = 0;
+                T prefix = 0;
+                bool is_prefix = true;
+
+                T last = std::min(get_run_nodes(layer - 1), (index + 1) * 64);
+
+                for (T child = index * 64; child < last; ++child) {
+                    run_lengths child_runs = get_run_lengths(layer - 1, child);
+                    longest = std::max(longest, std::max(child_runs.longest, run + child_runs.prefix));
+
+                    // a free child extends the run across it
+                    if (child_runs.prefix == get_subtree_ids(layer - 1, child)) {
+                        run += child_runs.prefix;
+                        continue;
+                    }
+
+                    if (is_prefix) {
+                        prefix = run + child_runs.prefix;
+                        is_prefix = false;
+                    }
+
+                    run = child_runs.suffix;
+                }
+
+                runs.prefix = is_prefix ? run : prefix;
+                runs.suffix = run;
+                runs.longest = std::max(longest, run);
+                runs.is_clean = clean_runs;
+
+                return runs;
+            }
+
+            const run_summary& get_runs(T block) {
+                run_summary& runs = _runs[block];
+
+                if (runs.is_clean & clean_runs) {
+                    return runs;
+                }
+
+                T run = 0;
+                T longest = 0;
+                T prefix = 0;
+                bool is_prefix = true;
+
+                T last = std::min(_slice, (block + 1) * 64);
+
+                for (T index = block * 64; index < last; ++index) {
+                    uint64_t data = get_padded_data(index);
+                    uint32_t pos = 0;
+
+                    while (pos < 64) {
+                        uint64_t rest = data >> pos;
+
+                        if (rest == 0) {
+                            run += 64 - pos;
+                            break;
+                        }
+
+                        // free bits up to the next used one, then close the run
+                        uint32_t free_len = find_first_free_bit(~rest);
+                        run += free_len;
+                        pos += free_len;
+
+                        if (is_prefix) {
+                            prefix = run;
+                            is_prefix = false;
+                        }
+
+                        longest = std::max(longest, run);
+                        run = 0;
+
+                        int32_t used_len = find_first_free_bit(data >> pos);
+                        pos += used_len < 0 ? 64 : used_len;
+                    }
+                }
+
+                runs.prefix = is_prefix ? run : prefix;
+                runs.suffix = run;
+                runs.longest = std::max(longest, run);
+                runs.is_clean |= clean_runs;
+
+                return runs;
+            }
+
+            // first ID of the first run of len free IDs inside the block
+            T find_run(T block, T len) const {
+                T run = 0;
+                T last = std::min(_slice, (block + 1) * 64);
+
+                for (T index = block * 64; index < last; ++index) {
+                    uint64_t data = get_padded_data(index);
+                    uint32_t pos = 0;
+
+                    while (pos < 64) {
+                        uint64_t rest = data >> pos;
+
+                        if (rest == 0) {
+                            run += 64 - pos;
+                            break;
+                        }
+
+                        uint32_t free_len = find_first_free_bit(~rest);
+                        run += free_len;
+                        pos += free_len;
+
+                        if (run >= len) {
+                            return index * 64 + pos - run;
+                        }
+
+                        run = 0;
+
+                        int32_t used_len = find_first_free_bit(data >> pos);
+                        pos += used_len < 0 ? 64 : used_len;
+                    }
+
+                    if (run >= len) {
+                        return index * 64 + 64 - run;
+                    }
+                }
+
+                return block * 4096;  // not reached: the block holds a long enough run
+            }
+
+            int64_t claim_range(T first, T len, bool is_using) {
+                if (is_using) {
+                    set_range_state(first, len, true);
+                }
+
+                return first;
+            }
+
+            /**
+             * set the state of [first, first + len) with a mask per data word,
+             * the words inside the range are all used or all free, so are their bits
+             * on the upper layers, only the words at both ends of the range are checked
+             * on each layer, instead of one walk up the tree per ID
+             */
+            void set_range_state(T first, T len, bool state) {
+                T low = first;
+                T high = first + (len - 1);
+                uint64_t fill = state ? ~uint64_t{0} : 0;
+
+                if (_journal != nullptr) {
+                    _journal->append_range(first, len, state);
+                }
+
+                T used = get_used_count(low, high);
+
+                if (state && (high >> 6) >= _high) {
+                    _high = (high >> 6) + 1;
+                }
+
+                fill_bits(_layers[0], low, high, fill);
+
+                for (T block = low >> 12; block <= high >> 12; ++block) {
+                    set_block_dirty(block);
+                }
+
+                for (size_t layer = 1; layer < _depth; ++layer) {
+                    low >>= 6;
+                    high >>= 6;
+
+                    fill_bits(_layers[layer], low, high, fill);
+                    set_bit(_layers[layer][low >> 6], low & 63, is_full(_layers[layer - 1][low]));
+                    set_bit(_layers[layer][high >> 6], high & 63, is_full(_layers[layer - 1][high]));
+
+                    fill_bits(_any[layer], low, high, fill);
+                    set_bit(_any[layer][low >> 6], low & 63, _any[layer - 1][low] != 0);
+                    set_bit(_any[layer][high >> 6], high & 63, _any[layer - 1][high] != 0);
+                }
+
+                _usage.set(state ? _usage.used() + (len - used) : _usage.used() - used);
+            }
+
+            // used IDs in [low, high], a word at a time
+            T get_used_count(T low, T high) const {
+                div_mod low_dm = get_div_and_mod_by_64(low);
+                div_mod high_dm = get_div_and_mod_by_64(high);
+                uint64_t low_mask = ~(get_on_64_bit(low_dm.mod) - 1);
+                uint64_t high_mask = high_dm.mod < 63 ? get_on_64_bit(high_dm.mod + 1) - 1 : ~uint64_t{0};
+
+                if (low_dm.div == high_dm.div) {
+                    return get_used_bit_count(_layers[0][low_dm.div] & low_mask & high_mask);
+                }
+
+                T used = get_used_bit_count(_layers[0][low_dm.div] & low_mask) +
+                         get_used_bit_count(_layers[0][high_dm.div] & high_mask);
+
+                for (T index = low_dm.div + 1; index < high_dm.div; ++index) {
+                    used += get_used_bit_count(_layers[0][index]);
+                }
+
+                return used;
+            }
+
+            // used IDs of the whole tree, only the words which are not empty are read
+            T get_used_count() const {
+                T used = 0;
+
+                for_each_word(true, [&used](T, uint64_t bits) {
+                    used += get_used_bit_count(bits);
+                    return true;
+                });
+
+                return used;
+            }
+
+            // set the bits [low, high] of the words to fill, whole words inside
+            static void fill_bits(uint64_t* data, T low, T high, uint64_t fill) {
+                div_mod low_dm = get_div_and_mod_by_64(low);
+                div_mod high_dm = get_div_and_mod_by_64(high);
+                uint64_t low_mask = ~(get_on_64_bit(low_dm.mod) - 1);
+                uint64_t high_mask = high_dm.mod < 63 ? get_on_64_bit(high_dm.mod + 1) - 1 : ~uint64_t{0};
+
+                if (low_dm.div == high_dm.div) {
+                    low_mask &= high_mask;
+                } else {
+                    std::fill(data + low_dm.div + 1, data + high_dm.div, fill);
+                    data[high_dm.div] = (data[high_dm.div] & ~high_mask) | (fill & high_mask);
+                }
+
+                data[low_dm.div] = (data[low_dm.div] & ~low_mask) | (fill & low_mask);
+            }
+
+            bool set_id_state(T index, bool state) {
+                if (index < _size) {
+                    T val = index;
+                    div_mod index_dm;
+
+                    set_block_dirty(index >> 12);
+
+                    if (_journal != nullptr) {
+                        state ? _journal->append_use(index) : _journal->append_free(index);
+                    }
+
+                    T word = index >> 6;
+                    bool was_empty = _layers[0][word] == 0;
+                    bool was_on = is_bit_on(_layers[0][word], index & 63);
+
+                    if (state && word >= _high) {
+                        _high = word + 1;
+                    }
+
+                    // start from the data layer (first layer)
+                    for (size_t layer = 0; layer < _depth; ++layer) {
+                        index_dm = get_div_and_mod_by_64(val);
+                        uint64_t& data = _layers[layer][index_dm.div];
+                        set_bit(data, index_dm.mod, state);
+
+                        // if removed and made available or 64 bits are fully used, mark this on the next level
+                        if (!state || is_full(data)) {
+                            val = index_dm.div;
+                        } else {
+                            break;
+                        }
+                    }
+
+                    // the first used ID of the data word, or the last one freed
+                    if (was_empty != (_layers[0][word] == 0)) {
+                        mark_any(1, word, was_empty);
+                    }
+
+                    _usage.update(was_on, state);
+
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+
+            // the highest set bit of bits which are not zero
+            static inline uint32_t find_last_used_bit(uint64_t bits) {
+#if __cplusplus > 201703L  // C++20
+                return 63 - std::countl_zero(bits);
+#else
+                return 63 - __builtin_clzll(bits);
+#endif
+            }
+
+            static inline uint32_t get_used_bit_count(uint64_t bits) {
+#if __cplusplus > 201703L  // C++20
+                return std::popcount(bits);
+#else
+                return __builtin_popcountll(bits);
+#endif
+            }
+
+            T get_container_count() const {
+                return _size / container_ids + (_size % container_ids > 0 ? 1 : 0);
+            }
+
+            T get_container_ids(T key) const {
+                T first = key * container_ids;
+                return _size - first < container_ids ? _size - first : container_ids;
+            }
+
+            T get_container_words(T key) const {
+                T first = key * container_words;
+                return _slice - first < container_words ? _slice - first : container_words;
+            }
+
+            // the 16 words of the container on the second layer are full, read as one 16-bit field of the third layer
+            bool is_container_full(T key) const {
+                if (_depth < 3 || get_container_words(key) < container_words) {
+                    return false;
+                }
+
+                return ((_layers[2][key >> 2] >> ((key & 3) * 16)) & 0xFFFF) == 0xFFFF;
+            }
+
+            // no used ID in the container: its 16-bit field of the third "any used" layer is zero
+            bool is_container_empty(T key) const {
+                if (_depth >= 3) {
+                    return ((_any[2][key >> 2] >> ((key & 3) * 16)) & 0xFFFF) == 0;
+                }
+
+                uint64_t any = 0;
+
+                for (T i = 0; i < _slice; ++i) {
+                    any |= _layers[0][i];
+                }
+
+                return any == 0;
+            }
+
+            // the smallest encoding of a partly used container
+            static uint8_t get_container_type(uint64_t used, uint64_t runs, T words) {
+                size_t runs_bytes = get_container_bytes(container_runs, used, runs, words);
+                size_t bitmap_bytes = get_container_bytes(container_bitmap, used, runs, words);
+
+                if (used <= container_array_max) {
+                    size_t array_bytes = get_container_bytes(container_array, used, runs, words);
+
+                    if (array_bytes <= runs_bytes && array_bytes <= bitmap_bytes) {
+                        return container_array;
+                    }
+                }
+
+                return runs_bytes <= bitmap_bytes ? container_runs : container_bitmap;
+            }
+
+            // payload bytes of a container
+            static size_t get_container_bytes(uint8_t type, uint64_t used, uint64_t runs, T words) {
+                switch (type) {
+                    case container_array:
+                        return 2 + 2 * used;
+                    case container_runs:
+                        return 2 + 4 * runs;
+                    case container_bitmap:
+                        return 8 * size_t{words};
+                    default:
+                        return 0;
+                }
+            }
+
+            static uint8_t* put_container(uint8_t* pos, uint8_t type, const uint64_t* data, T words,
+                                          uint64_t used, uint64_t runs) {
+                switch (type) {
+                    case container_array:
+                        pos = put_little_endian(pos, used - 1, 2);
+
+                        for (T i = 0; i < words; ++i) {
+                            for (uint64_t bits = data[i]; bits != 0; bits &= bits - 1) {
+                                pos = put_little_endian(pos, i * 64 + find_first_free_bit(~bits), 2);
+                            }
+                        }
+
+                        break;
+                    case container_runs: {
+                        pos = put_little_endian(pos, runs - 1, 2);
+
+                        uint32_t first = find_next_bit(data, 0, words, true);
+
+                        while (first < words * 64) {
+                            uint32_t last = find_next_bit(data, first, words, false);
+                            pos = put_little_endian(pos, first, 2);
+                            pos = put_little_endian(pos, last - first - 1, 2);
+                            first = find_next_bit(data, last, words, true);
+                        }
+
+                        break;
+                    }
+                    case container_bitmap:
+                        for (T i = 0; i < words; ++i) {
+                            pos = put_little_endian(pos, data[i], 8);
+                        }
+
+                        break;
+                    default:
+                        break;
+                }
+
+                return pos;
+            }
+
+            // position of the first used or free bit from pos on, or words * 64
+            static uint32_t find_next_bit(const uint64_t* data, uint32_t pos, T words, bool is_used) {
+                uint32_t index = pos >> 6;
+
+                if (index >= words) {
+                    return words * 64;
+                }
+
+                uint64_t bits = (is_used ? data[index] : ~data[index]) & (~uint64_t{0} << (pos & 63));
+
+                while (bits == 0) {
+                    if (++index >= words) {
+                        return words * 64;
+                    }
+
+                    bits = is_used ? data[index] : ~data[index];
+                }
+
+                return index * 64 + find_first_free_bit(~bits);
+            }
+
+            /**
+             * check the serialized containers against the size of the tree, or write them to the data layer,
+             * the keys increase and no bit is past the last ID of its container
+             */
+            bool read_containers(const uint8_t* data, size_t bytes, bool is_writing) {
+                const uint8_t* pos = data + sizeof(serial_magic);
+                const uint8_t* end = data + bytes;
+
+                if (bytes < serial_header_bytes || std::memcmp(data, serial_magic, sizeof(serial_magic)) != 0 ||
+                    get_little_endian(pos, 4) != serial_version ||
+                    get_little_endian(pos, 4) != sizeof(T) * 8 ||
+                    get_little_endian(pos, 8) != _size) {
+                    return false;
+                }
+
+                uint64_t containers = get_little_endian(pos, 8);
+                uint64_t next_key = 0;
+
+                for (uint64_t i = 0; i < containers; ++i) {
+                    if (static_cast<size_t>(end - pos) < sizeof(T) + 1) {
+                        return false;
+                    }
+
+                    uint64_t key = get_little_endian(pos, sizeof(T));
+                    uint8_t type = *pos++;
+
+                    if (key < next_key || key >= get_container_count()) {
+                        return false;
+                    }
+
+                    next_key = key + 1;
+
+                    T first = key * container_ids;
+                    T ids = get_container_ids(key);
+                    T words = get_container_words(key);
+                    size_t rest = end - pos;
+
+                    switch (type) {
+                        case container_full:
+                            if (is_writing) {
+                                fill_bits(_layers[0], first, first + (ids - 1), ~uint64_t{0});
+                            }
+
+                            break;
+                        case container_array: {
+                            if (rest < 2) {
+                                return false;
+                            }
+
+                            uint64_t used = get_little_endian(pos, 2) + 1;
+
+                            if (rest < 2 + 2 * used) {
+                                return false;
+                            }
+
+                            for (uint64_t j = 0; j < used; ++j) {
+                                T id = get_little_endian(pos, 2);
+
+                                if (id >= ids) {
+                                    return false;
+                                }
+
+                                if (is_writing) {
+                                    set_bit_on(_layers[0][(first + id) >> 6], id & 63);
+                                }
+                            }
+
+                            break;
+                        }
+                        case container_runs: {
+                            if (rest < 2) {
+                                return false;
+                            }
+
+                            uint64_t runs = get_little_endian(pos, 2) + 1;
+
+                            if (rest < 2 + 4 * runs) {
+                                return false;
+                            }
+
+                            for (uint64_t j = 0; j < runs; ++j) {
+                                T low = get_little_endian(pos, 2);
+                                T len = get_little_endian(pos, 2) + 1;
+
+                                if (len > ids || low > ids - len) {
+                                    return false;
+                                }
+
+                                if (is_writing) {
+                                    fill_bits(_layers[0], first + low, first + low + (len - 1), ~uint64_t{0});
+                                }
+                            }
+
+                            break;
+                        }
+                        case container_bitmap: {
+                            if (rest < 8 * size_t{words}) {
+                                return false;
+                            }
+
+                            uint64_t* words_data = _layers[0] + key * container_words;
+                            uint64_t tail = ids % 64 > 0 ? ~(get_on_64_bit(ids % 64) - 1) : 0;
+
+                            for (T j = 0; j < words; ++j) {
+                                uint64_t bits = get_little_endian(pos, 8);
+
+                                if (j == words - 1 && (bits & tail) != 0) {
+                                    return false;
+                                }
+
+                                if (is_writing) {
+                                    words_data[j] = bits;
+                                }
+                            }
+
+                            break;
+                        }
+                        default:
+                            return false;
+                    }
+                }
+
+                return pos == end;
+            }
+
+            static uint8_t* put_little_endian(uint8_t* pos, uint64_t value, size_t bytes) {
+                for (size_t i = 0; i < bytes; ++i) {
+                    *pos++ = static_cast<uint8_t>(value >> (i * 8));
+                }
+
+                return pos;
+            }
+
+            static uint64_t get_little_endian(const uint8_t*& pos, size_t bytes) {
+                uint64_t value = 0;
+
+                for (size_t i = 0; i < bytes; ++i) {
+                    value |= uint64_t{*pos++} << (i * 8);
+                }
+
+                return value;
+            }
+    };
+
+    template<typename T>
+    constexpr char basic_kbtree<T>::file_magic[8];
+
+    template<typename T>
+    constexpr char basic_kbtree<T>::serial_magic[8];
+
+    using kbtree = basic_kbtree<uint32_t>;
+    using kbtree64 = basic_kbtree<uint64_t>;
 }
 
 #endif // KBTREE_H
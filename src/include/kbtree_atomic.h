@@ -0,0 +1,307 @@
+#ifndef KBTREE_ATOMIC_H
+#define KBTREE_ATOMIC_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "kbtree.h"
+#include "kcommon.h"
+
+namespace kupid {
+    /**
+     * lock-free variant of kbtree, safe to share between threads
+     *
+     * the layers are the same as kbtree's, but every word is a std::atomic<uint64_t>:
+     * an ID is claimed with a single fetch_or on its layer 0 word, which is the
+     * linearization point of next() and use_id(), and released with a fetch_and
+     *
+     * a summary bit is set only after its child word is seen full, and the child
+     * is re-read after the bit is set: if it is no longer full the bit is cleared
+     * again, therefore a stale "full" bit can only be transient and the
+     * lowest-free-ID guarantee holds whenever no other thread is in flight
+     *
+     * the bits past the last ID of every layer are kept on, so a word is full
+     * only if all of its IDs are used and the top word tells if any ID is free
+     *
+     * every layer is 64-byte aligned and padded to whole cache lines,
+     * so the top word of a tree shares its cache line with no other data
+     *
+     * clear() is not safe to call concurrently with the other operations
+     *
+     * unlike the single-threaded factories it keeps no count of used IDs: a shared
+     * counter would be one more cache line written by every thread on every change
+     *
+     * std::atomic
+     * see:
+     *      https://en.cppreference.com/w/cpp/atomic/atomic
+     */
+
+    class kbtree_atomic {
+        public:
+            using div_mod = kbtree::div_mod;
+
+            kbtree_atomic(uint32_t size)
+                : _size{size}
+            {
+                uint32_t slice = size;
+                div_mod dm;
+
+                // max 6 data layers: 2^32 = (2^6)^5 x (2^2)
+                _words.reserve(6);
+                _data.reserve(6);
+                _slices.reserve(6);
+
+                do {
+                    dm = kbtree::get_div_and_mod_by_64(slice);
+                    slice = kbtree::get_div_or_plus_1(dm);
+
+                    // 8 more words to align the layer to 64 bytes
+                    size_t words = get_aligned_words(slice);
+                    _words.push_back(std::unique_ptr<std::atomic<uint64_t>[]>(new std::atomic<uint64_t>[words + 8]()));
+
+                    void* ptr = _words.back().get();
+                    size_t space = (words + 8) * sizeof(uint64_t);
+                    std::align(64, words * sizeof(uint64_t), ptr, space);
+
+                    _data.push_back(static_cast<std::atomic<uint64_t>*>(ptr));
+                    _slices.push_back(slice);
+                } while (dm.div > 0);
+
+                _words.shrink_to_fit();
+                _data.shrink_to_fit();
+                _slices.shrink_to_fit();
+
+                fill_padding();
+            }
+
+            // all IDs used or free
+            kbtree_atomic(uint32_t size, kpreset preset)
+                : kbtree_atomic{size}
+            {
+                // with the padding, all words of an all used tree are full
+                if (preset == kpreset::all_used) {
+                    for (size_t layer = 0; layer < _data.size(); ++layer) {
+                        for (uint32_t i = 0; i < _slices[layer]; ++i) {
+                            _data[layer][i].store(~uint64_t{0}, std::memory_order_relaxed);
+                        }
+                    }
+
+                    std::atomic_thread_fence(std::memory_order_release);
+                }
+            }
+
+            // the used IDs set word by word, then each upper layer derived in one pass,
+            // no other thread sees the tree yet: plain loads and stores instead of fetch_or
+            kbtree_atomic(uint32_t size, ksorted_ids<uint32_t> used)
+                : kbtree_atomic{size}
+            {
+                for (uint32_t id : used) {
+                    if (id < _size) {
+                        div_mod dm = kbtree::get_div_and_mod_by_64(id);
+                        set_bit_on(_data[0][dm.div], dm.mod);
+                    }
+                }
+
+                for (size_t layer = 1; layer < _data.size(); ++layer) {
+                    for (uint32_t child = 0; child < _slices[layer - 1]; ++child) {
+                        if (kbtree::is_full(_data[layer - 1][child].load(std::memory_order_relaxed))) {
+                            div_mod dm = kbtree::get_div_and_mod_by_64(child);
+                            set_bit_on(_data[layer][dm.div], dm.mod);
+                        }
+                    }
+                }
+
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+
+            kbtree_atomic() = delete;                                       // default constructor
+            kbtree_atomic(const kbtree_atomic& copy) = delete;              // copy constructor
+            kbtree_atomic& operator=(const kbtree_atomic& copy) = delete;   // copy assignment
+            kbtree_atomic(kbtree_atomic&& move) = default;                  // move constructor
+            kbtree_atomic& operator=(kbtree_atomic&& move) = default;       // move assignment
+
+            int64_t next(bool is_using = true) {
+                if (_size == 0) {
+                    return -1;
+                }
+
+                for (;;) {
+                    uint32_t rank = 0;
+                    bool is_stale = false;
+
+                    for (size_t layer = _data.size(); layer-- > 0;) {
+                        uint64_t data = _data[layer][rank].load(std::memory_order_acquire);
+                        int32_t offset = kbtree::find_first_free_bit(data);
+
+                        if (offset < 0) {
+                            if (layer + 1 == _data.size()) {
+                                return -1;
+                            }
+
+                            // the parent said not full: a racing use_id() has not marked it yet
+                            mark_full(layer, rank);
+                            is_stale = true;
+                            break;
+                        }
+
+                        rank *= 64;
+                        rank += offset;
+                    }
+
+                    if (is_stale) {
+                        continue;
+                    }
+
+                    if (rank >= _size) {
+                        return -1;
+                    }
+
+                    if (!is_using || claim(rank)) {
+                        return rank;
+                    }
+
+                    // lost the race for this ID, descend again
+                }
+            }
+
+            bool use_id(uint32_t id) {
+                if (id < _size) {
+                    claim(id);
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+
+            bool free_id(uint32_t id) {
+                if (id < _size) {
+                    uint32_t val = id;
+
+                    // clear upwards until a layer was already marked as available
+                    for (size_t layer = 0; layer < _data.size(); ++layer) {
+                        div_mod dm = kbtree::get_div_and_mod_by_64(val);
+                        uint64_t bit = uint64_t{1} << dm.mod;
+                        uint64_t prev = _data[layer][dm.div].fetch_and(~bit, std::memory_order_acq_rel);
+
+                        if (layer > 0 && (prev & bit) == 0) {
+                            break;
+                        }
+
+                        val = dm.div;
+                    }
+
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+
+            bool is_using(uint32_t id) const {
+                if (id < _size) {
+                    div_mod id_dm = kbtree::get_div_and_mod_by_64(id);
+                    return kbtree::is_bit_on(_data[0][id_dm.div].load(std::memory_order_acquire), id_dm.mod);
+                } else {
+                    return false;
+                }
+            }
+
+            // not thread-safe
+            void clear() {
+                for (size_t layer = 0; layer < _data.size(); ++layer) {
+                    for (uint32_t i = 0; i < _slices[layer]; ++i) {
+                        _data[layer][i].store(0, std::memory_order_relaxed);
+                    }
+                }
+
+                fill_padding();
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+
+            uint32_t size() const {
+                return _size;
+            }
+
+            uint32_t slice() const {
+                return _slices[0];
+            }
+
+            // true if the top summary word shows at least one available ID
+            bool has_free() const {
+                size_t top = _data.size() - 1;
+                return _slices[top] > 0 && !kbtree::is_full(_data[top][0].load(std::memory_order_acquire));
+            }
+
+        private:
+            uint32_t _size;
+            std::vector<uint32_t> _slices;
+            std::vector<std::unique_ptr<std::atomic<uint64_t>[]>> _words;
+            std::vector<std::atomic<uint64_t>*> _data;
+
+        private:
+            // 8 words = 64 bytes
+            static size_t get_aligned_words(size_t words) {
+                return (words + 7) & ~size_t{7};
+            }
+
+            // mark the bits which do not map to an ID or to a word of the lower layer as used
+            void fill_padding() {
+                uint32_t bits = _size;
+
+                for (size_t layer = 0; layer < _data.size(); ++layer) {
+                    div_mod dm = kbtree::get_div_and_mod_by_64(bits);
+
+                    if (dm.mod > 0) {
+                        _data[layer][dm.div].fetch_or(~uint64_t{0} << dm.mod, std::memory_order_relaxed);
+                    }
+
+                    bits = _slices[layer];
+                }
+            }
+
+            static void set_bit_on(std::atomic<uint64_t>& data, uint8_t mod) {
+                data.store(data.load(std::memory_order_relaxed) | (uint64_t{1} << mod), std::memory_order_relaxed);
+            }
+
+            // set the bit of the given ID, returns false if another thread owns it
+            bool claim(uint32_t id) {
+                div_mod dm = kbtree::get_div_and_mod_by_64(id);
+                uint64_t bit = uint64_t{1} << dm.mod;
+                uint64_t prev = _data[0][dm.div].fetch_or(bit, std::memory_order_acq_rel);
+
+                if (prev & bit) {
+                    return false;
+                }
+
+                if (kbtree::is_full(prev | bit)) {
+                    mark_full(0, dm.div);
+                }
+
+                return true;
+            }
+
+            // the word at (layer, index) has been seen full, mark it on the upper layers
+            void mark_full(size_t layer, uint32_t index) {
+                for (; layer + 1 < _data.size(); ++layer) {
+                    div_mod dm = kbtree::get_div_and_mod_by_64(index);
+                    uint64_t bit = uint64_t{1} << dm.mod;
+                    uint64_t prev = _data[layer + 1][dm.div].fetch_or(bit, std::memory_order_acq_rel);
+
+                    // a racing free_id() may have cleared the child after it was seen full
+                    if (!kbtree::is_full(_data[layer][index].load(std::memory_order_acquire))) {
+                        _data[layer + 1][dm.div].fetch_and(~bit, std::memory_order_acq_rel);
+                        return;
+                    }
+
+                    if (!kbtree::is_full(prev | bit)) {
+                        return;
+                    }
+
+                    index = dm.div;
+                }
+            }
+    };
+}
+
+#endif // KBTREE_ATOMIC_H
@@ -0,0 +1,257 @@
+#ifndef KBTREE_STATIC_H
+#define KBTREE_STATIC_H
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+#include "kcommon.h"
+
+#if __cplusplus > 201703L  // C++20
+#include <bit>
+#endif
+
+namespace kupid {
+    /**
+     * kbtree of a compile-time size N
+     *
+     * the number of layers, their slices and offsets are constexpr,
+     * all layers live in a single std::array, from the top layer down
+     * to the data layer, each layer aligned to a 64-byte cache line,
+     * therefore next() and set_id_state() loop over a constant number of layers
+     * and no memory is allocated
+     *
+     * the members are constexpr, under C++20 a tree can be used in constant
+     * expressions, and a static tree is zero-initialized into .bss
+     *
+     * the number of used IDs is kept by every change of state, without the watermark
+     * callbacks of kusage: a std::function is not a literal type
+     */
+
+    // constexpr geometry of the layers of a kbtree_static of N IDs
+    template<uint32_t N>
+    struct kbtree_static_layout {
+        // max 6 data layers: 2^32 = (2^6)^5 x (2^2)
+        size_t depth;
+        size_t words;
+        size_t offsets[6];
+        uint32_t slices[6];
+
+        constexpr kbtree_static_layout()
+            : depth{get_depth()},
+              words{0},
+              offsets{},
+              slices{}
+        {
+            // the top layer first, each layer padded to 8 words = 64 bytes
+            for (size_t layer = depth; layer > 0; --layer) {
+                offsets[layer - 1] = words;
+                slices[layer - 1] = get_slice(layer - 1);
+                words += (slices[layer - 1] + 7) & ~size_t{7};
+            }
+        }
+
+        // words of the data layer, or of the upper layers
+        static constexpr uint32_t get_slice(size_t layer) {
+            uint64_t slice = N;
+
+            for (size_t i = 0; i <= layer; ++i) {
+                slice = (slice + 63) / 64;
+            }
+
+            return slice;
+        }
+
+        // the data layer and the upper layers up to the one of a single word
+        static constexpr size_t get_depth() {
+            size_t layer = 0;
+
+            while (get_slice(layer) > 1) {
+                ++layer;
+            }
+
+            return layer + 1;
+        }
+    };
+
+    template<uint32_t N>
+    class kbtree_static {
+        public:
+            using layout = kbtree_static_layout<N>;
+
+            static constexpr layout geometry{};
+            static constexpr size_t depth_count = geometry.depth;
+            static constexpr size_t word_count = geometry.words;
+
+            constexpr kbtree_static() = default;
+
+            // all IDs used or free
+            constexpr kbtree_static(kpreset preset) {
+                if (preset == kpreset::all_used) {
+                    for (uint32_t index = 0; index < N / 64; ++index) {
+                        _data[geometry.offsets[0] + index] = ~uint64_t{0};
+                    }
+
+                    if (N % 64 != 0) {
+                        _data[geometry.offsets[0] + N / 64] = (uint64_t{1} << (N % 64)) - 1;
+                    }
+
+                    build_summaries();
+                    _used = N;
+                }
+            }
+
+            // the used IDs set word by word, then each upper layer derived in one pass
+            constexpr kbtree_static(ksorted_ids<uint32_t> used) {
+                for (uint32_t id : used) {
+                    if (id < N && !is_using(id)) {
+                        _data[geometry.offsets[0] + (id >> 6)] |= uint64_t{1} << (id & 63);
+                        ++_used;
+                    }
+                }
+
+                build_summaries();
+            }
+
+            constexpr int64_t next(bool is_using = true) {
+                if (N == 0) {
+                    return -1;
+                }
+
+                uint64_t rank = 0;
+
+                for (size_t layer = depth_count; layer > 0; --layer) {
+                    int32_t offset = find_first_free_bit(_data[geometry.offsets[layer - 1] + rank]);
+
+                    if (offset < 0) {
+                        return -1;
+                    }
+
+                    rank *= 64;
+                    rank += offset;
+
+                    // the first free bit is past the last word of the lower layer
+                    if (layer > 1 && rank >= geometry.slices[layer - 2]) {
+                        return -1;
+                    }
+                }
+
+                if (rank >= N) {
+                    return -1;
+                }
+
+                if (is_using) {
+                    use_id(rank);
+                }
+
+                return rank;
+            }
+
+            constexpr bool use_id(uint32_t id) {
+                return set_id_state(id, true);
+            }
+
+            constexpr bool free_id(uint32_t id) {
+                return set_id_state(id, false);
+            }
+
+            constexpr bool is_using(uint32_t id) const {
+                if (id < N) {
+                    return (_data[geometry.offsets[0] + (id >> 6)] & (uint64_t{1} << (id & 63))) > 0;
+                } else {
+                    return false;
+                }
+            }
+
+            constexpr void clear() {
+                for (auto& data : _data) {
+                    data = 0;
+                }
+
+                _used = 0;
+            }
+
+            // the number of used IDs in O(1)
+            constexpr uint32_t used_count() const {
+                return _used;
+            }
+
+            constexpr uint32_t free_count() const {
+                return N - _used;
+            }
+
+            constexpr uint32_t size() const {
+                return N;
+            }
+
+            constexpr uint32_t slice() const {
+                return geometry.slices[0];
+            }
+
+            constexpr size_t depth() const {
+                return depth_count;
+            }
+
+        private:
+            alignas(64) std::array<uint64_t, word_count> _data{};
+            uint32_t _used = 0;
+
+        private:
+            static constexpr int32_t find_first_free_bit(uint64_t bits) {
+#if __cplusplus > 201703L  // C++20
+                int32_t offset = std::countr_one(bits);
+                return offset < 64 ? offset : -1;
+#else
+                return __builtin_ffsll(~bits) - 1;
+#endif
+            }
+
+            // the bits of the upper layers from the data layer, bottom-up
+            constexpr void build_summaries() {
+                for (size_t layer = 1; layer < depth_count; ++layer) {
+                    for (uint32_t child = 0; child < geometry.slices[layer - 1]; ++child) {
+                        if (_data[geometry.offsets[layer - 1] + child] == ~uint64_t{0}) {
+                            _data[geometry.offsets[layer] + (child >> 6)] |= uint64_t{1} << (child & 63);
+                        }
+                    }
+                }
+            }
+
+            constexpr bool set_id_state(uint32_t id, bool state) {
+                if (id < N) {
+                    uint64_t index = id;
+                    bool was_on = is_using(id);
+
+                    // start from the data layer (first layer)
+                    for (size_t layer = 0; layer < depth_count; ++layer) {
+                        uint64_t& data = _data[geometry.offsets[layer] + (index >> 6)];
+                        uint64_t bit = uint64_t{1} << (index & 63);
+
+                        data = state ? data | bit : data & ~bit;
+
+                        // if removed and made available or 64 bits are fully used, mark this on the next level
+                        if (!state || data == ~uint64_t{0}) {
+                            index >>= 6;
+                        } else {
+                            break;
+                        }
+                    }
+
+                    if (was_on != state) {
+                        state ? ++_used : --_used;
+                    }
+
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+    };
+
+#if __cplusplus < 201703L  // C++14: a static constexpr member used by reference needs a definition
+    template<uint32_t N>
+    constexpr typename kbtree_static<N>::layout kbtree_static<N>::geometry;
+#endif
+}
+
+#endif // KBTREE_STATIC_H
@@ -0,0 +1,335 @@
+#ifndef KBTREE_WIDE_H
+#define KBTREE_WIDE_H
+
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#include "karena.h"
+#include "kscan.h"
+#include "kcommon.h"
+
+namespace kupid {
+    /**
+     * kbtree of 512-bit nodes
+     *
+     * a node is a cache line of 8 words, a bit of an upper layer marks a full
+     * node of the lower layer, therefore the fan-out is 512 instead of 64 and
+     * 2^32 IDs take 4 layers instead of 6
+     *
+     * next() finds the first word with a free bit inside a node with a scalar
+     * loop, or with a single AVX-512 or two AVX2 compares after set_kernel(),
+     * the scalar loop is the default: a 64-byte load of a node which was just
+     * written by free_id() cannot be forwarded from the 8-byte store, and the
+     * predicted branches of the loop hide the latency of the compares
+     *
+     * the padding bits past the last node of every layer are used,
+     * a full layer is exactly a layer of full nodes
+     */
+
+    class kbtree_wide {
+        public:
+            kbtree_wide(uint32_t size, bool is_huge_page = false)
+                : _size{size}
+            {
+                set_up_layout();
+                _arena.allocate(_words * sizeof(uint64_t), is_huge_page);
+                place_layers();
+                fill_padding();
+            }
+
+            // all IDs used or free
+            kbtree_wide(uint32_t size, kpreset preset, bool is_huge_page = false)
+                : kbtree_wide{size, is_huge_page}
+            {
+                // with the padding, all words of an all used tree are full
+                if (preset == kpreset::all_used) {
+                    std::fill(_arena.words(), _arena.words() + _words, ~uint64_t{0});
+                    _usage.set(size);
+                }
+            }
+
+            // the used IDs set word by word, then each upper layer derived in one pass
+            kbtree_wide(uint32_t size, ksorted_ids<uint32_t> used, bool is_huge_page = false)
+                : kbtree_wide{size, is_huge_page}
+            {
+                uint64_t count = 0;
+
+                for (uint32_t id : used) {
+                    if (id < _size && (_layers[0][id >> 6] & (uint64_t{1} << (id & 63))) == 0) {
+                        _layers[0][id >> 6] |= uint64_t{1} << (id & 63);
+                        ++count;
+                    }
+                }
+
+                _usage.set(count);
+
+                for (size_t layer = 1; layer < _depth; ++layer) {
+                    for (uint64_t node = 0; node < _bits[layer]; ++node) {
+                        if (is_full(_layers[layer - 1] + node * node_words)) {
+                            _layers[layer][node >> 6] |= uint64_t{1} << (node & 63);
+                        }
+                    }
+                }
+            }
+
+            kbtree_wide() = delete;                                     // default constructor
+            kbtree_wide(const kbtree_wide& copy) = delete;              // copy constructor
+            kbtree_wide& operator=(const kbtree_wide& copy) = delete;   // copy assignment
+            kbtree_wide(kbtree_wide&& move) = default;                  // move constructor
+            kbtree_wide& operator=(kbtree_wide&& move) = default;       // move assignment
+
+            int64_t next(bool is_using = true) {
+                int64_t id;
+
+                switch (_kernel) {
+#ifdef KSCAN_X86
+                    case kscan::kernel::avx512:
+                        id = find_first_free_avx512();
+                        break;
+                    case kscan::kernel::avx2:
+                        id = find_first_free_avx2();
+                        break;
+#endif
+                    default:
+                        id = find_first_free_scalar();
+                        break;
+                }
+
+                if (id >= 0 && is_using) {
+                    use_id(id);
+                }
+
+                return id;
+            }
+
+            bool use_id(uint32_t id) {
+                return set_id_state(id, true);
+            }
+
+            bool free_id(uint32_t id) {
+                return set_id_state(id, false);
+            }
+
+            bool is_using(uint32_t id) const {
+                if (id < _size) {
+                    return (_layers[0][id >> 6] & (uint64_t{1} << (id & 63))) > 0;
+                } else {
+                    return false;
+                }
+            }
+
+            void clear() {
+                _arena.fill_zero();
+                fill_padding();
+                _usage.set(0);
+            }
+
+            // the number of used IDs in O(1)
+            uint32_t used_count() const {
+                return _usage.used();
+            }
+
+            uint32_t free_count() const {
+                return _size - _usage.used();
+            }
+
+            // f(used) once the used IDs rise to used, nullptr removes the watermark
+            void set_high_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_high_watermark(used, std::move(f));
+            }
+
+            // f(used) once the used IDs fall to used, nullptr removes the watermark
+            void set_low_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_low_watermark(used, std::move(f));
+            }
+
+            uint32_t size() const {
+                return _size;
+            }
+
+            // the kernel of the in-node scan of next(), false if the CPU lacks it
+            bool set_kernel(kscan::kernel k) {
+                if (!kscan::is_supported(k)) {
+                    return false;
+                }
+
+                _kernel = k;
+                return true;
+            }
+
+            kscan::kernel get_kernel() const {
+                return _kernel;
+            }
+
+            // number of data layers
+            size_t depth() const {
+                return _depth;
+            }
+
+            // bytes of the arena of a tree of size IDs
+            static size_t get_arena_bytes(uint32_t size) {
+                kbtree_wide layout{size, nullptr};
+                return layout._words * sizeof(uint64_t);
+            }
+
+        private:
+            static constexpr size_t node_words = 8;
+
+            // max 4 data layers: 2^32 = (2^9)^3 x (2^5)
+            static constexpr size_t max_depth = 4;
+
+            uint32_t _size;
+            size_t _depth = 0;
+            size_t _words = 0;
+            std::array<uint64_t, max_depth> _bits;      // bits in use on each layer, the rest is padding
+            std::array<uint64_t, max_depth> _nodes;
+            std::array<size_t, max_depth> _offsets;
+            std::array<uint64_t*, max_depth> _layers;
+            kscan::kernel _kernel = kscan::kernel::scalar;  // of the in-node scan
+            karena _arena;
+            kusage _usage;
+
+        private:
+            // only the layout, without an arena
+            kbtree_wide(uint32_t size, std::nullptr_t)
+                : _size{size}
+            {
+                set_up_layout();
+            }
+
+            // nodes of every layer, and their offsets in the arena: the top layer first
+            void set_up_layout() {
+                uint64_t bits = _size;
+
+                do {
+                    uint64_t nodes = (bits + 511) / 512;
+
+                    _bits[_depth] = bits;
+                    _nodes[_depth] = nodes > 0 ? nodes : 1;
+
+                    bits = _nodes[_depth++];
+                } while (bits > 1);
+
+                for (size_t layer = _depth; layer > 0; --layer) {
+                    _offsets[layer - 1] = _words;
+                    _words += _nodes[layer - 1] * node_words;
+                }
+            }
+
+            void place_layers() {
+                for (size_t layer = 0; layer < _depth; ++layer) {
+                    _layers[layer] = _arena.words() + _offsets[layer];
+                }
+            }
+
+            // the bits past the last one of every layer are used, so that the last nodes become full
+            void fill_padding() {
+                for (size_t layer = 0; layer < _depth; ++layer) {
+                    uint64_t bits = _bits[layer];
+                    uint64_t last = _nodes[layer] * 512;
+
+                    if (bits % 64 != 0) {
+                        _layers[layer][bits / 64] |= ~((uint64_t{1} << (bits % 64)) - 1);
+                        bits += 64 - bits % 64;
+                    }
+
+                    for (; bits < last; bits += 64) {
+                        _layers[layer][bits / 64] = ~uint64_t{0};
+                    }
+                }
+
+                // a single node of padding only, as of size 0, is full
+                for (size_t layer = 0; layer + 1 < _depth && is_full(_layers[layer]); ++layer) {
+                    _layers[layer + 1][0] |= 1;
+                }
+            }
+
+            static bool is_full(const uint64_t* node) {
+                uint64_t data = ~uint64_t{0};
+
+                for (size_t i = 0; i < node_words; ++i) {
+                    data &= node[i];
+                }
+
+                return data == ~uint64_t{0};
+            }
+
+            // the first free ID, or -1
+            template<size_t (*scan_node)(const uint64_t*)>
+            __attribute__((always_inline)) int64_t descend() const {
+                uint64_t rank = 0;
+
+                for (size_t layer = _depth; layer > 0; --layer) {
+                    const uint64_t* node = _layers[layer - 1] + rank * node_words;
+                    size_t word = scan_node(node);
+
+                    if (word == node_words) {
+                        return -1;
+                    }
+
+                    rank = rank * 512 + word * 64 + __builtin_ctzll(~node[word]);
+                }
+
+                return rank;
+            }
+
+            int64_t find_first_free_scalar() const {
+                return descend<kscan::scan_node_scalar>();
+            }
+
+#ifdef KSCAN_X86
+            __attribute__((target("avx2")))
+            int64_t find_first_free_avx2() const {
+                return descend<kscan::scan_node_avx2>();
+            }
+
+            __attribute__((target("avx512f")))
+            int64_t find_first_free_avx512() const {
+                return descend<kscan::scan_node_avx512>();
+            }
+#endif
+
+            bool set_id_state(uint32_t id, bool state) {
+                if (id < _size) {
+                    uint64_t index = id;
+                    bool was_on = (_layers[0][id >> 6] & (uint64_t{1} << (id & 63))) > 0;
+
+                    // start from the data layer (first layer)
+                    for (size_t layer = 0; layer < _depth; ++layer) {
+                        uint64_t* node = _layers[layer] + (index >> 9) * node_words;
+                        uint64_t& data = node[(index >> 6) & 7];
+                        uint64_t bit = uint64_t{1} << (index & 63);
+
+                        if (state) {
+                            data |= bit;
+
+                            // a node which became full is marked on the next level
+                            if (data != ~uint64_t{0} || !is_full(node)) {
+                                break;
+                            }
+                        } else {
+                            bool was_on = (data & bit) > 0;
+                            data &= ~bit;
+
+                            // the bit of a node on the next level is on only if the node was full
+                            if (!was_on) {
+                                break;
+                            }
+                        }
+
+                        index >>= 9;
+                    }
+
+                    _usage.update(was_on, state);
+
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+    };
+}
+
+#endif // KBTREE_WIDE_H
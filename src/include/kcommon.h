@@ -0,0 +1,245 @@
+#ifndef KCOMMON_H
+#define KCOMMON_H
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+
+namespace kupid {
+    /**
+     * types shared by the bulk constructors of all ID factories
+     *
+     * a factory is built from a preset, or from a list of used IDs in increasing order,
+     * bottom-up in linear time instead of one use_id() per ID,
+     * IDs past the size of the factory are ignored, as by use_id()
+     */
+
+    // the state of all IDs of a new factory
+    enum class kpreset {
+        all_free,
+        all_used
+    };
+
+    // used IDs in increasing order, a std::span<const T> before C++20
+    template<typename T>
+    struct ksorted_ids {
+        const T* data;
+        size_t count;
+
+        constexpr ksorted_ids(const T* data, size_t count)
+            : data{data},
+              count{count}
+        {}
+
+        ksorted_ids(const std::vector<T>& ids)
+            : data{ids.data()},
+              count{ids.size()}
+        {}
+
+        constexpr const T* begin() const {
+            return data;
+        }
+
+        constexpr const T* end() const {
+            return data + count;
+        }
+    };
+
+    /**
+     * the number of used IDs of a factory, kept up to date by each change of state
+     *
+     * a callback fires when the count rises to the high watermark, or falls to the low watermark,
+     * a bulk change fires it when the count crosses the watermark,
+     * the watermarks are checked only while a callback is set: without one a change of state
+     * costs an add of the state delta and a test of a flag
+     */
+    class kusage {
+        public:
+            using callback = std::function<void(uint64_t used)>;
+
+            explicit kusage(uint64_t used = 0)
+                : _used{used}
+            {}
+
+            uint64_t used() const {
+                return _used;
+            }
+
+            // nullptr removes the watermark
+            void set_high_watermark(uint64_t used, callback on_high) {
+                _high = used;
+                _on_high = std::move(on_high);
+                _is_watched = _on_high || _on_low;
+            }
+
+            void set_low_watermark(uint64_t used, callback on_low) {
+                _low = used;
+                _on_low = std::move(on_low);
+                _is_watched = _on_high || _on_low;
+            }
+
+            // an ID was on and is now state, the delta is added without a branch
+            void update(bool was_on, bool state) {
+                uint64_t prev = _used;
+                _used += uint64_t{state} - uint64_t{was_on};
+
+                if (_is_watched) {
+                    check(prev);
+                }
+            }
+
+            // an ID became used
+            void inc() {
+                update(false, true);
+            }
+
+            // an ID became free, never below zero
+            void dec() {
+                if (_used > 0) {
+                    update(true, false);
+                }
+            }
+
+            // a bulk change of state
+            void set(uint64_t used) {
+                uint64_t prev = _used;
+                _used = used;
+
+                if (_is_watched) {
+                    check(prev);
+                }
+            }
+
+        private:
+            uint64_t _used;
+            uint64_t _high = 0;
+            uint64_t _low = 0;
+            bool _is_watched = false;
+            callback _on_high;
+            callback _on_low;
+
+        private:
+            // out of line, the update of the count stays small enough to inline
+            __attribute__((noinline)) void check(uint64_t prev) {
+                if (_on_high && prev < _high && _used >= _high) {
+                    _on_high(_used);
+                } else if (_on_low && prev > _low && _used <= _low) {
+                    _on_low(_used);
+                }
+            }
+    };
+
+    /**
+     * a set of at most capacity IDs, for the IDs cached or held in front of a factory
+     *
+     * open addressing with linear probing in a power of two of at least twice the capacity
+     * slots, the largest T marks an empty slot: it is past the last ID of any factory,
+     * erase() shifts the following entries of the cluster back, without tombstones
+     */
+    template<typename T>
+    class kid_set {
+        public:
+            explicit kid_set(size_t capacity = 0) {
+                size_t slots = 2;
+                uint32_t bits = 1;
+
+                while (slots < 2 * capacity) {
+                    slots *= 2;
+                    ++bits;
+                }
+
+                _slots.assign(slots, empty);
+                _mask = slots - 1;
+                _shift = 64 - bits;
+            }
+
+            bool contains(T id) const {
+                for (size_t i = get_home(id); _slots[i] != empty; i = (i + 1) & _mask) {
+                    if (_slots[i] == id) {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            // false if the ID is already in the set
+            bool insert(T id) {
+                size_t i = get_home(id);
+
+                for (; _slots[i] != empty; i = (i + 1) & _mask) {
+                    if (_slots[i] == id) {
+                        return false;
+                    }
+                }
+
+                _slots[i] = id;
+                ++_count;
+                return true;
+            }
+
+            // false if the ID is not in the set
+            bool erase(T id) {
+                size_t i = get_home(id);
+
+                for (; _slots[i] != id; i = (i + 1) & _mask) {
+                    if (_slots[i] == empty) {
+                        return false;
+                    }
+                }
+
+                // an entry after the hole moves into it unless its home is between them
+                for (size_t j = (i + 1) & _mask; _slots[j] != empty; j = (j + 1) & _mask) {
+                    size_t home = get_home(_slots[j]);
+
+                    if (((j - home) & _mask) >= ((j - i) & _mask)) {
+                        _slots[i] = _slots[j];
+                        i = j;
+                    }
+                }
+
+                _slots[i] = empty;
+                --_count;
+                return true;
+            }
+
+            void clear() {
+                std::fill(_slots.begin(), _slots.end(), empty);
+                _count = 0;
+            }
+
+            size_t count() const {
+                return _count;
+            }
+
+            // bytes of the slots
+            size_t get_bytes() const {
+                return _slots.size() * sizeof(T);
+            }
+
+        private:
+            static constexpr T empty = std::numeric_limits<T>::max();
+
+            std::vector<T> _slots;
+            size_t _mask;
+            uint32_t _shift;
+            size_t _count = 0;
+
+        private:
+            // Fibonacci hashing: the top bits of the product
+            size_t get_home(T id) const {
+                return (uint64_t{id} * 0x9E3779B97F4A7C15) >> _shift;
+            }
+    };
+
+#if __cplusplus < 201703L  // C++14: a static constexpr member passed by reference needs a definition
+    template<typename T>
+    constexpr T kid_set<T>::empty;
+#endif
+}
+
+#endif // KCOMMON_H
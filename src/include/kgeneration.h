@@ -0,0 +1,117 @@
+#ifndef KGENERATION_H
+#define KGENERATION_H
+
+#include <vector>
+#include <cstdint>
+
+#include "kbtree.h"
+
+namespace kupid {
+    /**
+     * a kbtree which hands out handles: the ID in the low 32 bits, its generation above
+     *
+     * every ID has a generation of G bits in a dense array, incremented when the ID is
+     * handed out and again when it is freed, therefore odd while the ID is used and even
+     * while it is free: a handle of a freed, or freed and handed out again, ID is stale,
+     * validate() is a single load of the array and a compare
+     *
+     * the generations wrap around: a handle kept over 2^(bits of G - 1) reuses of its ID
+     * becomes valid again, uint8_t saves memory, uint32_t makes that practically impossible
+     *
+     * a handle with an even generation is never valid, e.g. no_handle
+     */
+
+    template<typename G = uint16_t>
+    class kgeneration {
+        public:
+            static constexpr uint64_t no_handle = 0;
+
+            explicit kgeneration(uint32_t size)
+                : _tree{size},
+                  _gens(size)
+            {
+            }
+
+            kgeneration() = delete;                                     // default constructor
+            kgeneration(const kgeneration& copy) = delete;              // copy constructor
+            kgeneration& operator=(const kgeneration& copy) = delete;   // copy assignment
+
+            // the handle of the lowest free ID, or no_handle
+            uint64_t next() {
+                int64_t id = _tree.next();
+
+                if (id < 0) {
+                    return no_handle;
+                }
+
+                return get_handle(++_gens[id], id);
+            }
+
+            // true if the handle is of a used ID and of its current generation, an odd one
+            bool validate(uint64_t handle) const {
+                uint32_t id = get_id(handle);
+                uint64_t gen = handle >> 32;
+
+                return id < _gens.size() && _gens[id] == gen && (gen & 1) != 0;
+            }
+
+            // free the ID of the handle, false if the handle is stale
+            bool free(uint64_t handle) {
+                if (!validate(handle)) {
+                    return false;
+                }
+
+                uint32_t id = get_id(handle);
+                ++_gens[id];
+
+                return _tree.free_id(id);
+            }
+
+            // every handle becomes stale, only the used IDs are visited
+            void clear() {
+                _tree.for_each_used([this](uint32_t id) { ++_gens[id]; });
+                _tree.clear();
+            }
+
+            bool is_using(uint32_t id) const {
+                return _tree.is_using(id);
+            }
+
+            uint32_t size() const {
+                return _tree.size();
+            }
+
+            uint32_t used_count() const {
+                return _tree.used_count();
+            }
+
+            // the current handle of a used ID, or no_handle
+            uint64_t get_handle(uint32_t id) const {
+                return _tree.is_using(id) ? get_handle(_gens[id], id) : no_handle;
+            }
+
+            static uint32_t get_id(uint64_t handle) {
+                return static_cast<uint32_t>(handle);
+            }
+
+            static G get_generation(uint64_t handle) {
+                return static_cast<G>(handle >> 32);
+            }
+
+        private:
+            kbtree _tree;
+            std::vector<G> _gens;
+
+        private:
+            static uint64_t get_handle(G gen, uint32_t id) {
+                return (uint64_t{gen} << 32) | id;
+            }
+    };
+
+#if __cplusplus < 201703L  // C++14: a static constexpr member passed by reference needs a definition
+    template<typename G>
+    constexpr uint64_t kgeneration<G>::no_handle;
+#endif
+}
+
+#endif // KGENERATION_H
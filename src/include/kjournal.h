@@ -0,0 +1,346 @@
+#ifndef KJOURNAL_H
+#define KJOURNAL_H
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <system_error>
+#include <cerrno>
+#include <cstdint>
+#include <cstddef>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kupid {
+    /**
+     * write-ahead journal of use and free operations
+     *
+     * a record is a little-endian 64-bit word: the operation in the top 2 bits and the ID,
+     * a range is followed by a second word of its length
+     *
+     * the records are appended to a preallocated batch, a full batch is handed over
+     * to a background thread which writes it to the log file, while the next batch fills,
+     * therefore an append is a store and an increment, and a batch costs one write()
+     * and, by the fsync policy, one fdatasync(): a group commit
+     *
+     * records reach the file when a batch is full, on commit() and on destruction,
+     * replay() applies the log to a tree restored from the last snapshot,
+     * reset() empties the log once a new snapshot is durable
+     *
+     * see:
+     *      https://en.wikipedia.org/wiki/Write-ahead_logging
+     *      https://man7.org/linux/man-pages/man2/fsync.2.html
+     */
+
+    class kjournal {
+        public:
+            enum class fsync_policy {
+                none,       // the page cache decides
+                commit,     // every written batch
+                interval    // at most once per interval
+            };
+
+            struct options {
+                size_t batch_records = size_t{1} << 16;
+                fsync_policy policy = fsync_policy::commit;
+                std::chrono::milliseconds interval{10};
+            };
+
+            kjournal(const char* path)
+                : kjournal{path, options{}}
+            {}
+
+            kjournal(const char* path, options opts)
+                : _options{opts},
+                  _active(std::max(opts.batch_records, size_t{2})),
+                  _pending(_active.size())
+            {
+                _fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+                if (_fd < 0) {
+                    throw std::system_error(errno, std::generic_category(), "kjournal: open");
+                }
+
+                _flusher = std::thread{&kjournal::run, this};
+            }
+
+            kjournal() = delete;
+            kjournal(const kjournal& copy) = delete;
+            kjournal& operator=(const kjournal& copy) = delete;
+
+            ~kjournal() {
+                hand_over();
+
+                {
+                    std::unique_lock<std::mutex> lock{_mutex};
+                    _is_stopping = true;
+                }
+
+                _cv.notify_all();
+                _flusher.join();
+                close(_fd);
+            }
+
+            void append_use(uint64_t id) {
+                append(id | op_use);
+            }
+
+            void append_free(uint64_t id) {
+                append(id | op_free);
+            }
+
+            void append_range(uint64_t first, uint64_t len, bool is_using) {
+                if (is_using) {
+                    append(first | op_use_range);
+                } else {
+                    append(first | op_free_range);
+                }
+
+                append(len);
+            }
+
+            // all records appended so far are written and, unless the policy is none, synced
+            void commit() {
+                hand_over();
+
+                std::unique_lock<std::mutex> lock{_mutex};
+                _cv.wait(lock, [this] { return _pending_count == 0; });
+
+                // the flusher syncs every batch under the commit policy
+                if (_options.policy == fsync_policy::interval && _error == 0 && fdatasync(_fd) != 0) {
+                    _error = errno;
+                }
+
+                check_error();
+            }
+
+            // the log is emptied, once a snapshot holds the state of all its records
+            void reset() {
+                commit();
+
+                std::unique_lock<std::mutex> lock{_mutex};
+
+                if (ftruncate(_fd, 0) != 0) {
+                    _error = errno;
+                }
+
+                check_error();
+            }
+
+            /**
+             * apply the records of the log at path to the tree, returns the number of operations,
+             * a record torn by a crash at the end of the log is ignored, a missing log has none
+             */
+            template<typename T>
+            static uint64_t replay(const char* path, T& tree) {
+                int fd = open(path, O_RDONLY);
+
+                if (fd < 0) {
+                    if (errno == ENOENT) {
+                        return 0;
+                    }
+
+                    throw std::system_error(errno, std::generic_category(), "kjournal: open");
+                }
+
+                std::vector<uint64_t> records(size_t{1} << 16);
+                uint64_t count = 0;
+                uint64_t range = 0;     // a range record waiting for its length
+                bool is_range = false;
+                size_t tail = 0;        // bytes of a record split between two reads
+
+                for (;;) {
+                    ssize_t bytes = read(fd, reinterpret_cast<uint8_t*>(records.data()) + tail,
+                                         records.size() * sizeof(uint64_t) - tail);
+
+                    if (bytes < 0) {
+                        int error = errno;
+                        close(fd);
+                        throw std::system_error(error, std::generic_category(), "kjournal: read");
+                    }
+
+                    if (bytes == 0) {
+                        break;
+                    }
+
+                    size_t total = tail + bytes;
+                    size_t words = total / sizeof(uint64_t);
+
+                    for (size_t i = 0; i < words; ++i) {
+                        uint64_t record = get_little_endian(records[i]);
+
+                        if (is_range) {
+                            if ((range & op_mask) == op_use_range) {
+                                tree.use_range(range & id_mask, record);
+                            } else {
+                                tree.free_range(range & id_mask, record);
+                            }
+
+                            is_range = false;
+                            ++count;
+                        } else if ((record & op_mask) >= op_use_range) {
+                            range = record;
+                            is_range = true;
+                        } else {
+                            if ((record & op_mask) == op_use) {
+                                tree.use_id(record & id_mask);
+                            } else {
+                                tree.free_id(record & id_mask);
+                            }
+
+                            ++count;
+                        }
+                    }
+
+                    tail = total % sizeof(uint64_t);
+
+                    if (tail > 0) {
+                        std::copy(reinterpret_cast<uint8_t*>(records.data()) + words * sizeof(uint64_t),
+                                  reinterpret_cast<uint8_t*>(records.data()) + total,
+                                  reinterpret_cast<uint8_t*>(records.data()));
+                    }
+                }
+
+                close(fd);
+                return count;
+            }
+
+        private:
+            static constexpr uint64_t op_use = uint64_t{0} << 62;
+            static constexpr uint64_t op_free = uint64_t{1} << 62;
+            static constexpr uint64_t op_use_range = uint64_t{2} << 62;
+            static constexpr uint64_t op_free_range = uint64_t{3} << 62;
+            static constexpr uint64_t op_mask = uint64_t{3} << 62;
+            static constexpr uint64_t id_mask = ~op_mask;
+
+            options _options;
+            int _fd = -1;
+
+            // filled by the caller, no lock
+            std::vector<uint64_t> _active;
+            size_t _count = 0;
+
+            // written by the flusher
+            std::vector<uint64_t> _pending;
+            size_t _pending_count = 0;
+
+            std::mutex _mutex;
+            std::condition_variable _cv;
+            std::thread _flusher;
+            bool _is_stopping = false;
+            int _error = 0;
+
+        private:
+            void append(uint64_t record) {
+                _active[_count++] = get_little_endian(record);
+
+                if (__builtin_expect(_count >= _options.batch_records, 0)) {
+                    hand_over();
+                }
+            }
+
+            static uint64_t get_little_endian(uint64_t word) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                return __builtin_bswap64(word);
+#else
+                return word;
+#endif
+            }
+
+            // the active batch becomes the pending one, once the flusher is done with the previous batch
+            void hand_over() {
+                if (_count == 0) {
+                    return;
+                }
+
+                {
+                    std::unique_lock<std::mutex> lock{_mutex};
+                    _cv.wait(lock, [this] { return _pending_count == 0; });
+
+                    _active.swap(_pending);
+                    _pending_count = _count;
+                    _count = 0;
+                }
+
+                _cv.notify_all();
+            }
+
+            void run() {
+                auto last_sync = std::chrono::steady_clock::now();
+                std::unique_lock<std::mutex> lock{_mutex};
+
+                for (;;) {
+                    _cv.wait(lock, [this] { return _pending_count > 0 || _is_stopping; });
+
+                    if (_pending_count == 0) {
+                        break;
+                    }
+
+                    // the batch is not touched by the caller until it is handed back
+                    lock.unlock();
+                    int error = write_all(_pending.data(), _pending_count * sizeof(uint64_t));
+
+                    if (error == 0 && is_sync_due(last_sync)) {
+                        error = fdatasync(_fd) == 0 ? 0 : errno;
+                        last_sync = std::chrono::steady_clock::now();
+                    }
+
+                    lock.lock();
+
+                    if (error != 0 && _error == 0) {
+                        _error = error;
+                    }
+
+                    _pending_count = 0;
+                    _cv.notify_all();
+                }
+            }
+
+            bool is_sync_due(std::chrono::steady_clock::time_point last_sync) const {
+                switch (_options.policy) {
+                    case fsync_policy::commit:
+                        return true;
+                    case fsync_policy::interval:
+                        return std::chrono::steady_clock::now() - last_sync >= _options.interval;
+                    default:
+                        return false;
+                }
+            }
+
+            int write_all(const uint64_t* data, size_t bytes) {
+                const uint8_t* ptr = reinterpret_cast<const uint8_t*>(data);
+
+                while (bytes > 0) {
+                    ssize_t written = write(_fd, ptr, bytes);
+
+                    if (written < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+
+                        return errno;
+                    }
+
+                    ptr += written;
+                    bytes -= written;
+                }
+
+                return 0;
+            }
+
+            // a failed write or sync of the flusher is thrown to the caller, once
+            void check_error() {
+                if (_error != 0) {
+                    int error = _error;
+                    _error = 0;
+                    throw std::system_error(error, std::generic_category(), "kjournal: write");
+                }
+            }
+    };
+}
+
+#endif // KJOURNAL_H
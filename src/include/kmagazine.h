@@ -0,0 +1,177 @@
+#ifndef KMAGAZINE_H
+#define KMAGAZINE_H
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+
+#include "kcommon.h"
+#include "kbtree_atomic.h"
+
+namespace kupid {
+    /**
+     * per-thread cache of IDs in front of a shared ID factory
+     *
+     * every thread owns its own magazine, IDs are taken from and given back to
+     * the shared factory in batches of capacity / 2, therefore most next() and
+     * free_id() calls touch only the magazine of the calling thread
+     *
+     * order::lowest hands out the lowest ID within the magazine,
+     * order::lifo hands out the most recently freed ID,
+     * capacity 0 disables the magazine: the lowest free ID of the shared factory
+     *
+     * the cached IDs are also kept in a small local set, free_id() of a cached ID returns false
+     * without touching the shared factory: is_checked also rejects an ID free in the shared
+     * factory, a load of a data word written by the other threads
+     *
+     * a magazine is not thread-safe, the shared factory must be, e.g. kbtree_atomic
+     */
+
+    template<typename T = kbtree_atomic>
+    class kmagazine {
+        public:
+            enum class order {
+                lowest,
+                lifo
+            };
+
+            kmagazine(T& shared, uint32_t capacity = 64, order ord = order::lowest, bool is_checked = false)
+                : _shared(shared),
+                  _capacity{capacity},
+                  _order{ord},
+                  _is_checked{is_checked},
+                  _cached{capacity}
+            {
+                _ids.reserve(capacity);
+            }
+
+            kmagazine() = delete;                                   // default constructor
+            kmagazine(const kmagazine& copy) = delete;              // copy constructor
+            kmagazine& operator=(const kmagazine& copy) = delete;   // copy assignment
+
+            ~kmagazine() {
+                flush();
+            }
+
+            int64_t next(bool is_using = true) {
+                if (_capacity == 0) {
+                    return _shared.next(is_using);
+                }
+
+                if (_ids.empty() && !refill()) {
+                    return -1;
+                }
+
+                // the top of the stack is the ID to hand out
+                uint32_t id = _ids.back();
+
+                if (is_using) {
+                    _ids.pop_back();
+                    _cached.erase(id);
+                }
+
+                return id;
+            }
+
+            // false if the ID is already cached, it would be handed out twice, or checked and free
+            bool free_id(uint32_t id) {
+                if (_capacity == 0) {
+                    return _shared.free_id(id);
+                }
+
+                if (id >= _shared.size() || _cached.contains(id) || (_is_checked && !_shared.is_using(id))) {
+                    return false;
+                }
+
+                if (_ids.size() == _capacity) {
+                    drain();
+                }
+
+                if (_order == order::lowest) {
+                    // kept in decreasing order, the lowest ID is at the top
+                    auto it = std::lower_bound(_ids.begin(), _ids.end(), id, std::greater<uint32_t>());
+                    _ids.insert(it, id);
+                } else {
+                    _ids.push_back(id);
+                }
+
+                _cached.insert(id);
+                return true;
+            }
+
+            // give every cached ID back to the shared factory
+            void flush() {
+                for (auto id : _ids) {
+                    _shared.free_id(id);
+                }
+
+                _ids.clear();
+                _cached.clear();
+            }
+
+            uint32_t size() const {
+                return _shared.size();
+            }
+
+            uint32_t capacity() const {
+                return _capacity;
+            }
+
+            // number of IDs cached by this magazine
+            uint32_t count() const {
+                return _ids.size();
+            }
+
+            bool is_cached(uint32_t id) const {
+                return _cached.contains(id);
+            }
+
+        private:
+            T& _shared;
+            uint32_t _capacity;
+            order _order;
+            bool _is_checked;
+            std::vector<uint32_t> _ids;
+            kid_set<uint32_t> _cached;      // the IDs of _ids
+
+        private:
+            uint32_t batch() const {
+                return std::max<uint32_t>(1, _capacity / 2);
+            }
+
+            bool refill() {
+                uint32_t n = batch();
+
+                for (uint32_t i = 0; i < n; ++i) {
+                    int64_t id = _shared.next();
+
+                    if (id < 0) {
+                        break;
+                    }
+
+                    _ids.push_back(id);
+                    _cached.insert(id);
+                }
+
+                // taken in increasing order, the lowest one goes to the top
+                std::reverse(_ids.begin(), _ids.end());
+
+                return !_ids.empty();
+            }
+
+            // give the bottom of the stack back: the highest IDs or the least recently freed ones
+            void drain() {
+                uint32_t n = batch();
+
+                for (uint32_t i = 0; i < n; ++i) {
+                    _shared.free_id(_ids[i]);
+                    _cached.erase(_ids[i]);
+                }
+
+                _ids.erase(_ids.begin(), _ids.begin() + n);
+            }
+    };
+}
+
+#endif // KMAGAZINE_H
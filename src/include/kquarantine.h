@@ -0,0 +1,193 @@
+#ifndef KQUARANTINE_H
+#define KQUARANTINE_H
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "kcommon.h"
+#include "kbtree.h"
+
+namespace kupid {
+    /**
+     * a holding area for freed IDs in front of a kbtree
+     *
+     * next() of a kbtree hands out the lowest free ID, so an ID freed a moment ago comes back
+     * at once, and a late message for its old owner reaches the new one: a freed ID is held
+     * here first, and given back to the tree only once delay has passed since it was freed
+     *
+     * clock::operations counts the next() and free_id() calls, clock::time the nanoseconds
+     * of the steady clock
+     *
+     * the IDs are held in the order they were freed, in a ring of capacity IDs with one stamp
+     * per batch of 64 IDs, the time of its last ID: a batch is given back as a whole, sorted,
+     * with one free_word() per data word
+     *
+     * the held IDs are also kept in a set sized to the ring, a second free_id() of a held ID
+     * returns false
+     *
+     * when the ring is full the oldest batch is given back before its delay,
+     * capacity 0 disables the quarantine: free_id() passes through to the tree
+     *
+     * not thread-safe
+     */
+
+    template<typename T = uint32_t>
+    class kquarantine {
+        public:
+            enum class clock {
+                operations,
+                time
+            };
+
+            static constexpr uint32_t batch_ids = 64;
+
+            kquarantine(basic_kbtree<T>& tree, uint32_t capacity = 4096, uint64_t delay = 1024,
+                        clock clk = clock::operations)
+                : _tree(tree),
+                  _delay{delay},
+                  _clock{clk}
+            {
+                // whole batches, a batch never wraps around the ring
+                uint64_t batches = (uint64_t{capacity} + batch_ids - 1) / batch_ids;
+                _ids.resize(batches * batch_ids);
+                _stamps.resize(batches);
+                _held = kid_set<T>{_ids.size()};
+            }
+
+            kquarantine() = delete;                                     // default constructor
+            kquarantine(const kquarantine& copy) = delete;              // copy constructor
+            kquarantine& operator=(const kquarantine& copy) = delete;   // copy assignment
+
+            ~kquarantine() {
+                flush();
+            }
+
+            int64_t next(bool is_using = true) {
+                ++_ops;
+                release(get_now());
+
+                return _tree.next(is_using);
+            }
+
+            // false if the ID is not used, or already held
+            bool free_id(T id) {
+                if (_ids.empty()) {
+                    return _tree.free_id(id);
+                }
+
+                if (!_tree.is_using(id) || is_held(id)) {
+                    return false;
+                }
+
+                ++_ops;
+                uint64_t now = get_now();
+
+                if (_tail - _head == _ids.size()) {
+                    release_batch();
+                }
+
+                _ids[_tail % _ids.size()] = id;
+                _held.insert(id);
+                _stamps[_tail / batch_ids % _stamps.size()] = now;
+                ++_tail;
+
+                release(now);
+
+                return true;
+            }
+
+            // give back the IDs whose delay has passed
+            void release() {
+                release(get_now());
+            }
+
+            // give back every held ID, whatever its delay
+            void flush() {
+                while (_head != _tail) {
+                    release_batch();
+                }
+            }
+
+            bool is_held(T id) const {
+                return _held.contains(id);
+            }
+
+            T size() const {
+                return _tree.size();
+            }
+
+            // IDs of the ring, a multiple of 64
+            uint32_t capacity() const {
+                return _ids.size();
+            }
+
+            uint64_t delay() const {
+                return _delay;
+            }
+
+            // number of held IDs
+            uint32_t count() const {
+                return _tail - _head;
+            }
+
+            // bytes of the ring, its stamps and the set of the held IDs
+            size_t get_bytes() const {
+                return _ids.size() * sizeof(T) + _stamps.size() * sizeof(uint64_t) + _held.get_bytes();
+            }
+
+        private:
+            basic_kbtree<T>& _tree;
+            uint64_t _delay;
+            clock _clock;
+            uint64_t _ops = 0;
+            uint64_t _head = 0;         // the oldest held ID, positions increase forever
+            uint64_t _tail = 0;         // past the newest held ID
+            std::vector<T> _ids;
+            std::vector<uint64_t> _stamps;
+            kid_set<T> _held;
+
+        private:
+            uint64_t get_now() const {
+                if (_clock == clock::operations) {
+                    return _ops;
+                }
+
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+            }
+
+            // the oldest batches whose last ID was freed delay ago
+            void release(uint64_t now) {
+                while (_head != _tail && now - _stamps[_head / batch_ids % _stamps.size()] >= _delay) {
+                    release_batch();
+                }
+            }
+
+            // the rest of the oldest batch, sorted: its IDs of a data word are freed together
+            void release_batch() {
+                uint64_t end = std::min(_tail, (_head / batch_ids + 1) * batch_ids);
+                T* first = _ids.data() + _head % _ids.size();
+                T* last = first + (end - _head);
+
+                std::sort(first, last);
+
+                while (first != last) {
+                    T word = *first >> 6;
+                    uint64_t bits = 0;
+
+                    for (; first != last && *first >> 6 == word; ++first) {
+                        bits |= uint64_t{1} << (*first & 63);
+                        _held.erase(*first);
+                    }
+
+                    _tree.free_word(word, bits);
+                }
+
+                _head = end;
+            }
+    };
+}
+
+#endif // KQUARANTINE_H
@@ -0,0 +1,249 @@
+#ifndef KSCAN_H
+#define KSCAN_H
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define KSCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace kupid {
+    /**
+     * first zero bit of a flat bitmap of 64-bit words
+     *
+     * the AVX-512 kernel compares 512 bits, the AVX2 kernel 256 bits per step
+     * against all ones, the scalar kernel one word, the best kernel supported
+     * by the CPU is selected at run time, without compiler flags
+     *
+     * the k-th set bit of a word is found by PDEP of BMI2, else by the popcounts of its bytes
+     *
+     * see:
+     *      https://gcc.gnu.org/onlinedocs/gcc/Common-Function-Attributes.html#index-target-function-attribute
+     *      https://gcc.gnu.org/onlinedocs/gcc/x86-Built-in-Functions.html
+     */
+
+    namespace kscan {
+        enum class kernel {
+            scalar,
+            avx2,
+            avx512
+        };
+
+        // index of the first word which is not all ones in [0, count), or count
+        using scan_fn = size_t (*)(const uint64_t* words, size_t count);
+
+        inline size_t scan_scalar(const uint64_t* words, size_t count) {
+            size_t index = 0;
+
+            while (index < count && words[index] == ~uint64_t{0}) {
+                ++index;
+            }
+
+            return index;
+        }
+
+#ifdef KSCAN_X86
+        __attribute__((target("avx2")))
+        inline size_t scan_avx2(const uint64_t* words, size_t count) {
+            const __m256i ones = _mm256_set1_epi64x(-1);
+            size_t index = 0;
+
+            for (; index + 4 <= count; index += 4) {
+                __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + index));
+                // a lane of all ones when the word is full, sign bits gathered per 64-bit lane
+                int full = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(data, ones)));
+
+                if (full != 0xF) {
+                    return index + __builtin_ctz(~full);
+                }
+            }
+
+            return index + scan_scalar(words + index, count - index);
+        }
+
+        __attribute__((target("avx512f")))
+        inline size_t scan_avx512(const uint64_t* words, size_t count) {
+            const __m512i ones = _mm512_set1_epi64(-1);
+            size_t index = 0;
+
+            for (; index + 8 <= count; index += 8) {
+                __m512i data = _mm512_loadu_si512(words + index);
+                __mmask8 not_full = _mm512_cmpneq_epu64_mask(data, ones);
+
+                if (not_full != 0) {
+                    return index + __builtin_ctz(not_full);
+                }
+            }
+
+            // the rest of the words under a mask, the masked out lanes read as full
+            if (index < count) {
+                __mmask8 rest = (1U << (count - index)) - 1;
+                __m512i data = _mm512_mask_loadu_epi64(ones, rest, words + index);
+                __mmask8 not_full = _mm512_cmpneq_epu64_mask(data, ones);
+
+                if (not_full != 0) {
+                    return index + __builtin_ctz(not_full);
+                }
+            }
+
+            return count;
+        }
+#endif
+
+        // index of the first word of a 64-byte aligned node of 8 words which is not all ones, or 8
+        inline size_t scan_node_scalar(const uint64_t* node) {
+            return scan_scalar(node, 8);
+        }
+
+#ifdef KSCAN_X86
+        __attribute__((target("avx2")))
+        inline size_t scan_node_avx2(const uint64_t* node) {
+            const __m256i ones = _mm256_set1_epi64x(-1);
+
+            __m256i low = _mm256_cmpeq_epi64(_mm256_load_si256(reinterpret_cast<const __m256i*>(node)), ones);
+            __m256i high = _mm256_cmpeq_epi64(_mm256_load_si256(reinterpret_cast<const __m256i*>(node + 4)), ones);
+
+            unsigned full = _mm256_movemask_pd(_mm256_castsi256_pd(low)) |
+                            (_mm256_movemask_pd(_mm256_castsi256_pd(high)) << 4);
+
+            return __builtin_ctz(~full);
+        }
+
+        __attribute__((target("avx512f")))
+        inline size_t scan_node_avx512(const uint64_t* node) {
+            __mmask8 not_full = _mm512_cmpneq_epu64_mask(_mm512_load_si512(node), _mm512_set1_epi64(-1));
+            return not_full != 0 ? __builtin_ctz(not_full) : 8;
+        }
+#endif
+
+        inline bool is_supported(kernel k) {
+            switch (k) {
+                case kernel::scalar:
+                    return true;
+#ifdef KSCAN_X86
+                case kernel::avx2:
+                    return __builtin_cpu_supports("avx2");
+                case kernel::avx512:
+                    return __builtin_cpu_supports("avx512f");
+#endif
+                default:
+                    return false;
+            }
+        }
+
+        inline scan_fn get_scan_fn(kernel k) {
+            switch (k) {
+#ifdef KSCAN_X86
+                case kernel::avx2:
+                    return scan_avx2;
+                case kernel::avx512:
+                    return scan_avx512;
+#endif
+                default:
+                    return scan_scalar;
+            }
+        }
+
+        inline kernel get_best_kernel() {
+            if (is_supported(kernel::avx512)) {
+                return kernel::avx512;
+            } else if (is_supported(kernel::avx2)) {
+                return kernel::avx2;
+            } else {
+                return kernel::scalar;
+            }
+        }
+
+        // the kernel in use, selected once
+        inline kernel& get_kernel_ref() {
+            static kernel k = get_best_kernel();
+            return k;
+        }
+
+        inline scan_fn& get_scan_fn_ref() {
+            static scan_fn fn = get_scan_fn(get_kernel_ref());
+            return fn;
+        }
+
+        inline kernel get_kernel() {
+            return get_kernel_ref();
+        }
+
+        // override the selection, e.g. to compare the kernels, false if the CPU lacks it
+        inline bool set_kernel(kernel k) {
+            if (!is_supported(k)) {
+                return false;
+            }
+
+            get_kernel_ref() = k;
+            get_scan_fn_ref() = get_scan_fn(k);
+            return true;
+        }
+
+        /**
+         * first zero bit among the first bits of words, or -1
+         *
+         * the bits past the last one in the last word are ignored
+         */
+        inline int64_t find_first_zero(const uint64_t* words, size_t bits) {
+            size_t count = bits / 64;
+            size_t index = get_scan_fn_ref()(words, count);
+
+            if (index < count) {
+                return index * 64 + __builtin_ctzll(~words[index]);
+            }
+
+            size_t tail = bits % 64;
+
+            if (tail > 0) {
+                uint64_t data = words[count] | ~((uint64_t{1} << tail) - 1);
+
+                if (data != ~uint64_t{0}) {
+                    return count * 64 + __builtin_ctzll(~data);
+                }
+            }
+
+            return -1;
+        }
+
+        // position of the k-th set bit of bits, from 0, k below the popcount of bits
+        inline uint32_t select_bit_scalar(uint64_t bits, uint32_t k) {
+            uint32_t pos = 0;
+
+            // whole bytes first, then the lowest set bits of the byte are cleared
+            for (uint32_t count; k >= (count = __builtin_popcountll(bits & 0xFF)); k -= count) {
+                bits >>= 8;
+                pos += 8;
+            }
+
+            for (; k > 0; --k) {
+                bits &= bits - 1;
+            }
+
+            return pos + __builtin_ctzll(bits);
+        }
+
+#ifdef KSCAN_X86
+        // the k-th set bit deposited onto bit k of a single bit
+        __attribute__((target("bmi2")))
+        inline uint32_t select_bit_bmi2(uint64_t bits, uint32_t k) {
+            return __builtin_ctzll(_pdep_u64(uint64_t{1} << k, bits));
+        }
+#endif
+
+        inline uint32_t select_bit(uint64_t bits, uint32_t k) {
+#ifdef KSCAN_X86
+            static const bool has_bmi2 = __builtin_cpu_supports("bmi2");
+
+            if (has_bmi2) {
+                return select_bit_bmi2(bits, k);
+            }
+#endif
+            return select_bit_scalar(bits, k);
+        }
+    }
+}
+
+#endif // KSCAN_H
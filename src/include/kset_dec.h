@@ -5,6 +5,8 @@
 #include <algorithm>
 #include <cstdint>
 
+#include "kcommon.h"
+
 namespace kupid {
     /**
      * keep track of available IDs
@@ -23,6 +25,39 @@ namespace kupid {
                 clear();
             }
 
+            // all IDs used or free
+            kset_dec(uint32_t size, kpreset preset)
+                : _size{size},
+                  _usage{size}
+            {
+                if (preset == kpreset::all_free) {
+                    clear();
+                }
+            }
+
+            // the free IDs are the gaps between the used IDs, inserted in increasing order at the end hint
+            kset_dec(uint32_t size, ksorted_ids<uint32_t> used)
+                : _size{size}
+            {
+                uint32_t id = 0;
+
+                for (uint32_t used_id : used) {
+                    for (; id < std::min(used_id, _size); ++id) {
+                        _data.insert(_data.end(), id);
+                    }
+
+                    if (id == used_id) {
+                        ++id;
+                    }
+                }
+
+                for (; id < _size; ++id) {
+                    _data.insert(_data.end(), id);
+                }
+
+                _usage.set(_size - _data.size());
+            }
+
             kset_dec() = delete;
 
             int64_t next(bool is_using = true) {
@@ -30,13 +65,16 @@ namespace kupid {
 
                 if  (it == _data.end()) {
                     return -1;
-                } else {
-                    if (is_using) {
-                        _data.erase(it);
-                    }
                 }
 
-                return  *it;
+                uint32_t id = *it;
+
+                if (is_using) {
+                    _data.erase(it);
+                    _usage.inc();
+                }
+
+                return id;
             }
 
             bool use_id(uint32_t id) {
@@ -45,6 +83,7 @@ namespace kupid {
                     auto found = it != _data.end();
                     if (found) {
                         _data.erase(it);
+                        _usage.inc();
                     }
                     return found;
                 } else {
@@ -55,6 +94,9 @@ namespace kupid {
             bool free_id(uint32_t id) {
                 if (id < _size) {
                     auto result = _data.insert(id);
+                    if (result.second) {
+                        _usage.dec();
+                    }
                     return result.second;
                 } else {
                     return false;
@@ -72,10 +114,31 @@ namespace kupid {
 
             void clear() {
                 _data.clear();
-                // start with all IDs are available
+                // start with all IDs are available, in increasing order at the end hint
                 for (uint32_t id = 0; id < _size; ++id) {
-                    _data.insert(id);
+                    _data.insert(_data.end(), id);
                 }
+
+                _usage.set(0);
+            }
+
+            // the number of used IDs in O(1)
+            uint32_t used_count() const {
+                return _usage.used();
+            }
+
+            uint32_t free_count() const {
+                return _size - _usage.used();
+            }
+
+            // f(used) once the used IDs rise to used, nullptr removes the watermark
+            void set_high_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_high_watermark(used, std::move(f));
+            }
+
+            // f(used) once the used IDs fall to used, nullptr removes the watermark
+            void set_low_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_low_watermark(used, std::move(f));
             }
 
             uint32_t size() const {
@@ -89,6 +152,7 @@ namespace kupid {
         private:
             uint32_t _size;
             std::set<uint32_t> _data{};
+            kusage _usage;
     };
 }
 
@@ -5,6 +5,8 @@
 #include <algorithm>
 #include <cstdint>
 
+#include "kcommon.h"
+
 namespace kupid {
     /**
      * keep track of used IDs
@@ -21,6 +23,30 @@ namespace kupid {
                 : _size{size}
             {}
 
+            // all IDs used or free, in increasing order each insert lands at the end hint in amortized O(1)
+            kset_inc(uint32_t size, kpreset preset)
+                : _size{size},
+                  _usage{preset == kpreset::all_used ? size : 0}
+            {
+                if (preset == kpreset::all_used) {
+                    for (uint32_t id = 0; id < _size; ++id) {
+                        _data.insert(_data.end(), id);
+                    }
+                }
+            }
+
+            kset_inc(uint32_t size, ksorted_ids<uint32_t> used)
+                : _size{size}
+            {
+                for (uint32_t id : used) {
+                    if (id < _size) {
+                        _data.insert(_data.end(), id);
+                    }
+                }
+
+                _usage.set(_data.size());
+            }
+
             kset_inc() = delete;
 
             int64_t next(bool is_using = true) {
@@ -62,6 +88,9 @@ namespace kupid {
             bool use_id(uint32_t id) {
                 if (id < _size) {
                     auto result = _data.insert(id);
+                    if (result.second) {
+                        _usage.inc();
+                    }
                     return result.second;
                 } else {
                     return false;
@@ -74,6 +103,7 @@ namespace kupid {
                     auto found = it != _data.end();
                     if (found) {
                         _data.erase(it);
+                        _usage.dec();
                     }
                     return found;
                 } else {
@@ -92,6 +122,26 @@ namespace kupid {
 
             void clear() {
                 _data.clear();
+                _usage.set(0);
+            }
+
+            // the number of used IDs in O(1)
+            uint32_t used_count() const {
+                return _usage.used();
+            }
+
+            uint32_t free_count() const {
+                return _size - _usage.used();
+            }
+
+            // f(used) once the used IDs rise to used, nullptr removes the watermark
+            void set_high_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_high_watermark(used, std::move(f));
+            }
+
+            // f(used) once the used IDs fall to used, nullptr removes the watermark
+            void set_low_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_low_watermark(used, std::move(f));
             }
 
             uint32_t size() const {
@@ -105,6 +155,7 @@ namespace kupid {
         private:
             uint32_t _size;
             std::set<uint32_t> _data{};
+            kusage _usage;
     };
 }
 
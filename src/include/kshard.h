@@ -0,0 +1,186 @@
+#ifndef KSHARD_H
+#define KSHARD_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <exception>
+#include <cstdint>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "kbtree_atomic.h"
+
+namespace kupid {
+    /**
+     * per-core shards of a thread-safe ID factory, e.g. kbtree_atomic
+     *
+     * [0, size) is split into one shard per core, a thread takes IDs from the shard
+     * of its core first and steals from the next shards only when it is exhausted,
+     * the top word of a shard tells if it has a free ID without a walk down its tree,
+     * therefore the threads of different cores touch different cache lines,
+     * at the price of the lowest free ID: next() hands out the lowest free ID of a shard
+     *
+     * on Linux every shard is allocated by a thread pinned to its core: the pages of
+     * a shard are first touched, and so placed, on the NUMA node of its core
+     *
+     * clear() is not safe to call concurrently with the other operations
+     *
+     * see:
+     *      https://man7.org/linux/man-pages/man3/sched_getcpu.3.html
+     *      https://www.kernel.org/doc/html/latest/admin-guide/mm/numa_memory_policy.html
+     */
+
+    template<typename T = kbtree_atomic>
+    class kshard {
+        public:
+            kshard(uint32_t size, uint32_t shards = std::thread::hardware_concurrency())
+                : _size{size}
+            {
+                // at least one shard, and no shard without an ID
+                shards = std::max(uint32_t{1}, std::min(shards, size));
+                _shard_size = size / shards + (size % shards > 0 ? 1 : 0);
+                shards = _shard_size > 0 ? size / _shard_size + (size % _shard_size > 0 ? 1 : 0) : 1;
+
+                _shards.resize(shards);
+                allocate_shards();
+            }
+
+            kshard() = delete;                                  // default constructor
+            kshard(const kshard& copy) = delete;                // copy constructor
+            kshard& operator=(const kshard& copy) = delete;     // copy assignment
+
+            // the lowest free ID of the shard of this core, else of the first next shard with a free ID
+            int64_t next(bool is_using = true) {
+                uint32_t count = _shards.size();
+                uint32_t home = get_home_shard();
+
+                for (uint32_t i = 0; i < count; ++i) {
+                    uint32_t shard = home + i < count ? home + i : home + i - count;
+
+                    if (!_shards[shard]->has_free()) {
+                        continue;
+                    }
+
+                    int64_t id = _shards[shard]->next(is_using);
+
+                    if (id >= 0) {
+                        return int64_t{shard} * _shard_size + id;
+                    }
+                }
+
+                return -1;
+            }
+
+            bool use_id(uint32_t id) {
+                return id < _size && _shards[id / _shard_size]->use_id(id % _shard_size);
+            }
+
+            bool free_id(uint32_t id) {
+                return id < _size && _shards[id / _shard_size]->free_id(id % _shard_size);
+            }
+
+            bool is_using(uint32_t id) const {
+                return id < _size && _shards[id / _shard_size]->is_using(id % _shard_size);
+            }
+
+            // not thread-safe
+            void clear() {
+                for (auto& shard : _shards) {
+                    shard->clear();
+                }
+            }
+
+            // true if a shard has a free ID
+            bool has_free() const {
+                return std::any_of(_shards.begin(), _shards.end(),
+                                   [](const std::unique_ptr<T>& shard) { return shard->has_free(); });
+            }
+
+            uint32_t size() const {
+                return _size;
+            }
+
+            uint32_t shard_count() const {
+                return _shards.size();
+            }
+
+            // IDs of a shard, the last one may have fewer
+            uint32_t shard_size() const {
+                return _shard_size;
+            }
+
+        private:
+            uint32_t _size;
+            uint32_t _shard_size;
+            std::vector<std::unique_ptr<T>> _shards;
+
+        private:
+            uint32_t get_shard_ids(uint32_t shard) const {
+                uint32_t first = shard * _shard_size;
+                return _size - first < _shard_size ? _size - first : _shard_size;
+            }
+
+            // the shard of the core of the calling thread
+            uint32_t get_home_shard() const {
+#ifdef __linux__
+                int cpu = sched_getcpu();
+
+                if (cpu >= 0) {
+                    return cpu % _shards.size();
+                }
+#endif
+                return std::hash<std::thread::id>{}(std::this_thread::get_id()) % _shards.size();
+            }
+
+            // each shard first touched by a thread on the core it belongs to
+            void allocate_shards() {
+#ifdef __linux__
+                uint32_t cores = std::max(1U, std::thread::hardware_concurrency());
+
+                if (_shards.size() > 1 && cores > 1) {
+                    std::vector<std::thread> threads;
+                    std::vector<std::exception_ptr> errors(_shards.size());
+
+                    for (uint32_t shard = 0; shard < _shards.size(); ++shard) {
+                        threads.emplace_back([this, shard, cores, &errors] {
+                            cpu_set_t cpus;
+                            CPU_ZERO(&cpus);
+                            CPU_SET(shard % cores, &cpus);
+                            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+                            try {
+                                _shards[shard].reset(new T{get_shard_ids(shard)});
+                            } catch (...) {
+                                errors[shard] = std::current_exception();
+                            }
+                        });
+                    }
+
+                    for (auto& thread : threads) {
+                        thread.join();
+                    }
+
+                    // e.g. std::bad_alloc of a shard
+                    for (auto& error : errors) {
+                        if (error) {
+                            std::rethrow_exception(error);
+                        }
+                    }
+
+                    return;
+                }
+#endif
+                for (uint32_t shard = 0; shard < _shards.size(); ++shard) {
+                    _shards[shard].reset(new T{get_shard_ids(shard)});
+                }
+            }
+    };
+}
+
+#endif // KSHARD_H
@@ -0,0 +1,494 @@
+#ifndef KVEB_H
+#define KVEB_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+
+#include "kcommon.h"
+
+namespace kupid {
+    /**
+     * van Emde Boas tree with bitmap leaves
+     *
+     * a bitmap of 64-bit words keeps the free IDs, a bit is on when the ID is free,
+     * and a van Emde Boas tree keeps the indices of the words with a free bit,
+     * therefore the lowest free ID and the successor of an ID are found in O(log log U)
+     *
+     * the tree stores the minimum of a node outside of its clusters, and a universe
+     * of up to 64 indices is a single word, as in CLRS, Chapter 20
+     *
+     * van Emde Boas tree
+     * see:
+     *      https://en.wikipedia.org/wiki/Van_Emde_Boas_tree
+     */
+
+    class kveb {
+        public:
+            kveb(uint32_t size)
+                : _size{size},
+                  _free(get_word_count(size)),
+                  _words{get_universe_bits(_free.size())}
+            {
+                clear();
+            }
+
+            // all IDs used or free
+            kveb(uint32_t size, kpreset preset)
+                : _size{size},
+                  _free(get_word_count(size)),
+                  _words{get_universe_bits(_free.size())},
+                  _usage{size}
+            {
+                if (preset == kpreset::all_free) {
+                    clear();
+                }
+            }
+
+            // the free bits of the used IDs cleared word by word, then the tree built from the words in one pass
+            kveb(uint32_t size, ksorted_ids<uint32_t> used)
+                : _size{size},
+                  _free(get_word_count(size), ~uint64_t{0}),
+                  _words{get_universe_bits(_free.size())}
+            {
+                if (_size % 64 != 0) {
+                    _free.back() = (uint64_t{1} << (_size % 64)) - 1;
+                }
+
+                uint64_t count = 0;
+
+                for (uint32_t id : used) {
+                    if (id < _size && (_free[id >> 6] & (uint64_t{1} << (id & 63))) != 0) {
+                        _free[id >> 6] &= ~(uint64_t{1} << (id & 63));
+                        ++count;
+                    }
+                }
+
+                _usage.set(count);
+
+                std::vector<uint32_t> words;
+                words.reserve(_free.size());
+
+                for (size_t index = 0; index < _free.size(); ++index) {
+                    if (_free[index] != 0) {
+                        words.push_back(index);
+                    }
+                }
+
+                _words.build(words.data(), words.size());
+            }
+
+            kveb() = delete;
+
+            int64_t next(bool is_using = true) {
+                uint32_t index = _words.min();
+
+                if (index == none) {
+                    return -1;
+                }
+
+                int64_t id = uint64_t{index} * 64 + __builtin_ctzll(_free[index]);
+
+                if (is_using) {
+                    use_id(id);
+                }
+
+                return id;
+            }
+
+            // the lowest free ID greater than id, or -1
+            int64_t successor(uint32_t id) const {
+                uint64_t from = uint64_t{id} + 1;
+
+                if (from >= _size) {
+                    return -1;
+                }
+
+                uint32_t index = from >> 6;
+                uint64_t bits = _free[index] & (~uint64_t{0} << (from & 63));
+
+                if (bits == 0) {
+                    index = _words.successor(index);
+
+                    if (index == none) {
+                        return -1;
+                    }
+
+                    bits = _free[index];
+                }
+
+                return uint64_t{index} * 64 + __builtin_ctzll(bits);
+            }
+
+            bool use_id(uint32_t id) {
+                if (id < _size) {
+                    uint64_t& bits = _free[id >> 6];
+                    uint64_t bit = uint64_t{1} << (id & 63);
+
+                    if ((bits & bit) != 0) {
+                        bits &= ~bit;
+
+                        // no free ID left in the word
+                        if (bits == 0) {
+                            _words.erase(id >> 6);
+                        }
+
+                        _usage.inc();
+                    }
+
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+
+            bool free_id(uint32_t id) {
+                if (id < _size) {
+                    uint64_t& bits = _free[id >> 6];
+                    uint64_t bit = uint64_t{1} << (id & 63);
+
+                    if ((bits & bit) == 0) {
+                        // the first free ID of the word
+                        if (bits == 0) {
+                            _words.insert(id >> 6);
+                        }
+
+                        bits |= bit;
+                        _usage.dec();
+                    }
+
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+
+            bool is_using(uint32_t id) const {
+                if (id < _size) {
+                    return (_free[id >> 6] & (uint64_t{1} << (id & 63))) == 0;
+                } else {
+                    return false;
+                }
+            }
+
+            void clear() {
+                std::fill(_free.begin(), _free.end(), ~uint64_t{0});
+
+                if (_size % 64 != 0) {
+                    _free.back() = (uint64_t{1} << (_size % 64)) - 1;
+                }
+
+                _words.clear();
+
+                if (!_free.empty()) {
+                    _words.build_range(0, _free.size());
+                }
+
+                _usage.set(0);
+            }
+
+            // the number of used IDs in O(1)
+            uint32_t used_count() const {
+                return _usage.used();
+            }
+
+            uint32_t free_count() const {
+                return _size - _usage.used();
+            }
+
+            // f(used) once the used IDs rise to used, nullptr removes the watermark
+            void set_high_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_high_watermark(used, std::move(f));
+            }
+
+            // f(used) once the used IDs fall to used, nullptr removes the watermark
+            void set_low_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_low_watermark(used, std::move(f));
+            }
+
+            uint32_t size() const {
+                return _size;
+            }
+
+        private:
+            static constexpr uint32_t none = UINT32_MAX;
+
+            // a set of indices in [0, 2^bits)
+            class node {
+                public:
+                    node(uint8_t bits)
+                        : _bits{bits}
+                    {
+                        if (bits > 6) {
+                            _summary.reset(new node(get_high_bits()));
+                            _clusters.reserve(uint64_t{1} << get_high_bits());
+
+                            for (uint64_t i = 0; i < (uint64_t{1} << get_high_bits()); ++i) {
+                                _clusters.emplace_back(get_low_bits());
+                            }
+                        }
+                    }
+
+                    bool is_empty() const {
+                        return is_leaf() ? _leaf == 0 : _min == none;
+                    }
+
+                    uint32_t min() const {
+                        if (is_leaf()) {
+                            return _leaf == 0 ? none : __builtin_ctzll(_leaf);
+                        }
+
+                        return _min;
+                    }
+
+                    uint32_t max() const {
+                        if (is_leaf()) {
+                            return _leaf == 0 ? none : 63 - __builtin_clzll(_leaf);
+                        }
+
+                        return _max;
+                    }
+
+                    // x must not be in the set
+                    void insert(uint32_t x) {
+                        if (is_leaf()) {
+                            _leaf |= uint64_t{1} << x;
+                            return;
+                        }
+
+                        if (_min == none) {
+                            _min = _max = x;
+                            return;
+                        }
+
+                        // the minimum stays out of the clusters
+                        if (x < _min) {
+                            std::swap(x, _min);
+                        }
+
+                        node& cluster = _clusters[get_high(x)];
+
+                        if (cluster.is_empty()) {
+                            _summary->insert(get_high(x));
+                        }
+
+                        cluster.insert(get_low(x));
+
+                        if (x > _max) {
+                            _max = x;
+                        }
+                    }
+
+                    // x must be in the set
+                    void erase(uint32_t x) {
+                        if (is_leaf()) {
+                            _leaf &= ~(uint64_t{1} << x);
+                            return;
+                        }
+
+                        if (_min == _max) {
+                            _min = _max = none;
+                            return;
+                        }
+
+                        // the minimum of the first cluster becomes the minimum
+                        if (x == _min) {
+                            uint32_t high = _summary->min();
+                            x = get_index(high, _clusters[high].min());
+                            _min = x;
+                        }
+
+                        uint32_t high = get_high(x);
+                        node& cluster = _clusters[high];
+                        cluster.erase(get_low(x));
+
+                        if (cluster.is_empty()) {
+                            _summary->erase(high);
+
+                            if (x == _max) {
+                                uint32_t last = _summary->max();
+                                _max = last == none ? _min : get_index(last, _clusters[last].max());
+                            }
+                        } else if (x == _max) {
+                            _max = get_index(high, cluster.max());
+                        }
+                    }
+
+                    // the lowest index greater than x, or none
+                    uint32_t successor(uint32_t x) const {
+                        if (is_leaf()) {
+                            uint64_t bits = x < 63 ? _leaf & (~uint64_t{0} << (x + 1)) : 0;
+                            return bits == 0 ? none : __builtin_ctzll(bits);
+                        }
+
+                        if (_min != none && x < _min) {
+                            return _min;
+                        }
+
+                        uint32_t high = get_high(x);
+                        uint32_t low = get_low(x);
+                        const node& cluster = _clusters[high];
+                        uint32_t last = cluster.max();
+
+                        if (last != none && low < last) {
+                            return get_index(high, cluster.successor(low));
+                        }
+
+                        uint32_t next = _summary->successor(high);
+
+                        if (next == none) {
+                            return none;
+                        }
+
+                        return get_index(next, _clusters[next].min());
+                    }
+
+                    void clear() {
+                        if (is_leaf()) {
+                            _leaf = 0;
+                            return;
+                        }
+
+                        if (_min == none) {
+                            return;
+                        }
+
+                        _min = _max = none;
+                        _summary->clear();
+
+                        for (auto& cluster : _clusters) {
+                            cluster.clear();
+                        }
+                    }
+
+                    // an empty set becomes [first, last), without a node visited twice
+                    void build_range(uint64_t first, uint64_t last) {
+                        if (is_leaf()) {
+                            uint64_t high = last < 64 ? (uint64_t{1} << last) - 1 : ~uint64_t{0};
+                            _leaf = high & ~((uint64_t{1} << first) - 1);
+                            return;
+                        }
+
+                        _min = first;
+                        _max = last - 1;
+
+                        // the minimum stays out of the clusters
+                        if (++first == last) {
+                            return;
+                        }
+
+                        uint32_t first_high = get_high(first);
+                        uint32_t last_high = get_high(last - 1);
+                        uint64_t cluster_size = uint64_t{1} << get_low_bits();
+
+                        for (uint32_t high = first_high; high <= last_high; ++high) {
+                            uint64_t begin = std::max(first, high * cluster_size);
+                            uint64_t end = std::min(last, (high + 1) * cluster_size);
+
+                            _clusters[high].build_range(begin - high * cluster_size, end - high * cluster_size);
+                        }
+
+                        _summary->build_range(first_high, last_high + 1);
+                    }
+
+                    /**
+                     * an empty set becomes the count indices in increasing order, each node visited once,
+                     * the indices are overwritten: by their low bits for a cluster,
+                     * then by the high bits of the clusters for the summary
+                     */
+                    void build(uint32_t* indices, size_t count) {
+                        if (count == 0) {
+                            return;
+                        }
+
+                        if (is_leaf()) {
+                            for (size_t i = 0; i < count; ++i) {
+                                _leaf |= uint64_t{1} << indices[i];
+                            }
+
+                            return;
+                        }
+
+                        _min = indices[0];
+                        _max = indices[count - 1];
+
+                        // the minimum stays out of the clusters
+                        uint32_t* rest = indices + 1;
+                        size_t clusters = 0;
+
+                        for (size_t first = 0, last = 0; first < count - 1; first = last) {
+                            uint32_t high = get_high(rest[first]);
+
+                            for (last = first; last < count - 1 && get_high(rest[last]) == high; ++last) {
+                                rest[last] = get_low(rest[last]);
+                            }
+
+                            _clusters[high].build(rest + first, last - first);
+
+                            // the cluster's indices are consumed, its high bits take their first place
+                            rest[clusters++] = high;
+                        }
+
+                        _summary->build(rest, clusters);
+                    }
+
+                private:
+                    uint8_t _bits;
+                    uint32_t _min = none;
+                    uint32_t _max = none;
+                    uint64_t _leaf = 0;
+                    std::unique_ptr<node> _summary;
+                    std::vector<node> _clusters;
+
+                private:
+                    bool is_leaf() const {
+                        return _bits <= 6;
+                    }
+
+                    // the upper square root of the universe is the number of clusters
+                    uint8_t get_high_bits() const {
+                        return _bits - _bits / 2;
+                    }
+
+                    uint8_t get_low_bits() const {
+                        return _bits / 2;
+                    }
+
+                    uint32_t get_high(uint32_t x) const {
+                        return x >> get_low_bits();
+                    }
+
+                    uint32_t get_low(uint32_t x) const {
+                        return x & ((uint32_t{1} << get_low_bits()) - 1);
+                    }
+
+                    uint32_t get_index(uint32_t high, uint32_t low) const {
+                        return (high << get_low_bits()) | low;
+                    }
+            };
+
+            uint32_t _size;
+            std::vector<uint64_t> _free;
+            node _words;
+            kusage _usage;
+
+        private:
+            static size_t get_word_count(uint32_t size) {
+                return (uint64_t{size} + 63) / 64;
+            }
+
+            // bits of the smallest power of two universe of count word indices
+            static uint8_t get_universe_bits(size_t count) {
+                uint8_t bits = 0;
+
+                while ((uint64_t{1} << bits) < count) {
+                    ++bits;
+                }
+
+                return bits;
+            }
+    };
+}
+
+#endif // KVEB_H
@@ -2,13 +2,19 @@
 #define KVECTOR_H
 
 #include <vector>
+#include <algorithm>
 #include <cstdint>
 
+#include "kscan.h"
+#include "kcommon.h"
+
 namespace kupid {
     /**
-     * std::vector
+     * a flat bitmap in a std::vector of 64-bit words
      * see:
      *      https://en.cppreference.com/w/cpp/container/vector
+     *
+     * next() scans the words with kscan, the bits past the last ID stay off
      */
 
     class kvector {
@@ -16,27 +22,51 @@ namespace kupid {
             kvector(uint32_t size)
                 : _size{size}
             {
-                _data.reserve(size);
+                _data.resize((uint64_t{size} + 63) / 64);
+            }
+
+            // all IDs used or free
+            kvector(uint32_t size, kpreset preset)
+                : kvector{size}
+            {
+                if (preset == kpreset::all_used) {
+                    std::fill(_data.begin(), _data.end(), ~uint64_t{0});
+
+                    if (size % 64 != 0) {
+                        _data.back() = (uint64_t{1} << (size % 64)) - 1;
+                    }
+
+                    _usage.set(size);
+                }
+            }
+
+            kvector(uint32_t size, ksorted_ids<uint32_t> used)
+                : kvector{size}
+            {
+                for (uint32_t id : used) {
+                    set_id_state(id, true);
+                }
             }
 
             kvector() = delete;
 
             int64_t next(bool is_using = true) {
-                for (uint32_t id = 0 ; id < _size; ++id) {
-                    if (_data[id] == false) {
-                        if (is_using) {
-                            use_id(id);
-                        }
-                        return id;
-                    }
+                int64_t id = kscan::find_first_zero(_data.data(), _size);
+
+                if (id >= 0 && is_using) {
+                    use_id(id);
                 }
 
-                return -1;
+                return id;
             }
 
             bool set_id_state(uint32_t id, bool state) {
                 if (id < _size) {
-                    _data[id] = state;
+                    uint64_t& data = _data[id >> 6];
+                    uint64_t bit = uint64_t{1} << (id & 63);
+                    _usage.update((data & bit) != 0, state);
+                    data = state ? data | bit : data & ~bit;
+
                     return true;
                 } else {
                     return false;
@@ -53,15 +83,34 @@ namespace kupid {
 
             bool is_using(uint32_t id) const {
                 if (id < _size) {
-                    return _data[id] == true;
+                    return (_data[id >> 6] & (uint64_t{1} << (id & 63))) != 0;
                 } else {
                     return false;
                 }
             }
 
             void clear() {
-                _data.clear();
-                _data.resize(_size);
+                std::fill(_data.begin(), _data.end(), 0);
+                _usage.set(0);
+            }
+
+            // the number of used IDs in O(1)
+            uint32_t used_count() const {
+                return _usage.used();
+            }
+
+            uint32_t free_count() const {
+                return _size - _usage.used();
+            }
+
+            // f(used) once the used IDs rise to used, nullptr removes the watermark
+            void set_high_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_high_watermark(used, std::move(f));
+            }
+
+            // f(used) once the used IDs fall to used, nullptr removes the watermark
+            void set_low_watermark(uint32_t used, kusage::callback f) {
+                _usage.set_low_watermark(used, std::move(f));
             }
 
             uint32_t size() const {
@@ -70,7 +119,8 @@ namespace kupid {
 
         private:
             uint32_t _size;
-            std::vector<bool> _data;
+            std::vector<uint64_t> _data;
+            kusage _usage;
     };
 }
 
@@ -5,6 +5,7 @@
 #include "../include/kvector.h"
 #include "../include/kset_inc.h"
 #include "../include/kset_dec.h"
+#include "../include/kveb.h"
 
 // g++ -std=c++14 -O3 main.cpp -o kupid
 
@@ -165,4 +166,29 @@ int main(int argc, char** argv) {
         id = id_factory.next();
         std::cout << "next() = " << id << '\n';
     }
+
+    std::cout << "\nkupid::kveb\n" << line_sep << '\n';
+    {
+        kupid::kveb id_factory{size};
+
+        std::cout << "++ size = " << size << " : all used\n";
+
+        for (uint32_t i = 0; i < size; ++i) {
+            id_factory.use_id(i);
+        }
+
+        std::cout << "++ last id is freed\n";
+        id_factory.free_id(last);
+
+        auto id = id_factory.next();
+        std::cout << "next() = " << id << '\n';
+        id = id_factory.next();
+        std::cout << "next() = " << id << '\n';
+
+        std::cout << "++ cleared\n";
+        id_factory.clear();
+
+        id = id_factory.next();
+        std::cout << "next() = " << id << '\n';
+    }
 }
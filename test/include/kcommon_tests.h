@@ -1,6 +1,7 @@
 #include "gtest/gtest.h"
 #include "../include/krandom.h"
 #include "../../src/include/kbset.h"
+#include "../../src/include/kcommon.h"
 
 template<typename T>
 class kcommon_tests {
@@ -378,6 +379,128 @@ class kcommon_tests {
             }
         }
 
+        void test_bulk() {
+            uint32_t size = 100000 + 37;
+
+            std::cout << "test " << _name << " bulk construction with size = " << size << '\n';
+
+            // presets
+            ASSERT_EQ((T{0, kupid::kpreset::all_used}.next()), -1);
+            ASSERT_EQ((T{0, kupid::kpreset::all_free}.next()), -1);
+            ASSERT_EQ((T{size, kupid::kpreset::all_free}.next(false)), 0);
+
+            T used_factory = T{size, kupid::kpreset::all_used};
+            ASSERT_EQ(used_factory.next(false), -1);
+            ASSERT_TRUE(used_factory.is_using(size - 1));
+            ASSERT_TRUE(used_factory.free_id(size - 1));
+            ASSERT_EQ(used_factory.next(), size - 1);
+
+            // sorted used IDs: a full prefix of whole words, random IDs, and IDs past the size
+            kupid::krandom_int rnd_factory{size, kupid::krandom_int::seed_token};
+            std::set<uint32_t> rnd_set{};
+
+            for (uint32_t i = 0; i < 64 * 70; ++i) {
+                rnd_set.insert(i);
+            }
+
+            for (uint32_t i = 0; i < size / 2; ++i) {
+                rnd_set.insert(rnd_factory.get_random());
+            }
+
+            rnd_set.insert(size);
+            rnd_set.insert(size + 100);
+
+            std::vector<uint32_t> used{rnd_set.begin(), rnd_set.end()};
+            T id_factory = T{size, used};
+            T id_factory_by_id = T{size};
+
+            for (uint32_t id : used) {
+                id_factory_by_id.use_id(id);
+            }
+
+            for (uint32_t id = 0; id < size; ++id) {
+                ASSERT_EQ(id_factory.is_using(id), id_factory_by_id.is_using(id));
+            }
+
+            // the first free IDs, next() of the sets is linear
+            for (int i = 0; i < 1000; ++i) {
+                ASSERT_EQ(id_factory.next(), id_factory_by_id.next());
+            }
+        }
+
+        void test_usage() {
+            uint32_t size = 1000 + 37;
+
+            std::cout << "test " << _name << " used and free counts with size = " << size << '\n';
+
+            T id_factory = T{size};
+            std::vector<uint64_t> highs{};
+            std::vector<uint64_t> lows{};
+
+            ASSERT_EQ(id_factory.used_count(), 0);
+            ASSERT_EQ(id_factory.free_count(), size);
+
+            id_factory.set_high_watermark(100, [&highs](uint64_t used) { highs.push_back(used); });
+            id_factory.set_low_watermark(10, [&lows](uint64_t used) { lows.push_back(used); });
+
+            for (int i = 0; i < 100; ++i) {
+                id_factory.next();
+            }
+
+            ASSERT_EQ(id_factory.used_count(), 100);
+            ASSERT_EQ(id_factory.free_count(), size - 100);
+            ASSERT_EQ(highs, std::vector<uint64_t>{100});
+
+            // an ID used or freed twice is counted once, the sets return false
+            id_factory.use_id(50);
+            id_factory.free_id(500);
+            ASSERT_FALSE(id_factory.use_id(size));
+            ASSERT_EQ(id_factory.used_count(), 100);
+
+            // the count rises to the high watermark again
+            ASSERT_TRUE(id_factory.free_id(99));
+            ASSERT_TRUE(id_factory.use_id(99));
+            ASSERT_EQ(highs, (std::vector<uint64_t>{100, 100}));
+
+            for (uint32_t id = 0; id < 90; ++id) {
+                ASSERT_TRUE(id_factory.free_id(id));
+            }
+
+            ASSERT_EQ(id_factory.used_count(), 10);
+            ASSERT_EQ(lows, std::vector<uint64_t>{10});
+
+            // a bulk change fires only when it crosses a watermark
+            id_factory.clear();
+            ASSERT_EQ(id_factory.used_count(), 0);
+            ASSERT_EQ(lows, std::vector<uint64_t>{10});
+
+            // without a callback the watermark is removed
+            id_factory.set_high_watermark(5, nullptr);
+
+            for (int i = 0; i < 20; ++i) {
+                id_factory.next();
+            }
+
+            ASSERT_EQ(id_factory.used_count(), 20);
+            ASSERT_EQ(highs.size(), 2);
+
+            id_factory.clear();
+            ASSERT_EQ(lows, (std::vector<uint64_t>{10, 0}));
+
+            // a free of a free ID at a count of 0 neither wraps nor fires
+            id_factory.free_id(3);
+            ASSERT_EQ(id_factory.used_count(), 0);
+            ASSERT_EQ(lows.size(), 2);
+
+            // the counts of the bulk constructors
+            std::vector<uint32_t> used{0, 1, 2, 5, 64, 65, size - 1, size, size + 100};
+
+            ASSERT_EQ((T{size, kupid::kpreset::all_used}.used_count()), size);
+            ASSERT_EQ((T{size, kupid::kpreset::all_used}.free_count()), 0);
+            ASSERT_EQ((T{size, kupid::kpreset::all_free}.used_count()), 0);
+            ASSERT_EQ((T{size, used}.used_count()), 7);
+        }
+
     private:
         std::string _name;
 };
@@ -370,3 +370,57 @@ TEST(TestKBSet, RandomOrdered) {
         ASSERT_NE(it, rnd_set.end());
     }
 }
+
+TEST(TestKBSet, Bulk) {
+    constexpr uint32_t size = 1000;
+
+    std::cout << "test kupid::kbset bulk construction with size = " << size << '\n';
+
+    kupid::kbset<size> used_factory{kupid::kpreset::all_used};
+
+    ASSERT_EQ(used_factory.next(false), -1);
+    ASSERT_TRUE(used_factory.free_id(size - 1));
+    ASSERT_EQ(used_factory.next(), size - 1);
+
+    std::vector<uint32_t> used{0, 1, 2, 5, 64, 65, 999, 1000};
+    kupid::kbset<size> id_factory{used};
+
+    ASSERT_TRUE(id_factory.is_using(65));
+    ASSERT_FALSE(id_factory.is_using(66));
+    ASSERT_EQ(id_factory.next(), 3);
+    ASSERT_EQ(id_factory.next(), 4);
+    ASSERT_EQ(id_factory.next(), 6);
+}
+
+TEST(TestKBSet, Usage) {
+    constexpr uint32_t size = 1000;
+
+    std::cout << "test kupid::kbset used and free counts with size = " << size << '\n';
+
+    kupid::kbset<size> id_factory{};
+    std::vector<uint64_t> highs{};
+    std::vector<uint64_t> lows{};
+
+    id_factory.set_high_watermark(100, [&highs](uint64_t used) { highs.push_back(used); });
+    id_factory.set_low_watermark(0, [&lows](uint64_t used) { lows.push_back(used); });
+
+    for (int i = 0; i < 100; ++i) {
+        id_factory.next();
+    }
+
+    // an ID used or freed twice is counted once
+    ASSERT_TRUE(id_factory.use_id(50));
+    ASSERT_TRUE(id_factory.free_id(500));
+    ASSERT_EQ(id_factory.used_count(), 100U);
+    ASSERT_EQ(id_factory.free_count(), size - 100);
+    ASSERT_EQ(highs, std::vector<uint64_t>{100});
+
+    id_factory.clear();
+    ASSERT_EQ(id_factory.used_count(), 0U);
+    ASSERT_EQ(lows, std::vector<uint64_t>{0});
+
+    std::vector<uint32_t> used{0, 1, 2, 5, 64, 65, 999, 1000};
+
+    ASSERT_EQ((kupid::kbset<size>{used}.used_count()), 7U);
+    ASSERT_EQ((kupid::kbset<size>{kupid::kpreset::all_used}.free_count()), 0U);
+}
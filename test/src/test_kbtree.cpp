@@ -1,5 +1,9 @@
 #include "gtest/gtest.h"
 #include <bitset>
+#include <stdexcept>
+#include <system_error>
+#include <fstream>
+#include <cstdio>
 #include "../include/kcommon_tests.h"
 #include "../../src/include/kbtree.h"
 
@@ -221,6 +225,1098 @@ TEST(TestKBTree, BTreeDataByIndex) {
     ASSERT_EQ(last_1, last_2);
 }
 
+TEST(TestKBTree, BTreeNextN) {
+    uint32_t size = 1000;
+
+    std::cout << "test kupid::kbtree with size = " << size << '\n';
+
+    kupid::kbtree id_factory{size};
+    std::vector<uint32_t> ids(size + 10);
+
+    id_factory.use_id(1);
+    id_factory.use_id(64);
+    id_factory.use_id(130);
+
+    // ascending, the used IDs are skipped
+    auto n = id_factory.next_n(200, ids.data());
+    std::cout << "next_n(200) = " << n << '\n';
+    ASSERT_EQ(n, 200);
+
+    uint32_t expected = 0;
+
+    for (size_t i = 0; i < n; ++i, ++expected) {
+        while (expected == 1 || expected == 64 || expected == 130) {
+            ++expected;
+        }
+
+        ASSERT_EQ(ids[i], expected);
+        ASSERT_TRUE(id_factory.is_using(ids[i]));
+    }
+
+    ASSERT_EQ(id_factory.next(false), expected);
+
+    // more than available: the partial last word stops at the size
+    n = id_factory.next_n(ids.size(), ids.data());
+    std::cout << "next_n(" << ids.size() << ") = " << n << '\n';
+    ASSERT_EQ(n, size - 203);
+    ASSERT_EQ(ids[n - 1], size - 1);
+    ASSERT_EQ(id_factory.next(), -1);
+    ASSERT_EQ(id_factory.next_n(1, ids.data()), 0);
+
+    // the summaries were kept in sync
+    id_factory.free_id(500);
+    id_factory.free_id(999);
+    ASSERT_EQ(id_factory.next_n(ids.size(), ids.data()), 2);
+    ASSERT_EQ(ids[0], 500);
+    ASSERT_EQ(ids[1], 999);
+}
+
+TEST(TestKBTree, BTreeNextNSummaries) {
+    uint32_t size = 64 * 64 * 64 + 100;
+
+    std::cout << "test kupid::kbtree with size = " << size << '\n';
+
+    kupid::kbtree id_factory{size};
+    std::vector<uint32_t> ids(size);
+
+    ASSERT_EQ(id_factory.next_n(0, ids.data()), 0);
+    ASSERT_EQ(id_factory.next(false), 0);
+
+    for (uint32_t i = 0; i < size; i += 4097) {
+        id_factory.next_n(4097, ids.data() + i);
+    }
+
+    ASSERT_EQ(id_factory.next(), -1);
+
+    for (uint32_t i = 0; i < size; ++i) {
+        ASSERT_EQ(ids[i], i);
+    }
+
+    id_factory.free_id(64 * 64 * 3 + 7);
+    ASSERT_EQ(id_factory.next(), 64 * 64 * 3 + 7);
+}
+
+TEST(TestKBTree, BTreeNextRange) {
+    uint32_t size = 1000;
+
+    std::cout << "test kupid::kbtree with size = " << size << '\n';
+
+    kupid::kbtree id_factory{size};
+
+    ASSERT_EQ(id_factory.next_range(0), -1);
+    ASSERT_EQ(id_factory.next_range(size + 1), -1);
+
+    ASSERT_EQ(id_factory.next_range(10), 0);
+    ASSERT_EQ(id_factory.next(false), 10);
+
+    // a run which spans a word boundary
+    id_factory.use_id(70);
+    ASSERT_EQ(id_factory.next_range(60, false), 10);
+    ASSERT_EQ(id_factory.next_range(61), 71);
+
+    for (uint32_t i = 71; i < 132; ++i) {
+        ASSERT_TRUE(id_factory.is_using(i));
+    }
+
+    ASSERT_FALSE(id_factory.is_using(132));
+    ASSERT_EQ(id_factory.next(false), 10);
+
+    // the rest up to the size
+    ASSERT_EQ(id_factory.next_range(size - 132), 132);
+    ASSERT_EQ(id_factory.next_range(61), -1);
+    ASSERT_EQ(id_factory.next_range(60), 10);
+    ASSERT_EQ(id_factory.next(), -1);
+
+    ASSERT_TRUE(id_factory.free_range(200, 300));
+    ASSERT_FALSE(id_factory.free_range(900, 101));
+    ASSERT_TRUE(id_factory.free_range(0, 0));
+    ASSERT_TRUE(id_factory.free_range(size, 0));
+    ASSERT_TRUE(id_factory.is_using(0));
+    ASSERT_FALSE(id_factory.is_using(200));
+    ASSERT_FALSE(id_factory.is_using(499));
+    ASSERT_TRUE(id_factory.is_using(500));
+    ASSERT_EQ(id_factory.next(), 200);
+    ASSERT_EQ(id_factory.next_range(299), 201);
+    ASSERT_EQ(id_factory.next(), -1);
+}
+
+TEST(TestKBTree, BTreeNextRangeBlocks) {
+    uint32_t size = 64 * 4096;
+
+    std::cout << "test kupid::kbtree with size = " << size << '\n';
+
+    kupid::kbtree id_factory{size};
+
+    // runs of 99 free IDs everywhere but at the end of the 3rd block and the start of the 4th
+    for (uint32_t i = 0; i < size; i += 100) {
+        if (i < 3 * 4096 - 3000 || i > 3 * 4096 + 3000) {
+            id_factory.use_id(i);
+        }
+    }
+
+    // free: [9201, 15300)
+    ASSERT_EQ(id_factory.next_range(99, false), 1);
+    ASSERT_EQ(id_factory.next_range(100, false), 9201);
+    ASSERT_EQ(id_factory.next_range(6099, false), 9201);
+    ASSERT_EQ(id_factory.next_range(6100, false), -1);
+
+    // the summary of a modified block is recomputed: [9201, 12238) and [12239, 15300)
+    id_factory.use_id(3 * 4096 - 50);
+    ASSERT_EQ(id_factory.next_range(3037, false), 9201);
+    ASSERT_EQ(id_factory.next_range(3038, false), 12239);
+    ASSERT_EQ(id_factory.next_range(3062, false), -1);
+
+    // a whole free block joins the runs on both sides
+    id_factory.clear();
+    id_factory.use_id(4095);
+    id_factory.use_id(3 * 4096);
+    ASSERT_EQ(id_factory.next_range(8192), 4096);
+    ASSERT_EQ(id_factory.next_range(4096), 3 * 4096 + 1);
+    ASSERT_EQ(id_factory.next(), 0);
+
+    ASSERT_TRUE(id_factory.free_range(0, size));
+    ASSERT_EQ(id_factory.next_range(size), 0);
+    ASSERT_EQ(id_factory.next(), -1);
+}
+
+TEST(TestKBTree, BTreeNextRangeRandom) {
+    uint32_t size = 16 * 4096 + 77;
+    kupid::kbtree id_factory{size};
+    kupid::krandom_int rnd_factory{size};
+
+    std::cout << "test kupid::kbtree with size = " << size << '\n';
+
+    // first run of len free IDs, bit by bit
+    auto naive_range = [&id_factory, size](uint32_t len) -> int64_t {
+        uint32_t run = 0;
+
+        for (uint32_t id = 0; id < size; ++id) {
+            run = id_factory.is_using(id) ? 0 : run + 1;
+
+            if (run == len) {
+                return id + 1 - len;
+            }
+        }
+
+        return -1;
+    };
+
+    for (uint32_t round = 0; round < 8; ++round) {
+        id_factory.clear();
+
+        // fewer used IDs in every round: longer runs
+        for (uint32_t i = 0; i < (size >> round); ++i) {
+            id_factory.use_id(rnd_factory.get_random());
+        }
+
+        for (uint32_t len : {1U, 2U, 7U, 63U, 64U, 65U, 200U, 1000U, 5000U, 40000U}) {
+            ASSERT_EQ(id_factory.next_range(len, false), naive_range(len));
+        }
+    }
+}
+
+TEST(TestKBTree, BTreeNextRangeDeep) {
+    uint32_t size = 8 * 64 * 64 * 64 + 77;
+    kupid::kbtree id_factory{size};
+    kupid::krandom_int rnd_factory{size};
+
+    std::cout << "test kupid::kbtree with size = " << size << '\n';
+
+    // 4 layers: the words of the third layer keep the free runs of their subtrees
+    ASSERT_EQ(id_factory.depth(), 4);
+
+    auto naive_range = [&id_factory](uint32_t len) -> int64_t {
+        uint32_t run = 0;
+
+        for (uint32_t id = 0; id < id_factory.size(); ++id) {
+            run = id_factory.is_using(id) ? 0 : run + 1;
+
+            if (run == len) {
+                return id + 1 - len;
+            }
+        }
+
+        return -1;
+    };
+
+    ASSERT_TRUE(id_factory.use_range(0, size));
+    ASSERT_EQ(id_factory.next_range(1, false), -1);
+
+    for (uint32_t round = 0; round < 6; ++round) {
+        // longer holes in every round, some across the subtrees of the third layer
+        for (uint32_t i = 0; i < 20; ++i) {
+            uint32_t first = rnd_factory.get_random();
+            uint32_t len = std::min(rnd_factory.get_random() % (1000U << round) + 1, size - first);
+            ASSERT_TRUE(id_factory.free_range(first, len));
+        }
+
+        for (uint32_t len : {1U, 64U, 1000U, 5000U, 40000U, 300000U}) {
+            ASSERT_EQ(id_factory.next_range(len, false), naive_range(len));
+        }
+
+        // a claimed run modifies the summaries above it
+        int64_t first = naive_range(500);
+
+        if (first >= 0) {
+            ASSERT_EQ(id_factory.next_range(500), first);
+            ASSERT_EQ(id_factory.next_range(500, false), naive_range(500));
+        }
+    }
+
+    // the free IDs of a resized tree join the run at its end
+    ASSERT_TRUE(id_factory.resize(size + 5000));
+    ASSERT_EQ(id_factory.next_range(6000, false), naive_range(6000));
+    ASSERT_TRUE(id_factory.resize(size));
+    ASSERT_EQ(id_factory.next_range(6000, false), naive_range(6000));
+
+    id_factory.clear();
+    ASSERT_EQ(id_factory.next_range(size), 0);
+    ASSERT_EQ(id_factory.next_range(1, false), -1);
+}
+
+TEST(TestKBTree, BTreeUseFreeRange) {
+    uint32_t size = 64 * 64 * 64 + 100;
+    kupid::kbtree id_factory{size};
+    kupid::kbtree id_factory_by_id{size};
+    kupid::krandom_int rnd_factory{size, kupid::krandom_int::seed_token};
+
+    std::cout << "test kupid::kbtree ranges with size = " << size << '\n';
+
+    ASSERT_TRUE(id_factory.use_range(size, 0));
+    ASSERT_FALSE(id_factory.use_range(size - 10, 11));
+    ASSERT_FALSE(id_factory.free_range(1, size));
+
+    // whole upper words become full and free again
+    ASSERT_TRUE(id_factory.use_range(0, size));
+    ASSERT_EQ(id_factory.next(false), -1);
+    ASSERT_TRUE(id_factory.free_range(64 * 64 * 10, 64 * 64));
+    ASSERT_EQ(id_factory.next(false), 64 * 64 * 10);
+    ASSERT_TRUE(id_factory.use_range(64 * 64 * 10, 64 * 64));
+    ASSERT_EQ(id_factory.next(false), -1);
+
+    // random ranges against one ID at a time
+    for (int round = 0; round < 20; ++round) {
+        id_factory.clear();
+        id_factory_by_id.clear();
+
+        for (int i = 0; i < 50; ++i) {
+            uint32_t first = rnd_factory.get_random();
+            uint32_t len = std::min(rnd_factory.get_random() % (round * 1000 + 100), size - first);
+            bool state = i % 3 != 2;
+
+            if (state) {
+                ASSERT_TRUE(id_factory.use_range(first, len));
+            } else {
+                ASSERT_TRUE(id_factory.free_range(first, len));
+            }
+
+            for (uint32_t id = first; id < first + len; ++id) {
+                state ? id_factory_by_id.use_id(id) : id_factory_by_id.free_id(id);
+            }
+        }
+
+        for (uint32_t len : {1U, 100U, 1000U}) {
+            ASSERT_EQ(id_factory.next_range(len, false), id_factory_by_id.next_range(len, false));
+        }
+
+        int64_t id;
+        while ((id = id_factory_by_id.next()) >= 0) {
+            ASSERT_EQ(id_factory.next(), id);
+        }
+
+        ASSERT_EQ(id_factory.next(), -1);
+    }
+}
+
+static void assert_iteration(const kupid::kbtree& id_factory) {
+    std::vector<uint32_t> used;
+    std::vector<uint32_t> free;
+
+    for (uint32_t id = 0; id < id_factory.size(); ++id) {
+        (id_factory.is_using(id) ? used : free).push_back(id);
+    }
+
+    std::vector<uint32_t> ids;
+    id_factory.for_each_used([&ids](uint32_t id) { ids.push_back(id); });
+    ASSERT_EQ(ids, used);
+
+    ids.clear();
+    id_factory.for_each_free([&ids](uint32_t id) { ids.push_back(id); });
+    ASSERT_EQ(ids, free);
+
+    ids.clear();
+    for (auto id : id_factory.used_ids()) {
+        ids.push_back(id);
+    }
+    ASSERT_EQ(ids, used);
+
+    ids.assign(id_factory.free_ids().begin(), id_factory.free_ids().end());
+    ASSERT_EQ(ids, free);
+
+    ids.assign(used.size() + 1, 0);
+    ASSERT_EQ(id_factory.export_used(ids.data(), ids.size()), used.size());
+    ids.pop_back();
+    ASSERT_EQ(ids, used);
+
+    // a short buffer takes the lowest IDs
+    if (used.size() > 2) {
+        ASSERT_EQ(id_factory.export_used(ids.data(), 2), 2);
+        ASSERT_EQ(ids[1], used[1]);
+    }
+}
+
+TEST(TestKBTree, BTreeIterate) {
+    uint32_t size = 64 * 64 * 64 + 100;
+    kupid::kbtree id_factory{size};
+    kupid::krandom_int rnd_factory{size, kupid::krandom_int::seed_token};
+
+    std::cout << "test kupid::kbtree iteration with size = " << size << '\n';
+
+    assert_iteration(id_factory);
+    ASSERT_EQ(id_factory.find_used(0), -1);
+
+    // sparse, the last ID, ranges, then dense with freed IDs
+    for (int i = 0; i < 100; ++i) {
+        id_factory.use_id(rnd_factory.get_random());
+    }
+
+    id_factory.use_id(size - 1);
+    assert_iteration(id_factory);
+
+    ASSERT_TRUE(id_factory.use_range(64 * 64 * 5 + 3, 64 * 64 * 3));
+    ASSERT_TRUE(id_factory.free_range(64 * 64 * 6, 64 * 10 + 1));
+    assert_iteration(id_factory);
+
+    std::vector<uint32_t> ids(size / 2);
+    id_factory.next_n(ids.size(), ids.data());
+
+    for (int i = 0; i < 1000; ++i) {
+        id_factory.free_id(rnd_factory.get_random());
+    }
+
+    assert_iteration(id_factory);
+
+    // all used: no free ID, though the last data word is partial
+    ASSERT_TRUE(id_factory.use_range(0, size));
+    assert_iteration(id_factory);
+    ASSERT_EQ(id_factory.find_free(0), -1);
+
+    ASSERT_TRUE(id_factory.free_range(0, size));
+    ASSERT_TRUE(id_factory.use_id(100));
+    ASSERT_EQ(id_factory.find_used(0), 100);
+    ASSERT_EQ(id_factory.find_used(101), -1);
+    ASSERT_EQ(id_factory.find_free(100), 101);
+
+    for (uint32_t small_size : {0U, 1U, 63U, 64U, 65U, 4096U, 4097U}) {
+        kupid::kbtree small{small_size};
+        assert_iteration(small);
+
+        small.use_range(0, small_size);
+        assert_iteration(small);
+
+        small.free_id(small_size / 2);
+        assert_iteration(small);
+    }
+
+    kupid::kbtree64 id_factory64{100000};
+    ASSERT_TRUE(id_factory64.use_range(70000, 20000));
+
+    uint64_t count = 0;
+    id_factory64.for_each_used([&count](uint64_t) { ++count; });
+    ASSERT_EQ(count, 20000);
+    ASSERT_EQ(*id_factory64.used_ids().begin(), 70000);
+    ASSERT_EQ(id_factory64.find_free(70000), 90000);
+}
+
+// rank and select of every ID against a scan of is_using()
+template<typename T>
+static void assert_rank_select(T& id_factory) {
+    uint64_t used = 0;
+
+    for (uint64_t id = 0; id < id_factory.size(); ++id) {
+        ASSERT_EQ(id_factory.rank_used(id), used);
+        ASSERT_EQ(id_factory.rank_free(id), id - used);
+
+        if (id_factory.is_using(id)) {
+            ASSERT_EQ(id_factory.select_used(used), static_cast<int64_t>(id));
+            ++used;
+        } else {
+            ASSERT_EQ(id_factory.select_free(id - used), static_cast<int64_t>(id));
+        }
+    }
+
+    ASSERT_EQ(id_factory.rank_used(id_factory.size()), used);
+    ASSERT_EQ(id_factory.select_used(used), -1);
+    ASSERT_EQ(id_factory.select_free(id_factory.size() - used), -1);
+}
+
+TEST(TestKBTree, BTreeRankSelect) {
+    uint32_t size = 64 * 64 * 64 + 100;
+    kupid::kbtree id_factory{size};
+    kupid::krandom_int rnd_factory{size, kupid::krandom_int::seed_token};
+
+    std::cout << "test kupid::kbtree rank and select with size = " << size << '\n';
+
+    assert_rank_select(id_factory);
+
+    // the counts are recomputed once modified: sparse, ranges, dense, then freed IDs
+    for (int i = 0; i < 100; ++i) {
+        id_factory.use_id(rnd_factory.get_random());
+    }
+
+    assert_rank_select(id_factory);
+
+    ASSERT_TRUE(id_factory.use_range(64 * 64 * 5 + 3, 64 * 64 * 30));
+    ASSERT_TRUE(id_factory.free_range(64 * 64 * 6, 64 * 10 + 1));
+    assert_rank_select(id_factory);
+
+    std::vector<uint32_t> ids(size / 4);
+    id_factory.next_n(ids.size(), ids.data());
+    ASSERT_GE(id_factory.next_range(5000), 0);
+
+    for (int i = 0; i < 1000; ++i) {
+        id_factory.free_id(rnd_factory.get_random());
+    }
+
+    assert_rank_select(id_factory);
+
+    // a single change below clean counts
+    ASSERT_TRUE(id_factory.free_id(size - 1));
+    ASSERT_TRUE(id_factory.use_id(size - 1));
+    ASSERT_TRUE(id_factory.free_id(64 * 64 * 64 - 1));
+    ASSERT_EQ(id_factory.rank_used(size), id_factory.used_count());
+    assert_rank_select(id_factory);
+
+    id_factory.clear();
+    assert_rank_select(id_factory);
+
+    for (uint32_t small_size : {0U, 1U, 63U, 64U, 65U, 4096U, 4097U}) {
+        kupid::kbtree small{small_size};
+        assert_rank_select(small);
+
+        small.use_range(0, small_size);
+        assert_rank_select(small);
+
+        small.free_id(small_size / 2);
+        assert_rank_select(small);
+    }
+
+    kupid::kbtree64 id_factory64{300000};
+    ASSERT_TRUE(id_factory64.use_range(70000, 200000));
+    ASSERT_TRUE(id_factory64.free_id(100000));
+    assert_rank_select(id_factory64);
+}
+
+// next_from() and next_in_range() of a few hints against a scan of is_using()
+template<typename T>
+static void assert_next_from(T& id_factory) {
+    uint64_t size = id_factory.size();
+
+    for (uint64_t hint : {uint64_t{0}, uint64_t{1}, uint64_t{63}, uint64_t{64}, size / 3, size / 2, size - 1, size, size + 7}) {
+        int64_t expected = -1;
+
+        for (uint64_t i = 0; i < size && expected < 0; ++i) {
+            uint64_t id = (hint < size ? hint : 0) + i;
+            id = id < size ? id : id - size;
+
+            if (!id_factory.is_using(id)) {
+                expected = id;
+            }
+        }
+
+        ASSERT_EQ(id_factory.next_from(hint, false), expected);
+
+        for (uint64_t high : {hint, hint + 1, hint + 64, hint + 5000, size}) {
+            expected = -1;
+
+            for (uint64_t id = hint; id < std::min(high, size) && expected < 0; ++id) {
+                if (!id_factory.is_using(id)) {
+                    expected = id;
+                }
+            }
+
+            ASSERT_EQ(id_factory.next_in_range(hint, high, false), expected);
+        }
+    }
+}
+
+TEST(TestKBTree, BTreeNextFrom) {
+    uint32_t size = 64 * 64 * 64 + 100;
+    kupid::kbtree id_factory{size};
+
+    std::cout << "test kupid::kbtree next_from and next_in_range with size = " << size << '\n';
+
+    assert_next_from(id_factory);
+
+    ASSERT_TRUE(id_factory.use_range(0, 64 * 64 * 20));
+    ASSERT_TRUE(id_factory.use_range(size / 2, size - size / 2));
+    assert_next_from(id_factory);
+
+    // a hint past the last free ID wraps around to the lowest one
+    ASSERT_TRUE(id_factory.free_id(100));
+    ASSERT_EQ(id_factory.next_from(size - 1), 100);
+    ASSERT_TRUE(id_factory.is_using(100));
+    ASSERT_EQ(id_factory.next_from(size / 2), 64 * 64 * 20);
+    ASSERT_EQ(id_factory.next_from(size / 2, false), 64 * 64 * 20 + 1);
+
+    // a range of used IDs only
+    ASSERT_EQ(id_factory.next_in_range(10, 64 * 64 * 20), -1);
+    ASSERT_EQ(id_factory.next_in_range(10, 64 * 64 * 20 + 2), 64 * 64 * 20 + 1);
+    ASSERT_EQ(id_factory.next_in_range(5, 5), -1);
+    ASSERT_EQ(id_factory.next_in_range(7, 3), -1);
+
+    ASSERT_TRUE(id_factory.use_range(0, size));
+    assert_next_from(id_factory);
+    ASSERT_EQ(id_factory.next_from(12345), -1);
+
+    for (uint32_t small_size : {1U, 63U, 64U, 65U, 4096U, 4097U}) {
+        kupid::kbtree small{small_size};
+        assert_next_from(small);
+
+        small.use_range(0, small_size);
+        small.free_id(small_size / 2);
+        assert_next_from(small);
+    }
+
+    kupid::kbtree64 id_factory64{300000};
+    ASSERT_TRUE(id_factory64.use_range(70000, 200000));
+    ASSERT_TRUE(id_factory64.free_id(100000));
+    assert_next_from(id_factory64);
+    ASSERT_EQ(id_factory64.next_from(70000), 100000);
+}
+
+// a tree against a new tree of its size with the same used IDs
+template<typename T>
+static void assert_as_new(T& id_factory) {
+    T expected{id_factory.size()};
+    id_factory.for_each_used([&expected](uint64_t id) { expected.use_id(id); });
+
+    ASSERT_EQ(id_factory.used_count(), expected.used_count());
+    ASSERT_EQ(id_factory.free_count(), expected.free_count());
+    ASSERT_EQ(id_factory.next(false), expected.next(false));
+
+    for (uint64_t len : {1, 2, 63, 64, 65, 1000, 5000}) {
+        ASSERT_EQ(id_factory.next_range(len, false), expected.next_range(len, false));
+    }
+
+    uint64_t step = id_factory.size() / 97 + 1;
+
+    for (uint64_t id = 0; id <= id_factory.size(); id += step) {
+        ASSERT_EQ(id_factory.find_free(id), expected.find_free(id));
+        ASSERT_EQ(id_factory.find_used(id), expected.find_used(id));
+        ASSERT_EQ(id_factory.rank_used(id), expected.rank_used(id));
+        ASSERT_EQ(id_factory.select_free(id), expected.select_free(id));
+        ASSERT_EQ(id_factory.select_used(id), expected.select_used(id));
+    }
+
+    if (id_factory.free_count() > 0) {
+        ASSERT_EQ(id_factory.select_free(id_factory.free_count() - 1), expected.select_free(expected.free_count() - 1));
+    }
+
+    uint64_t last_free = 0;
+    id_factory.for_each_free([&last_free](uint64_t id) { last_free = id + 1; });
+    ASSERT_LE(last_free, id_factory.size());
+}
+
+TEST(TestKBTree, BTreeResize) {
+    uint32_t size = 1000;
+    kupid::kbtree id_factory{size};
+
+    std::cout << "test kupid::kbtree resize from size = " << size << '\n';
+
+    ASSERT_TRUE(id_factory.use_range(0, 900));
+    ASSERT_TRUE(id_factory.free_id(100));
+
+    // past the capacity: twice the capacity, at least the size
+    ASSERT_TRUE(id_factory.resize(5000));
+    ASSERT_EQ(id_factory.size(), 5000);
+    ASSERT_EQ(id_factory.capacity(), 5000);
+    assert_as_new(id_factory);
+
+    ASSERT_TRUE(id_factory.resize(6000));
+    ASSERT_EQ(id_factory.capacity(), 10000);
+    ASSERT_TRUE(id_factory.use_range(4000, 2000));
+    ASSERT_FALSE(id_factory.use_id(6000));
+    assert_as_new(id_factory);
+
+    // a shrink needs a free tail
+    ASSERT_FALSE(id_factory.resize(5999));
+    ASSERT_TRUE(id_factory.free_range(3000, 3000));
+    ASSERT_TRUE(id_factory.resize(3001));
+    ASSERT_EQ(id_factory.capacity(), 10000);
+    assert_as_new(id_factory);
+
+    // the IDs past the size are never handed out
+    ASSERT_TRUE(id_factory.use_range(101, 2899));
+    ASSERT_EQ(id_factory.next(), 100);
+    ASSERT_EQ(id_factory.next(), 3000);
+    ASSERT_EQ(id_factory.next(), -1);
+    ASSERT_EQ(id_factory.next_from(3000), -1);
+    ASSERT_TRUE(id_factory.free_id(3000));
+
+    std::vector<uint32_t> ids(10);
+    ASSERT_EQ(id_factory.next_n(ids.size(), ids.data()), 1);
+    ASSERT_EQ(ids[0], 3000);
+    ASSERT_EQ(id_factory.free_count(), 0);
+    assert_as_new(id_factory);
+
+    // and within the capacity again, the old tail is free
+    ASSERT_TRUE(id_factory.resize(9000));
+    ASSERT_EQ(id_factory.capacity(), 10000);
+    ASSERT_EQ(id_factory.next(), 3001);
+    assert_as_new(id_factory);
+
+    // a full tree grows by new upper layers over its old top word
+    kupid::kbtree full{64, kupid::kpreset::all_used};
+    ASSERT_EQ(full.depth(), 2);
+    ASSERT_TRUE(full.resize(64 * 64 * 64 + 100));
+    ASSERT_EQ(full.depth(), 4);
+    ASSERT_EQ(full.next(), 64);
+    assert_as_new(full);
+
+    ASSERT_TRUE(full.free_range(65, 64 * 64 * 64 + 35));
+    ASSERT_TRUE(full.resize(65));
+    ASSERT_FALSE(full.resize(0));
+    assert_as_new(full);
+
+    // the capacity doubles: a few copies for many resizes
+    kupid::kbtree growing{0};
+    size_t copies = 0;
+
+    for (uint32_t n = 1; n <= 100000; ++n) {
+        uint32_t capacity = growing.capacity();
+        ASSERT_TRUE(growing.resize(n));
+        ASSERT_EQ(growing.next(), n - 1);
+        copies += growing.capacity() != capacity;
+    }
+
+    ASSERT_LE(copies, 18);
+    ASSERT_EQ(growing.used_count(), 100000);
+    assert_as_new(growing);
+
+    kupid::kbtree64 id_factory64{70000};
+    ASSERT_TRUE(id_factory64.use_range(1000, 60000));
+    ASSERT_TRUE(id_factory64.resize(300000));
+    ASSERT_TRUE(id_factory64.use_range(200000, 100000));
+    assert_as_new(id_factory64);
+}
+
+TEST(TestKBTree, BTreeHighWater) {
+    uint32_t size = 64 * 64 * 64 + 100;
+    kupid::kbtree id_factory{size};
+
+    std::cout << "test kupid::kbtree high-water mark with size = " << size << '\n';
+
+    ASSERT_EQ(id_factory.high_water(), 0);
+    ASSERT_EQ(id_factory.find_free(5000), 5000);
+    ASSERT_EQ(id_factory.next_range(size), 0);
+    ASSERT_EQ(id_factory.high_water(), size);
+    id_factory.clear();
+    ASSERT_EQ(id_factory.high_water(), 0);
+
+    for (int i = 0; i < 1000; ++i) {
+        id_factory.next();
+    }
+
+    ASSERT_EQ(id_factory.high_water(), 1024);
+    ASSERT_TRUE(id_factory.use_id(200000));
+    ASSERT_EQ(id_factory.high_water(), 200000 / 64 * 64 + 64);
+    ASSERT_EQ(id_factory.next_range(199001), -1);
+    ASSERT_EQ(id_factory.next_range(199000), 1000);
+    ASSERT_EQ(id_factory.next_range(size - 200001), 200001);
+    ASSERT_EQ(id_factory.next(), -1);
+    assert_as_new(id_factory);
+
+    // the counts and the run summaries past the mark after a clear are of free IDs
+    ASSERT_TRUE(id_factory.free_range(1000, size - 1000));
+    ASSERT_EQ(id_factory.high_water(), size);
+    assert_as_new(id_factory);
+
+    id_factory.clear();
+    ASSERT_EQ(id_factory.high_water(), 0);
+    ASSERT_EQ(id_factory.used_count(), 0);
+    ASSERT_FALSE(id_factory.is_using(200000));
+    assert_as_new(id_factory);
+
+    ASSERT_TRUE(id_factory.use_range(10, 100));
+    ASSERT_TRUE(id_factory.use_id(250000));
+    ASSERT_EQ(id_factory.next_range(64 * 64 * 30), 110);
+    assert_as_new(id_factory);
+
+    // the counts past a low mark are computed by rank and select, kept by a clear, then modified
+    id_factory.clear();
+    ASSERT_TRUE(id_factory.use_range(0, 5000));
+    assert_as_new(id_factory);
+
+    id_factory.clear();
+    ASSERT_TRUE(id_factory.use_range(6000, 100000));
+    ASSERT_TRUE(id_factory.free_id(50000));
+    assert_as_new(id_factory);
+
+    // a sorted constructor and a round trip derive their upper layers up to the mark
+    std::vector<uint32_t> ids{3, 70, 4095, 4096, 100000};
+    kupid::kbtree sorted{size, kupid::ksorted_ids<uint32_t>{ids}};
+    ASSERT_EQ(sorted.high_water(), 100032);
+    assert_as_new(sorted);
+
+    kupid::kbtree copy{size};
+    std::vector<uint8_t> bytes = sorted.serialize();
+    ASSERT_TRUE(copy.deserialize(bytes.data(), bytes.size()));
+    ASSERT_EQ(copy.high_water(), 100032);
+    assert_as_new(copy);
+}
+
+TEST(TestKBTree, BTreeClearSparse) {
+    uint32_t size = (1 << 22) + 100;
+    kupid::kbtree id_factory{size};
+
+    std::cout << "test kupid::kbtree sparse clear with size = " << size << '\n';
+
+    // a full data word and a full block under full bits, the counts and run summaries computed
+    ASSERT_TRUE(id_factory.use_range(64 * 100, 64));
+    ASSERT_TRUE(id_factory.use_range(4096 * 10, 4096));
+    ASSERT_TRUE(id_factory.use_id(size - 1));
+    ASSERT_EQ(id_factory.rank_used(size), 64 + 4096 + 1);
+    ASSERT_EQ(id_factory.next_range(5000, false), 0);
+    ASSERT_EQ(id_factory.next_range(4096 * 11, false), 4096 * 11);
+
+    // words used then freed are free already
+    ASSERT_TRUE(id_factory.use_range(1000000, 3000));
+    ASSERT_TRUE(id_factory.free_range(1000000, 3000));
+    ASSERT_LT(uint64_t{id_factory.used_count()} * 8, id_factory.high_water());
+
+    id_factory.clear();
+    ASSERT_EQ(id_factory.high_water(), 0);
+    ASSERT_FALSE(id_factory.is_using(64 * 100));
+    ASSERT_FALSE(id_factory.is_using(4096 * 10 + 1));
+    ASSERT_FALSE(id_factory.is_using(size - 1));
+    ASSERT_EQ(id_factory.next_range(size, false), 0);
+    assert_as_new(id_factory);
+
+    // scattered IDs, one per data word
+    for (uint32_t id = 7; id < size; id += 64 * 37 + 1) {
+        ASSERT_TRUE(id_factory.use_id(id));
+    }
+
+    ASSERT_EQ(id_factory.select_used(100), 7 + 100 * (64 * 37 + 1));
+    assert_as_new(id_factory);
+
+    id_factory.clear();
+    ASSERT_EQ(id_factory.used_count(), 0);
+    ASSERT_EQ(id_factory.find_used(0), -1);
+    assert_as_new(id_factory);
+
+    // reused after a clear, the summaries of the cleared words recomputed
+    ASSERT_TRUE(id_factory.use_range(4096 * 10 + 5, 100));
+    ASSERT_TRUE(id_factory.use_id(size - 2));
+    ASSERT_EQ(id_factory.next_range(4096 * 10 + 5, false), 0);
+    ASSERT_EQ(id_factory.rank_used(size), 101);
+    assert_as_new(id_factory);
+
+    kupid::kbtree64 id_factory64{uint64_t{1} << 20};
+    ASSERT_TRUE(id_factory64.use_range(70000, 200));
+    ASSERT_TRUE(id_factory64.use_id(1000000));
+    ASSERT_EQ(id_factory64.rank_used(1000001), 201);
+    id_factory64.clear();
+    ASSERT_EQ(id_factory64.next_range(uint64_t{1} << 20, false), 0);
+    assert_as_new(id_factory64);
+}
+
+TEST(TestKBTree, BTreeResizeBuffer) {
+    uint32_t size = 10000;
+    std::vector<uint64_t> buffer(kupid::kbtree::get_arena_bytes(size) / 8 + 8);
+    void* aligned = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(buffer.data()) + 63) & ~uintptr_t{63});
+    kupid::kbtree id_factory{size, aligned, kupid::kbtree::get_arena_bytes(size)};
+
+    std::cout << "test kupid::kbtree resize of a user buffer with size = " << size << '\n';
+
+    // the capacity of a user buffer is fixed
+    ASSERT_FALSE(id_factory.resize(size + 1));
+    ASSERT_FALSE(id_factory.reserve(size + 1));
+    ASSERT_TRUE(id_factory.resize(100));
+    ASSERT_TRUE(id_factory.use_range(0, 100));
+    ASSERT_EQ(id_factory.next(), -1);
+    ASSERT_TRUE(id_factory.resize(size));
+    ASSERT_EQ(id_factory.next(), 100);
+    assert_as_new(id_factory);
+}
+
+TEST(TestKBTree, BTreeUsageRange) {
+    uint32_t size = 100000;
+    kupid::kbtree id_factory{size};
+    std::vector<uint64_t> highs{};
+    std::vector<uint64_t> lows{};
+
+    std::cout << "test kupid::kbtree used count of ranges with size = " << size << '\n';
+
+    id_factory.set_high_watermark(50000, [&highs](uint64_t used) { highs.push_back(used); });
+    id_factory.set_low_watermark(1000, [&lows](uint64_t used) { lows.push_back(used); });
+
+    // ranges which overlap used IDs count only the IDs which change
+    ASSERT_TRUE(id_factory.use_range(100, 1000));
+    ASSERT_TRUE(id_factory.use_range(50, 100));
+    ASSERT_EQ(id_factory.used_count(), 1050);
+    ASSERT_TRUE(id_factory.free_range(1000, 500));
+    ASSERT_EQ(id_factory.used_count(), 950);
+    ASSERT_EQ(lows, std::vector<uint64_t>{950});
+
+    std::vector<uint32_t> out(60000);
+    ASSERT_EQ(id_factory.next_n(out.size(), out.data()), out.size());
+    ASSERT_EQ(id_factory.used_count(), 60950);
+    ASSERT_EQ(highs, std::vector<uint64_t>{60950});
+
+    ASSERT_EQ(id_factory.next_range(100), 60950);
+    ASSERT_EQ(id_factory.used_count(), 61050);
+    ASSERT_EQ(id_factory.free_count(), size - 61050);
+
+    // the all used preset, then a range back to the low watermark
+    kupid::kbtree used_factory{size, kupid::kpreset::all_used};
+    used_factory.set_low_watermark(1000, [&lows](uint64_t used) { lows.push_back(used); });
+
+    ASSERT_EQ(used_factory.free_count(), 0);
+    ASSERT_TRUE(used_factory.free_range(1000, size - 1000));
+    ASSERT_EQ(used_factory.used_count(), 1000);
+    ASSERT_EQ(lows, (std::vector<uint64_t>{950, 1000}));
+}
+
+TEST(TestKBTree, BTreeSerialize) {
+    uint32_t size = 65536 * 5 + 1000;
+    kupid::kbtree id_factory{size};
+    kupid::krandom_int rnd_factory{size, kupid::krandom_int::seed_token};
+
+    std::cout << "test kupid::kbtree serialization with size = " << size << '\n';
+
+    // one container of each type: full, array, runs, bitmap, none, and a full partial one
+    ASSERT_TRUE(id_factory.use_range(0, 65536));
+
+    for (int i = 0; i < 100; ++i) {
+        id_factory.use_id(65536 + rnd_factory.get_random() % 65536);
+    }
+
+    for (uint32_t first = 65536 * 2; first < 65536 * 3; first += 2000) {
+        ASSERT_TRUE(id_factory.use_range(first, 500));
+    }
+
+    for (uint32_t id = 65536 * 3; id < 65536 * 4; ++id) {
+        if (rnd_factory.get_random() % 2 == 0) {
+            id_factory.use_id(id);
+        }
+    }
+
+    ASSERT_TRUE(id_factory.use_range(65536 * 5, 1000));
+
+    std::vector<uint8_t> bytes = id_factory.serialize();
+
+    // header, 5 keys and types, array, runs and bitmap
+    ASSERT_LT(bytes.size(), 32 + 5 * 5 + (2 + 2 * 100) + (2 + 4 * 33) + 8192 + 64);
+
+    kupid::kbtree copy{size};
+    ASSERT_TRUE(copy.use_range(10, 100000));
+    ASSERT_TRUE(copy.deserialize(bytes.data(), bytes.size()));
+
+    for (uint32_t id = 0; id < size; ++id) {
+        ASSERT_EQ(copy.is_using(id), id_factory.is_using(id));
+    }
+
+    ASSERT_EQ(copy.next_range(1000, false), id_factory.next_range(1000, false));
+    ASSERT_EQ(copy.used_count(), id_factory.used_count());
+    ASSERT_EQ(copy.serialize(), bytes);
+
+    // truncated, another size or not serialized: rejected, the tree unchanged
+    copy.clear();
+    ASSERT_TRUE(copy.use_id(42));
+
+    for (size_t len : {size_t{0}, size_t{31}, size_t{32}, bytes.size() / 2, bytes.size() - 1}) {
+        ASSERT_FALSE(copy.deserialize(bytes.data(), len));
+    }
+
+    std::vector<uint8_t> garbage(bytes);
+    garbage[0] = 'X';
+    ASSERT_FALSE(copy.deserialize(garbage.data(), garbage.size()));
+
+    kupid::kbtree other{size + 1};
+    ASSERT_FALSE(other.deserialize(bytes.data(), bytes.size()));
+
+    ASSERT_TRUE(copy.is_using(42));
+    ASSERT_EQ(copy.next(false), 0);
+
+    // an empty tree is its header alone
+    copy.clear();
+    ASSERT_EQ(copy.serialize().size(), size_t{32});
+
+    kupid::kbtree64 id_factory64{100000};
+    ASSERT_TRUE(id_factory64.use_range(70000, 20000));
+    std::vector<uint8_t> bytes64 = id_factory64.serialize();
+
+    kupid::kbtree64 copy64{100000};
+    ASSERT_TRUE(copy64.deserialize(bytes64.data(), bytes64.size()));
+    ASSERT_FALSE(copy64.is_using(69999));
+    ASSERT_TRUE(copy64.is_using(89999));
+    ASSERT_FALSE(copy64.is_using(90000));
+    ASSERT_FALSE(copy.deserialize(bytes64.data(), bytes64.size()));
+}
+
+TEST(TestKBTree, BTreeArenaBuffer) {
+    uint32_t size = 100000;
+
+    std::cout << "test kupid::kbtree with size = " << size << " in a user buffer\n";
+
+    size_t bytes = kupid::kbtree::get_arena_bytes(size);
+
+    // 1563 data words + 25 + 1 upper words + 25 run summaries + 25 + 1 "any used" words
+    // + 25 + 1 used counts of 4 bytes, each part padded to 64 bytes
+    ASSERT_EQ(bytes, (1568 + 32 + 8 + 32 + 32 + 8 + 16 + 8) * 8);
+
+    std::vector<uint64_t> buffer(bytes / 8 + 8, ~uint64_t{0});
+    uint64_t* aligned = buffer.data();
+
+    while (reinterpret_cast<uintptr_t>(aligned) % 64 != 0) {
+        ++aligned;
+    }
+
+    {
+        kupid::kbtree id_factory{size, aligned, bytes};
+
+        ASSERT_EQ(id_factory.depth(), 3);
+        ASSERT_EQ(id_factory.next(), 0);
+        ASSERT_TRUE(id_factory.use_id(size - 1));
+
+        // moved, the arena stays where it is
+        kupid::kbtree moved{std::move(id_factory)};
+
+        ASSERT_EQ(moved.next(), 1);
+        ASSERT_TRUE(moved.is_using(size - 1));
+    }
+
+    // the buffer is not released, the last data word holds the last ID
+    ASSERT_EQ(aligned[32 + 8 + 1562], uint64_t{1} << ((size - 1) % 64));
+
+    ASSERT_THROW((kupid::kbtree{size, aligned, bytes - 8}), std::invalid_argument);
+    ASSERT_THROW((kupid::kbtree{size, aligned + 1, bytes}), std::invalid_argument);
+}
+
+TEST(TestKBTree, BTreeArenaHugePage) {
+    uint32_t size = 1 << 24;
+
+    std::cout << "test kupid::kbtree with size = " << size << " on huge pages\n";
+
+    kupid::kbtree id_factory{size, true};
+
+    for (uint32_t i = 0; i < 4096; ++i) {
+        ASSERT_EQ(id_factory.next(), i);
+    }
+
+    ASSERT_TRUE(id_factory.use_id(size - 1));
+
+    id_factory.clear();
+
+    ASSERT_FALSE(id_factory.is_using(size - 1));
+    ASSERT_EQ(id_factory.next(), 0);
+}
+
+TEST(TestKBTree, BTreeArenaFile) {
+    uint32_t size = 100000;
+    std::string path = testing::TempDir() + "kupid_kbtree_file.bin";
+
+    std::cout << "test kupid::kbtree with size = " << size << " in a file\n";
+
+    std::remove(path.c_str());
+
+    {
+        kupid::kbtree id_factory{size, path};
+
+        ASSERT_EQ(id_factory.next(), 0);
+        ASSERT_TRUE(id_factory.use_range(0, 5000));
+        ASSERT_TRUE(id_factory.use_id(size - 1));
+        ASSERT_TRUE(id_factory.free_id(4000));
+    }
+
+    // reopened after a clean close, the used count from the header
+    {
+        std::ifstream file{path, std::ios::binary};
+        uint64_t used = 0;
+        file.seekg(40);
+        file.read(reinterpret_cast<char*>(&used), sizeof(used));
+        ASSERT_EQ(used, 5000);
+    }
+
+    {
+        kupid::kbtree id_factory{size, path};
+
+        ASSERT_TRUE(id_factory.is_using(4999));
+        ASSERT_TRUE(id_factory.is_using(size - 1));
+        ASSERT_EQ(id_factory.used_count(), 5000);
+        ASSERT_EQ(id_factory.next(), 4000);
+        ASSERT_EQ(id_factory.next(), 5000);
+
+        // the size of a file is fixed
+        ASSERT_FALSE(id_factory.resize(size + 1));
+        ASSERT_FALSE(id_factory.resize(size - 1000));
+
+        // released by a move assignment without the used count: counted on the next open
+        id_factory = kupid::kbtree{size};
+    }
+
+    {
+        kupid::kbtree id_factory{size, path};
+
+        ASSERT_EQ(id_factory.used_count(), 5002);
+        ASSERT_EQ(id_factory.next(false), 5001);
+    }
+
+    // not closed: the mapping is leaked as after a crash, and the top layer is garbage
+    {
+        auto* id_factory = new kupid::kbtree{size, path};
+        ASSERT_TRUE(id_factory->use_range(5001, 64 * 100));
+        ASSERT_TRUE(id_factory->sync());
+
+        std::fstream file{path, std::ios::in | std::ios::out | std::ios::binary};
+        uint64_t all_used = ~uint64_t{0};
+        file.seekp(64);
+        file.write(reinterpret_cast<const char*>(&all_used), sizeof(all_used));
+    }
+
+    // the summaries are rebuilt from the data layer
+    {
+        kupid::kbtree id_factory{size, path};
+
+        ASSERT_EQ(id_factory.used_count(), 5002 + 64 * 100);
+        ASSERT_EQ(id_factory.next(), 5001 + 64 * 100);
+        ASSERT_EQ(id_factory.next_range(100), 5002 + 64 * 100);
+    }
+
+    // another size, another file
+    ASSERT_THROW((kupid::kbtree{size + 1, path}), std::runtime_error);
+
+    {
+        std::ofstream file{path, std::ios::in | std::ios::out | std::ios::binary};
+        file.write("NOTKUPID", 8);
+    }
+
+    ASSERT_THROW((kupid::kbtree{size, path}), std::runtime_error);
+    ASSERT_THROW((kupid::kbtree{size, "/nonexistent/kupid.bin"}), std::system_error);
+
+    std::remove(path.c_str());
+}
+
+#if __cplusplus >= 201703L  // C++17
+TEST(TestKBTree, BTreeArenaMemoryResource) {
+    uint32_t size = 10000;
+
+    std::cout << "test kupid::kbtree with size = " << size << " from a memory resource\n";
+
+    std::pmr::monotonic_buffer_resource resource;
+
+    kupid::kbtree id_factory{size, &resource};
+
+    for (uint32_t i = 0; i < size; ++i) {
+        ASSERT_EQ(id_factory.next(), i);
+    }
+
+    ASSERT_EQ(id_factory.next(), -1);
+}
+#endif
+
 // common tests
 
 kcommon_tests<kupid::kbtree> test_kbtree{"kupid::kbtree"};
@@ -266,3 +1362,23 @@ TEST(TestKBTree, RandomUnordered) {
 TEST(TestKBTree, RandomOrdered) {
     test_kbtree.test_random_ordered();
 }
+
+TEST(TestKBTree, Bulk) {
+    test_kbtree.test_bulk();
+}
+
+TEST(TestKBTree, Usage) {
+    test_kbtree.test_usage();
+
+    // a decrement at 0 stays at 0, a watermark without a callback is never checked
+    kupid::kusage usage{};
+    usage.set_low_watermark(UINT64_MAX, nullptr);
+    usage.dec();
+    ASSERT_EQ(usage.used(), 0);
+    usage.inc();
+    usage.update(true, true);
+    usage.update(false, false);
+    ASSERT_EQ(usage.used(), 1);
+    usage.update(true, false);
+    ASSERT_EQ(usage.used(), 0);
+}
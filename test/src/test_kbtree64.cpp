@@ -0,0 +1,124 @@
+#include "gtest/gtest.h"
+#include <fstream>
+#include <unistd.h>
+#include "../include/kcommon_tests.h"
+#include "../../src/include/kbtree.h"
+
+// resident memory of the process in bytes
+static uint64_t get_resident_bytes() {
+    std::ifstream statm{"/proc/self/statm"};
+    uint64_t total = 0;
+    uint64_t resident = 0;
+
+    statm >> total >> resident;
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+TEST(TestKBTree64, SizeHuge) {
+    uint64_t size = 1ULL << 40;
+
+    std::cout << "test kupid::kbtree64 with size = " << size << '\n';
+
+    uint64_t resident = get_resident_bytes();
+
+    kupid::kbtree64 id_factory{size};
+
+    // 2^40 = (2^6)^6 x (2^4)
+    ASSERT_EQ(id_factory.depth(), 7);
+    ASSERT_EQ(id_factory.size(), size);
+
+    for (int64_t i = 0; i < 1000; ++i) {
+        ASSERT_EQ(id_factory.next(), i);
+    }
+
+    uint64_t high = size - 1;
+
+    ASSERT_TRUE(id_factory.use_id(high));
+    ASSERT_TRUE(id_factory.is_using(high));
+    ASSERT_FALSE(id_factory.is_using(high - 1));
+    ASSERT_FALSE(id_factory.use_id(size));
+
+    ASSERT_TRUE(id_factory.free_id(500));
+    ASSERT_EQ(id_factory.next(), 500);
+    ASSERT_EQ(id_factory.next(), 1000);
+
+    // 128 GB of bits, only the touched pages are resident
+    if (resident > 0) {
+        ASSERT_LT(get_resident_bytes() - resident, 64ULL << 20);
+    }
+
+    id_factory.clear();
+    ASSERT_FALSE(id_factory.is_using(high));
+    ASSERT_EQ(id_factory.next(), 0);
+}
+
+TEST(TestKBTree64, AboveUInt32) {
+    uint64_t size = (1ULL << 32) + 100;
+
+    std::cout << "test kupid::kbtree64 with size = " << size << '\n';
+
+    kupid::kbtree64 id_factory{size};
+
+    uint64_t first = 1ULL << 32;
+
+    ASSERT_TRUE(id_factory.use_id(first + 99));
+    ASSERT_TRUE(id_factory.is_using(first + 99));
+    ASSERT_FALSE(id_factory.is_using(first + 98));
+    ASSERT_FALSE(id_factory.is_using(99));
+
+    std::vector<uint64_t> ids(100);
+
+    ASSERT_EQ(id_factory.next_n(ids.size(), ids.data()), ids.size());
+    ASSERT_EQ(ids.back(), 99);
+
+    ASSERT_TRUE(id_factory.free_id(first + 99));
+    ASSERT_FALSE(id_factory.is_using(first + 99));
+    ASSERT_FALSE(id_factory.free_id(size));
+}
+
+// common tests
+
+kcommon_tests<kupid::kbtree64> test_kbtree64{"kupid::kbtree64"};
+
+TEST(TestKBTree64, SizeZero) {
+    test_kbtree64.test_size_zero();
+}
+
+TEST(TestKBTree64, SizeOne) {
+    test_kbtree64.test_size_one();
+}
+
+TEST(TestKBTree64, SizeTwo) {
+    test_kbtree64.test_size_two();
+}
+
+TEST(TestKBTree64, ClearUseHalf) {
+    test_kbtree64.test_clear_use_half();
+}
+
+TEST(TestKBTree64, SizeSmall) {
+    test_kbtree64.test_size_small();
+}
+
+TEST(TestKBTree64, SizeMedium) {
+    test_kbtree64.test_size_medium();
+}
+
+TEST(TestKBTree64, SizeLarge) {
+    test_kbtree64.test_size_large();
+}
+
+#ifdef TEST_XLARGE
+TEST(TestKBTree64, SizeXLarge) {
+    test_kbtree64.test_size_xlarge();
+}
+#endif
+
+TEST(TestKBTree64, RandomUnordered) {
+    test_kbtree64.test_random_unordered();
+}
+
+TEST(TestKBTree64, RandomOrdered) {
+    test_kbtree64.test_random_ordered();
+}
@@ -0,0 +1,128 @@
+#include "gtest/gtest.h"
+#include <thread>
+#include <algorithm>
+#include "../include/kcommon_tests.h"
+#include "../../src/include/kbtree_atomic.h"
+
+TEST(TestKBTreeAtomic, HasFree) {
+    uint32_t size = 100;
+
+    std::cout << "test kupid::kbtree_atomic with size = " << size << '\n';
+
+    kupid::kbtree_atomic id_factory{size};
+
+    ASSERT_TRUE(id_factory.has_free());
+
+    for (uint32_t i = 0; i < size; ++i) {
+        id_factory.use_id(i);
+    }
+
+    ASSERT_FALSE(id_factory.has_free());
+
+    id_factory.free_id(size / 2);
+    ASSERT_TRUE(id_factory.has_free());
+
+    id_factory.clear();
+    ASSERT_TRUE(id_factory.has_free());
+}
+
+TEST(TestKBTreeAtomic, ThreadsUnique) {
+    uint32_t size = 64 * 1024;
+    uint32_t thread_size = 4;
+    uint32_t per_thread = size / thread_size;
+
+    std::cout << "test kupid::kbtree_atomic with size = " << size << " and " << thread_size << " threads\n";
+
+    kupid::kbtree_atomic id_factory{size};
+    std::vector<std::vector<int64_t>> ids(thread_size);
+    std::vector<std::thread> threads;
+
+    for (uint32_t t = 0; t < thread_size; ++t) {
+        threads.emplace_back([&id_factory, &ids, t, per_thread] {
+            for (uint32_t i = 0; i < per_thread; ++i) {
+                ids[t].push_back(id_factory.next());
+
+                // churn: give back every other ID and take it again
+                if (i % 2 == 0) {
+                    id_factory.free_id(ids[t].back());
+                    ids[t].back() = id_factory.next();
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<int64_t> all;
+
+    for (const auto& v : ids) {
+        all.insert(all.end(), v.begin(), v.end());
+    }
+
+    std::sort(all.begin(), all.end());
+
+    // every ID handed out exactly once
+    ASSERT_EQ(all.size(), size);
+
+    for (uint32_t i = 0; i < size; ++i) {
+        ASSERT_EQ(all[i], i);
+    }
+
+    ASSERT_FALSE(id_factory.has_free());
+    ASSERT_EQ(id_factory.next(), -1);
+
+    id_factory.free_id(size - 1);
+    ASSERT_EQ(id_factory.next(), size - 1);
+}
+
+// common tests
+
+kcommon_tests<kupid::kbtree_atomic> test_kbtree_atomic{"kupid::kbtree_atomic"};
+
+TEST(TestKBTreeAtomic, SizeZero) {
+    test_kbtree_atomic.test_size_zero();
+}
+
+TEST(TestKBTreeAtomic, SizeOne) {
+    test_kbtree_atomic.test_size_one();
+}
+
+TEST(TestKBTreeAtomic, SizeTwo) {
+    test_kbtree_atomic.test_size_two();
+}
+
+TEST(TestKBTreeAtomic, ClearUseHalf) {
+    test_kbtree_atomic.test_clear_use_half();
+}
+
+TEST(TestKBTreeAtomic, SizeSmall) {
+    test_kbtree_atomic.test_size_small();
+}
+
+TEST(TestKBTreeAtomic, SizeMedium) {
+    test_kbtree_atomic.test_size_medium();
+}
+
+TEST(TestKBTreeAtomic, SizeLarge) {
+    test_kbtree_atomic.test_size_large();
+}
+
+#ifdef TEST_XLARGE
+TEST(TestKBTreeAtomic, SizeXLarge) {
+    test_kbtree_atomic.test_size_xlarge();
+}
+#endif
+
+TEST(TestKBTreeAtomic, RandomUnordered) {
+    test_kbtree_atomic.test_random_unordered();
+}
+
+TEST(TestKBTreeAtomic, RandomOrdered) {
+    test_kbtree_atomic.test_random_ordered();
+}
+
+TEST(TestKBTreeAtomic, Bulk) {
+    test_kbtree_atomic.test_bulk();
+}
@@ -0,0 +1,178 @@
+#include "gtest/gtest.h"
+#include "../include/krandom.h"
+#include "../../src/include/kbtree.h"
+#include "../../src/include/kbtree_static.h"
+
+// 2^24 = (2^6)^4: 262144 + 4096 + 64 + 1 words, each layer padded to 8 words
+static_assert(kupid::kbtree_static<1 << 24>::depth_count == 4, "depth of 2^24");
+static_assert(kupid::kbtree_static<1 << 24>::word_count == 262144 + 4096 + 64 + 8, "words of 2^24");
+static_assert(kupid::kbtree_static<100000>::geometry.offsets[0] == 32 + 8, "offset of the data layer");
+static_assert(kupid::kbtree_static<64>::depth_count == 1, "a single word");
+
+// zero-initialized into .bss
+static kupid::kbtree_static<1 << 20> static_pool;
+
+#if __cplusplus > 201703L  // C++20
+constexpr int64_t get_constexpr_next() {
+    kupid::kbtree_static<5000> id_factory;
+
+    for (uint32_t i = 0; i < 5000; ++i) {
+        id_factory.use_id(i);
+    }
+
+    id_factory.free_id(4097);
+
+    return id_factory.next();
+}
+
+static_assert(get_constexpr_next() == 4097, "next() in a constant expression");
+#endif
+
+TEST(TestKBTreeStatic, SizeZero) {
+    std::cout << "test kupid::kbtree_static with size = 0\n";
+
+    kupid::kbtree_static<0> id_factory{};
+
+    ASSERT_EQ(id_factory.next(), -1);
+    ASSERT_FALSE(id_factory.use_id(0));
+}
+
+TEST(TestKBTreeStatic, SizeOne) {
+    std::cout << "test kupid::kbtree_static with size = 1\n";
+
+    kupid::kbtree_static<1> id_factory{};
+
+    ASSERT_EQ(id_factory.next(false), 0);
+    ASSERT_EQ(id_factory.next(), 0);
+    ASSERT_EQ(id_factory.next(), -1);
+
+    ASSERT_TRUE(id_factory.free_id(0));
+    ASSERT_EQ(id_factory.next(), 0);
+}
+
+TEST(TestKBTreeStatic, SizeUnaligned) {
+    constexpr uint32_t size = 4097;
+
+    std::cout << "test kupid::kbtree_static with size = " << size << '\n';
+
+    kupid::kbtree_static<size> id_factory{};
+
+    ASSERT_EQ(id_factory.depth(), 3);
+
+    for (uint32_t i = 0; i < size; ++i) {
+        ASSERT_EQ(id_factory.next(), i);
+    }
+
+    // the free padding bits past the last ID are never handed out
+    ASSERT_EQ(id_factory.next(), -1);
+
+    ASSERT_TRUE(id_factory.free_id(4096));
+    ASSERT_EQ(id_factory.next(), 4096);
+
+    id_factory.clear();
+    ASSERT_FALSE(id_factory.is_using(4096));
+    ASSERT_EQ(id_factory.next(), 0);
+}
+
+TEST(TestKBTreeStatic, StaticPool) {
+    std::cout << "test kupid::kbtree_static with size = " << static_pool.size() << " in static storage\n";
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        ASSERT_EQ(static_pool.next(), i);
+    }
+
+    ASSERT_TRUE(static_pool.use_id(static_pool.size() - 1));
+    ASSERT_FALSE(static_pool.use_id(static_pool.size()));
+
+    static_pool.clear();
+    ASSERT_EQ(static_pool.next(false), 0);
+}
+
+TEST(TestKBTreeStatic, RandomAsRuntime) {
+    constexpr uint32_t size = 100000;
+    int rnd_size = 10000;
+
+    std::cout << "test kupid::kbtree_static vs. kupid::kbtree with size = " << size << '\n';
+
+    auto id_factory = std::make_unique<kupid::kbtree_static<size>>();
+    kupid::kbtree runtime_factory{size};
+    kupid::krandom_int rnd_factory{size};
+
+    for (uint32_t i = 0; i < size; ++i) {
+        id_factory->use_id(i);
+        runtime_factory.use_id(i);
+    }
+
+    for (int i = 0; i < rnd_size; ++i) {
+        auto rnd_num = rnd_factory.get_random();
+
+        if (i % 3 == 0) {
+            ASSERT_EQ(id_factory->next(), runtime_factory.next());
+        } else {
+            id_factory->free_id(rnd_num);
+            runtime_factory.free_id(rnd_num);
+        }
+
+        ASSERT_EQ(id_factory->is_using(rnd_num), runtime_factory.is_using(rnd_num));
+    }
+}
+
+TEST(TestKBTreeStatic, Bulk) {
+    constexpr uint32_t size = 64 * 4096 + 5;
+
+    std::cout << "test kupid::kbtree_static bulk construction with size = " << size << '\n';
+
+    static kupid::kbtree_static<size> used_factory{kupid::kpreset::all_used};
+
+    ASSERT_EQ(used_factory.next(false), -1);
+    ASSERT_TRUE(used_factory.free_id(size - 1));
+    ASSERT_EQ(used_factory.next(), size - 1);
+
+    // every ID but each 1000th
+    std::vector<uint32_t> used;
+
+    for (uint32_t i = 0; i < size + 10; ++i) {
+        if (i % 1000 != 999) {
+            used.push_back(i);
+        }
+    }
+
+    static kupid::kbtree_static<size> id_factory{used};
+    kupid::kbtree runtime_factory{size, used};
+
+    int64_t id;
+    while ((id = runtime_factory.next()) >= 0) {
+        ASSERT_EQ(id_factory.next(), id);
+    }
+
+    ASSERT_EQ(id_factory.next(), -1);
+}
+
+TEST(TestKBTreeStatic, Usage) {
+    constexpr uint32_t size = 5000;
+
+    std::cout << "test kupid::kbtree_static used and free counts with size = " << size << '\n';
+
+    static kupid::kbtree_static<size> id_factory{};
+
+    ASSERT_EQ(id_factory.used_count(), 0U);
+
+    for (int i = 0; i < 100; ++i) {
+        id_factory.next();
+    }
+
+    // an ID used or freed twice is counted once
+    ASSERT_TRUE(id_factory.use_id(50));
+    ASSERT_TRUE(id_factory.free_id(500));
+    ASSERT_TRUE(id_factory.free_id(99));
+    ASSERT_EQ(id_factory.used_count(), 99U);
+    ASSERT_EQ(id_factory.free_count(), size - 99);
+
+    id_factory.clear();
+    ASSERT_EQ(id_factory.used_count(), 0U);
+
+    std::vector<uint32_t> used{0, 1, 2, 5, 64, 65, size - 1, size};
+
+    ASSERT_EQ((kupid::kbtree_static<size>{used}.used_count()), 7U);
+    ASSERT_EQ((kupid::kbtree_static<size>{kupid::kpreset::all_used}.free_count()), 0U);
+}
@@ -0,0 +1,126 @@
+#include "gtest/gtest.h"
+#include "../include/kcommon_tests.h"
+#include "../../src/include/kbtree.h"
+#include "../../src/include/kbtree_wide.h"
+
+TEST(TestKBTreeWide, Depth) {
+    std::cout << "test kupid::kbtree_wide depth\n";
+
+    ASSERT_EQ(kupid::kbtree_wide{512}.depth(), 1);
+    ASSERT_EQ(kupid::kbtree_wide{513}.depth(), 2);
+    ASSERT_EQ(kupid::kbtree_wide{1 << 20}.depth(), 3);
+    ASSERT_EQ(kupid::kbtree_wide{1 << 24}.depth(), 3);
+
+    // 2^20 IDs: 2048 + 4 + 1 nodes of 64 bytes
+    ASSERT_EQ(kupid::kbtree_wide::get_arena_bytes(1 << 20), (2048 + 4 + 1) * 64);
+}
+
+TEST(TestKBTreeWide, FullNodes) {
+    uint32_t size = 512 * 512 + 100;
+
+    std::cout << "test kupid::kbtree_wide with size = " << size << '\n';
+
+    kupid::kbtree_wide id_factory{size};
+
+    for (uint32_t i = 0; i < size; ++i) {
+        ASSERT_EQ(id_factory.next(), i);
+    }
+
+    ASSERT_EQ(id_factory.next(), -1);
+
+    // a node of the middle layer becomes free again
+    ASSERT_TRUE(id_factory.free_id(100000));
+    ASSERT_TRUE(id_factory.free_id(512 * 512 + 99));
+    ASSERT_EQ(id_factory.next(), 100000);
+    ASSERT_EQ(id_factory.next(), 512 * 512 + 99);
+    ASSERT_EQ(id_factory.next(), -1);
+}
+
+TEST(TestKBTreeWide, KernelsAsRuntime) {
+    uint32_t size = 300000;
+    int rnd_size = 20000;
+
+    std::cout << "test kupid::kbtree_wide kernels vs. kupid::kbtree with size = " << size << '\n';
+
+    for (auto k : {kupid::kscan::kernel::scalar, kupid::kscan::kernel::avx2, kupid::kscan::kernel::avx512}) {
+        kupid::kbtree_wide id_factory{size};
+
+        if (!id_factory.set_kernel(k)) {
+            std::cout << "kernel " << static_cast<int>(k) << " not supported\n";
+            continue;
+        }
+
+        kupid::kbtree runtime_factory{size};
+        kupid::krandom_int rnd_factory{size, kupid::krandom_int::seed_token};
+
+        for (uint32_t i = 0; i < size - 1000; ++i) {
+            id_factory.use_id(i);
+            runtime_factory.use_id(i);
+        }
+
+        for (int i = 0; i < rnd_size; ++i) {
+            auto rnd_num = rnd_factory.get_random();
+
+            if (i % 2 == 0) {
+                ASSERT_EQ(id_factory.next(), runtime_factory.next());
+            } else {
+                id_factory.free_id(rnd_num);
+                runtime_factory.free_id(rnd_num);
+            }
+        }
+    }
+}
+
+// common tests
+
+kcommon_tests<kupid::kbtree_wide> test_kbtree_wide{"kupid::kbtree_wide"};
+
+TEST(TestKBTreeWide, SizeZero) {
+    test_kbtree_wide.test_size_zero();
+}
+
+TEST(TestKBTreeWide, SizeOne) {
+    test_kbtree_wide.test_size_one();
+}
+
+TEST(TestKBTreeWide, SizeTwo) {
+    test_kbtree_wide.test_size_two();
+}
+
+TEST(TestKBTreeWide, ClearUseHalf) {
+    test_kbtree_wide.test_clear_use_half();
+}
+
+TEST(TestKBTreeWide, SizeSmall) {
+    test_kbtree_wide.test_size_small();
+}
+
+TEST(TestKBTreeWide, SizeMedium) {
+    test_kbtree_wide.test_size_medium();
+}
+
+TEST(TestKBTreeWide, SizeLarge) {
+    test_kbtree_wide.test_size_large();
+}
+
+#ifdef TEST_XLARGE
+TEST(TestKBTreeWide, SizeXLarge) {
+    test_kbtree_wide.test_size_xlarge();
+}
+#endif
+
+TEST(TestKBTreeWide, RandomUnordered) {
+    test_kbtree_wide.test_random_unordered();
+}
+
+TEST(TestKBTreeWide, RandomOrdered) {
+    test_kbtree_wide.test_random_ordered();
+}
+
+TEST(TestKBTreeWide, Bulk) {
+    test_kbtree_wide.test_bulk();
+}
+
+TEST(TestKBTreeWide, Usage) {
+    test_kbtree_wide.test_usage();
+}
@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+#include <vector>
+#include "../../src/include/kgeneration.h"
+
+TEST(TestKGeneration, Handles) {
+    uint32_t size = 1000;
+
+    std::cout << "test kupid::kgeneration with size = " << size << '\n';
+
+    kupid::kgeneration<> id_factory{size};
+    std::vector<uint64_t> handles;
+
+    for (uint32_t i = 0; i < size; ++i) {
+        uint64_t handle = id_factory.next();
+        ASSERT_EQ(id_factory.get_id(handle), i);
+        ASSERT_EQ(id_factory.get_generation(handle), 1);
+        ASSERT_TRUE(id_factory.validate(handle));
+        handles.push_back(handle);
+    }
+
+    ASSERT_EQ(id_factory.next(), id_factory.no_handle);
+    ASSERT_EQ(id_factory.used_count(), size);
+
+    // a freed ID comes back with a new generation, the old handle stays stale
+    uint64_t old = handles[10];
+    ASSERT_TRUE(id_factory.free(old));
+    ASSERT_FALSE(id_factory.validate(old));
+    ASSERT_FALSE(id_factory.free(old));
+    ASSERT_FALSE(id_factory.is_using(10));
+    ASSERT_EQ(id_factory.get_handle(10), id_factory.no_handle);
+
+    uint64_t handle = id_factory.next();
+    ASSERT_EQ(id_factory.get_id(handle), 10);
+    ASSERT_EQ(id_factory.get_generation(handle), 3);
+    ASSERT_EQ(id_factory.get_handle(10), handle);
+    ASSERT_TRUE(id_factory.validate(handle));
+    ASSERT_FALSE(id_factory.validate(old));
+    ASSERT_FALSE(id_factory.free(old));
+    ASSERT_TRUE(id_factory.is_using(10));
+
+    // forged handles: an even generation, a generation past G, an ID past the size
+    ASSERT_FALSE(id_factory.validate(id_factory.no_handle));
+    ASSERT_FALSE(id_factory.validate((uint64_t{2} << 32) | 10));
+    ASSERT_FALSE(id_factory.validate((uint64_t{0x10003} << 32) | 10));
+    ASSERT_FALSE(id_factory.validate((uint64_t{1} << 32) | size));
+
+    id_factory.clear();
+    ASSERT_EQ(id_factory.used_count(), 0);
+    ASSERT_FALSE(id_factory.validate(handle));
+    ASSERT_FALSE(id_factory.validate(handles[0]));
+    ASSERT_EQ(id_factory.next(), (uint64_t{3} << 32) | 0);
+}
+
+TEST(TestKGeneration, Wraparound) {
+    uint32_t size = 10;
+
+    std::cout << "test kupid::kgeneration<uint8_t> with size = " << size << '\n';
+
+    kupid::kgeneration<uint8_t> id_factory{size};
+    uint64_t first = id_factory.next();
+
+    // 128 reuses of the ID later its generation is the one of the first handle again
+    ASSERT_TRUE(id_factory.free(first));
+
+    for (int i = 0; i < 127; ++i) {
+        uint64_t handle = id_factory.next();
+        ASSERT_FALSE(id_factory.validate(first));
+        ASSERT_TRUE(id_factory.free(handle));
+    }
+
+    ASSERT_EQ(id_factory.next(), first);
+    ASSERT_TRUE(id_factory.validate(first));
+}
@@ -0,0 +1,121 @@
+#include "gtest/gtest.h"
+#include <fstream>
+#include <cstdio>
+#include "../include/krandom.h"
+#include "../../src/include/kbtree.h"
+#include "../../src/include/kjournal.h"
+
+static std::string get_journal_path() {
+    return testing::TempDir() + "kupid_kjournal.log";
+}
+
+static void assert_same_state(kupid::kbtree& id_factory, kupid::kbtree& replayed) {
+    for (uint32_t id = 0; id < id_factory.size(); ++id) {
+        ASSERT_EQ(replayed.is_using(id), id_factory.is_using(id));
+    }
+
+    ASSERT_EQ(replayed.next(false), id_factory.next(false));
+    ASSERT_EQ(replayed.next_range(100, false), id_factory.next_range(100, false));
+}
+
+TEST(TestKJournal, Replay) {
+    uint32_t size = 100000;
+    std::string path = get_journal_path();
+
+    std::cout << "test kupid::kjournal with size = " << size << '\n';
+
+    std::remove(path.c_str());
+
+    kupid::kbtree id_factory{size};
+    kupid::krandom_int rnd_factory{size, kupid::krandom_int::seed_token};
+
+    // small batches: many hand-overs to the flusher
+    kupid::kjournal::options options;
+    options.batch_records = 100;
+    options.policy = kupid::kjournal::fsync_policy::interval;
+
+    {
+        kupid::kjournal journal{path.c_str(), options};
+        id_factory.attach(&journal);
+
+        std::vector<uint32_t> ids(500);
+
+        for (int round = 0; round < 3; ++round) {
+            for (uint32_t i = 0; i < 1000; ++i) {
+                id_factory.next();
+            }
+
+            for (uint32_t i = 0; i < 2000; ++i) {
+                id_factory.free_id(rnd_factory.get_random());
+                id_factory.use_id(rnd_factory.get_random());
+            }
+
+            ASSERT_EQ(id_factory.next_n(ids.size(), ids.data()), ids.size());
+            id_factory.next_range(30);
+            ASSERT_TRUE(id_factory.use_range(50000 + round * 1000, 700));
+            ASSERT_TRUE(id_factory.free_range(1000, 64 * 3 + 5));
+
+            if (round == 1) {
+                id_factory.clear();
+            }
+        }
+
+        journal.commit();
+        id_factory.attach(nullptr);
+    }
+
+    kupid::kbtree replayed{size};
+
+    ASSERT_GT(kupid::kjournal::replay(path.c_str(), replayed), 0);
+    assert_same_state(id_factory, replayed);
+
+    std::remove(path.c_str());
+}
+
+TEST(TestKJournal, ResetAndTornTail) {
+    uint32_t size = 10000;
+    std::string path = get_journal_path();
+
+    std::cout << "test kupid::kjournal reset with size = " << size << '\n';
+
+    std::remove(path.c_str());
+
+    // a missing log has no records
+    kupid::kbtree snapshot{size};
+    ASSERT_EQ(kupid::kjournal::replay(path.c_str(), snapshot), 0);
+
+    kupid::kbtree id_factory{size};
+
+    {
+        kupid::kjournal journal{path.c_str()};
+        id_factory.attach(&journal);
+
+        for (uint32_t i = 0; i < 100; ++i) {
+            id_factory.next();
+        }
+
+        // the snapshot holds the first 100 IDs, the log starts again
+        snapshot.use_range(0, 100);
+        journal.reset();
+
+        id_factory.free_id(7);
+        id_factory.use_range(200, 10);
+        id_factory.attach(nullptr);
+    }
+
+    // a range record without its length and half a record, as torn by a crash
+    {
+        std::ofstream file{path, std::ios::app | std::ios::binary};
+        uint64_t range = (uint64_t{2} << 62) | 500;
+        file.write(reinterpret_cast<const char*>(&range), sizeof(range));
+        file.write("\x01\x02\x03", 3);
+    }
+
+    ASSERT_EQ(kupid::kjournal::replay(path.c_str(), snapshot), 2);
+    assert_same_state(id_factory, snapshot);
+    ASSERT_FALSE(snapshot.is_using(500));
+
+    ASSERT_THROW((kupid::kjournal{"/nonexistent/kupid.log"}), std::system_error);
+
+    std::remove(path.c_str());
+}
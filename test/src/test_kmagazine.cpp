@@ -0,0 +1,278 @@
+#include "gtest/gtest.h"
+#include <thread>
+#include <algorithm>
+#include <random>
+#include <set>
+#include "../../src/include/kbtree_atomic.h"
+#include "../../src/include/kmagazine.h"
+
+using kmagazine = kupid::kmagazine<kupid::kbtree_atomic>;
+
+TEST(TestKMagazine, LowestInMagazine) {
+    uint32_t size = 1024;
+    uint32_t capacity = 8;
+
+    std::cout << "test kupid::kmagazine with size = " << size << " and capacity = " << capacity << '\n';
+
+    kupid::kbtree_atomic shared{size};
+    kmagazine magazine{shared, capacity};
+
+    // a batch of capacity / 2 is claimed from the shared factory
+    ASSERT_EQ(magazine.next(false), 0);
+    ASSERT_EQ(magazine.count(), capacity / 2);
+    ASSERT_TRUE(shared.is_using(capacity / 2 - 1));
+    ASSERT_FALSE(shared.is_using(capacity / 2));
+
+    for (uint32_t i = 0; i < 2 * capacity; ++i) {
+        ASSERT_EQ(magazine.next(), i);
+    }
+
+    ASSERT_TRUE(magazine.free_id(7));
+    ASSERT_TRUE(magazine.free_id(3));
+    ASSERT_TRUE(magazine.free_id(5));
+
+    // freed IDs stay in the magazine, still used in the shared factory
+    ASSERT_TRUE(shared.is_using(3));
+
+    ASSERT_EQ(magazine.next(), 3);
+    ASSERT_EQ(magazine.next(), 5);
+    ASSERT_EQ(magazine.next(), 7);
+}
+
+TEST(TestKMagazine, Lifo) {
+    uint32_t size = 1024;
+    uint32_t capacity = 8;
+
+    std::cout << "test kupid::kmagazine with size = " << size << " and capacity = " << capacity << '\n';
+
+    kupid::kbtree_atomic shared{size};
+    kmagazine magazine{shared, capacity, kmagazine::order::lifo};
+
+    for (uint32_t i = 0; i < capacity; ++i) {
+        ASSERT_EQ(magazine.next(), i);
+    }
+
+    magazine.free_id(3);
+    magazine.free_id(7);
+    magazine.free_id(5);
+
+    ASSERT_EQ(magazine.next(), 5);
+    ASSERT_EQ(magazine.next(), 7);
+    ASSERT_EQ(magazine.next(), 3);
+}
+
+TEST(TestKMagazine, DoubleFree) {
+    uint32_t size = 1024;
+    uint32_t capacity = 8;
+
+    std::cout << "test kupid::kmagazine double free with size = " << size << " and capacity = " << capacity << '\n';
+
+    kupid::kbtree_atomic shared{size};
+
+    for (auto ord : {kmagazine::order::lowest, kmagazine::order::lifo}) {
+        kmagazine magazine{shared, capacity, ord, true};
+
+        for (uint32_t i = 0; i < capacity; ++i) {
+            ASSERT_EQ(magazine.next(), i);
+        }
+
+        // a cached ID, checked: a free ID, and an ID cached by the magazine but never handed out
+        ASSERT_TRUE(magazine.free_id(3));
+        ASSERT_FALSE(magazine.free_id(3));
+        ASSERT_FALSE(magazine.free_id(100));
+        ASSERT_TRUE(magazine.is_cached(3));
+
+        int64_t first = magazine.next();
+        int64_t second = magazine.next();
+        ASSERT_EQ(first, 3);
+        ASSERT_NE(first, second);
+
+        ASSERT_FALSE(magazine.free_id(magazine.next(false)));
+
+        for (uint32_t i = 0; i < capacity; ++i) {
+            ASSERT_TRUE(magazine.free_id(i));
+        }
+
+        ASSERT_TRUE(magazine.free_id(second));
+    }
+
+    ASSERT_EQ(shared.next(false), 0);
+}
+
+TEST(TestKMagazine, DoubleFreeCached) {
+    uint32_t size = 1024;
+    uint32_t capacity = 64;
+
+    std::cout << "test kupid::kmagazine double free of cached IDs with size = " << size << '\n';
+
+    kupid::kbtree_atomic shared{size};
+    kmagazine magazine{shared, capacity, kmagazine::order::lifo};
+
+    for (uint32_t i = 0; i < 3 * capacity; ++i) {
+        ASSERT_EQ(magazine.next(), i);
+    }
+
+    // the magazine drains and refills, a cached ID is rejected without the shared factory
+    for (uint32_t i = 0; i < 3 * capacity; ++i) {
+        ASSERT_TRUE(magazine.free_id(i));
+        ASSERT_FALSE(magazine.free_id(i));
+        ASSERT_TRUE(magazine.is_cached(i));
+    }
+
+    std::set<int64_t> ids;
+
+    for (uint32_t i = 0; i < 3 * capacity; ++i) {
+        ASSERT_TRUE(ids.insert(magazine.next()).second);
+    }
+}
+
+TEST(TestKMagazine, IdSet) {
+    std::cout << "test kupid::kid_set of at most 100 IDs against std::set\n";
+
+    kupid::kid_set<uint32_t> cached{100};
+    std::set<uint32_t> expected;
+    std::mt19937 rnd_factory{787350};
+
+    for (int i = 0; i < 100000; ++i) {
+        uint32_t id = rnd_factory() % 300;
+
+        if (expected.size() < 100 && rnd_factory() % 2 == 0) {
+            ASSERT_EQ(cached.insert(id), expected.insert(id).second);
+        } else {
+            ASSERT_EQ(cached.erase(id), expected.erase(id) == 1);
+        }
+
+        ASSERT_EQ(cached.count(), expected.size());
+        ASSERT_EQ(cached.contains(id), expected.count(id) == 1);
+    }
+
+    for (uint32_t id = 0; id < 300; ++id) {
+        ASSERT_EQ(cached.contains(id), expected.count(id) == 1);
+    }
+
+    cached.clear();
+    ASSERT_EQ(cached.count(), 0);
+    ASSERT_FALSE(cached.contains(*expected.begin()));
+}
+
+TEST(TestKMagazine, DrainAndFlush) {
+    uint32_t size = 1024;
+    uint32_t capacity = 8;
+
+    std::cout << "test kupid::kmagazine with size = " << size << " and capacity = " << capacity << '\n';
+
+    kupid::kbtree_atomic shared{size};
+
+    {
+        kmagazine magazine{shared, capacity};
+
+        for (uint32_t i = 0; i < 2 * capacity; ++i) {
+            magazine.next();
+        }
+
+        for (uint32_t i = 0; i < 2 * capacity; ++i) {
+            magazine.free_id(i);
+            ASSERT_LE(magazine.count(), capacity);
+        }
+
+        // the highest IDs were given back first
+        ASSERT_FALSE(shared.is_using(2 * capacity));
+        ASSERT_FALSE(shared.is_using(capacity));
+        ASSERT_TRUE(shared.is_using(2 * capacity - 1));
+        ASSERT_TRUE(shared.is_using(0));
+    }
+
+    // the destructor gives back the rest
+    for (uint32_t i = 0; i < 2 * capacity; ++i) {
+        ASSERT_FALSE(shared.is_using(i));
+    }
+
+    ASSERT_EQ(shared.next(false), 0);
+}
+
+TEST(TestKMagazine, CapacityZero) {
+    uint32_t size = 2;
+
+    std::cout << "test kupid::kmagazine with size = " << size << " and capacity = 0\n";
+
+    kupid::kbtree_atomic shared{size};
+    kmagazine magazine{shared, 0};
+
+    ASSERT_EQ(magazine.next(), 0);
+    ASSERT_TRUE(shared.is_using(0));
+    ASSERT_EQ(magazine.next(), 1);
+    ASSERT_EQ(magazine.next(), -1);
+
+    ASSERT_TRUE(magazine.free_id(0));
+    ASSERT_FALSE(shared.is_using(0));
+    ASSERT_FALSE(magazine.free_id(size));
+}
+
+TEST(TestKMagazine, Exhausted) {
+    uint32_t size = 10;
+
+    std::cout << "test kupid::kmagazine with size = " << size << '\n';
+
+    kupid::kbtree_atomic shared{size};
+    kmagazine magazine{shared, 8};
+
+    for (uint32_t i = 0; i < size; ++i) {
+        ASSERT_EQ(magazine.next(), i);
+    }
+
+    ASSERT_EQ(magazine.next(), -1);
+    ASSERT_FALSE(magazine.free_id(size));
+}
+
+TEST(TestKMagazine, ThreadsUnique) {
+    uint32_t size = 64 * 1024;
+    uint32_t thread_size = 4;
+    // leave room for the IDs cached by the magazines
+    uint32_t per_thread = size / thread_size / 2;
+
+    std::cout << "test kupid::kmagazine with size = " << size << " and " << thread_size << " threads\n";
+
+    kupid::kbtree_atomic shared{size};
+    std::vector<std::vector<int64_t>> ids(thread_size);
+    std::vector<std::thread> threads;
+
+    for (uint32_t t = 0; t < thread_size; ++t) {
+        threads.emplace_back([&shared, &ids, t, per_thread] {
+            kmagazine magazine{shared, 16};
+
+            for (uint32_t i = 0; i < per_thread; ++i) {
+                ids[t].push_back(magazine.next());
+
+                if (i % 2 == 0) {
+                    magazine.free_id(ids[t].back());
+                    ids[t].back() = magazine.next();
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<int64_t> all;
+
+    for (const auto& v : ids) {
+        all.insert(all.end(), v.begin(), v.end());
+    }
+
+    std::sort(all.begin(), all.end());
+
+    ASSERT_EQ(all.size(), per_thread * thread_size);
+    ASSERT_GE(all.front(), 0);
+    ASSERT_EQ(std::adjacent_find(all.begin(), all.end()), all.end());
+
+    // the magazines gave back their cached IDs: only the handed out ones are used
+    uint32_t used = 0;
+
+    for (uint32_t i = 0; i < size; ++i) {
+        used += shared.is_using(i) ? 1 : 0;
+    }
+
+    ASSERT_EQ(used, all.size());
+}
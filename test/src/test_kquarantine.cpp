@@ -0,0 +1,202 @@
+#include "gtest/gtest.h"
+#include <thread>
+#include <chrono>
+#include "../../src/include/kbtree.h"
+#include "../../src/include/kquarantine.h"
+
+using kquarantine = kupid::kquarantine<uint32_t>;
+
+TEST(TestKQuarantine, Operations) {
+    uint32_t size = 1024;
+    uint32_t capacity = 256;
+    uint64_t delay = 100;
+
+    std::cout << "test kupid::kquarantine with size = " << size << ", capacity = " << capacity
+              << " and delay = " << delay << " operations\n";
+
+    kupid::kbtree tree{size};
+    kquarantine quarantine{tree, capacity, delay};
+
+    for (uint32_t i = 0; i < 10; ++i) {
+        ASSERT_EQ(quarantine.next(), i);
+    }
+
+    // a freed ID is still used in the tree, the next ID is a new one
+    ASSERT_TRUE(quarantine.free_id(3));
+    ASSERT_FALSE(quarantine.free_id(3));
+    ASSERT_FALSE(quarantine.free_id(20));
+    ASSERT_FALSE(quarantine.free_id(size));
+    ASSERT_TRUE(tree.is_using(3));
+    ASSERT_TRUE(quarantine.is_held(3));
+    ASSERT_EQ(quarantine.count(), 1);
+    ASSERT_EQ(quarantine.next(), 10);
+
+    // the free_id() call was operation 11, it is given back on operation 11 + delay
+    for (uint32_t i = 0; i < delay - 2; ++i) {
+        ASSERT_EQ(quarantine.next(), 11 + i);
+    }
+
+    ASSERT_TRUE(tree.is_using(3));
+    ASSERT_EQ(quarantine.next(false), 3);
+    ASSERT_FALSE(quarantine.is_held(3));
+    ASSERT_EQ(quarantine.count(), 0);
+    ASSERT_EQ(tree.used_count(), 10 + delay - 2);
+
+    // given back it is free, handed out again it can be held again
+    ASSERT_FALSE(quarantine.free_id(3));
+    ASSERT_EQ(quarantine.next(), 3);
+    ASSERT_TRUE(quarantine.free_id(3));
+    ASSERT_FALSE(quarantine.free_id(3));
+    ASSERT_EQ(quarantine.count(), 1);
+}
+
+TEST(TestKQuarantine, Resized) {
+    uint32_t size = 100;
+
+    std::cout << "test kupid::kquarantine of a resized tree with size = " << size << '\n';
+
+    kupid::kbtree tree{size};
+    kquarantine quarantine{tree, 64, 1000};
+
+    ASSERT_TRUE(tree.use_range(0, size));
+    ASSERT_TRUE(quarantine.free_id(50));
+
+    // an ID past the old size is held as well
+    ASSERT_TRUE(tree.resize(10000));
+    ASSERT_TRUE(tree.use_id(9000));
+    ASSERT_TRUE(quarantine.free_id(9000));
+    ASSERT_FALSE(quarantine.free_id(9000));
+    ASSERT_FALSE(quarantine.free_id(50));
+    ASSERT_TRUE(quarantine.is_held(50));
+    ASSERT_EQ(quarantine.count(), 2);
+
+    quarantine.flush();
+    ASSERT_FALSE(tree.is_using(9000));
+    ASSERT_FALSE(quarantine.is_held(9000));
+}
+
+TEST(TestKQuarantine, Batches) {
+    uint32_t size = 4096;
+    uint32_t capacity = 100;
+    uint64_t delay = 1000;
+
+    std::cout << "test kupid::kquarantine with size = " << size << ", capacity = " << capacity
+              << " and delay = " << delay << " operations\n";
+
+    kupid::kbtree tree{size};
+    kquarantine quarantine{tree, capacity, delay};
+
+    // rounded up to whole batches
+    ASSERT_EQ(quarantine.capacity(), 128);
+
+    ASSERT_TRUE(tree.use_range(0, size));
+
+    // a full ring gives back its oldest batch, the IDs of a data word at once
+    for (uint32_t i = 0; i < quarantine.capacity(); ++i) {
+        ASSERT_TRUE(quarantine.free_id(size - 1 - 7 * i));
+    }
+
+    ASSERT_EQ(tree.used_count(), size);
+    ASSERT_TRUE(quarantine.free_id(1));
+    ASSERT_EQ(quarantine.count(), kquarantine::batch_ids + 1);
+    ASSERT_EQ(tree.used_count(), size - kquarantine::batch_ids);
+
+    for (uint32_t i = 0; i < quarantine.capacity(); ++i) {
+        ASSERT_EQ(tree.is_using(size - 1 - 7 * i), i >= kquarantine::batch_ids);
+    }
+
+    ASSERT_EQ(tree.next(false), size - 1 - 7 * (kquarantine::batch_ids - 1));
+
+    quarantine.flush();
+    ASSERT_EQ(quarantine.count(), 0);
+    ASSERT_EQ(tree.used_count(), size - quarantine.capacity() - 1);
+    ASSERT_EQ(tree.next(false), 1);
+
+    // the summaries agree with a tree freed an ID at a time
+    kupid::kbtree expected{size};
+    ASSERT_TRUE(expected.use_range(0, size));
+
+    for (uint32_t i = 0; i < quarantine.capacity(); ++i) {
+        expected.free_id(size - 1 - 7 * i);
+    }
+
+    expected.free_id(1);
+
+    for (uint32_t hint = 0; hint < size; hint += 61) {
+        ASSERT_EQ(tree.find_free(hint), expected.find_free(hint));
+        ASSERT_EQ(tree.find_used(hint), expected.find_used(hint));
+    }
+
+    ASSERT_EQ(tree.rank_free(size), expected.rank_free(size));
+}
+
+TEST(TestKQuarantine, Time) {
+    uint32_t size = 1024;
+    uint64_t delay = 20'000'000;
+
+    std::cout << "test kupid::kquarantine with size = " << size << " and delay = " << delay << " ns\n";
+
+    kupid::kbtree tree{size};
+    kquarantine quarantine{tree, 64, delay, kquarantine::clock::time};
+
+    ASSERT_EQ(quarantine.next(), 0);
+    ASSERT_EQ(quarantine.next(), 1);
+    ASSERT_TRUE(quarantine.free_id(0));
+    ASSERT_EQ(quarantine.next(), 2);
+
+    std::this_thread::sleep_for(std::chrono::nanoseconds(2 * delay));
+
+    ASSERT_EQ(quarantine.next(), 0);
+    ASSERT_EQ(quarantine.count(), 0);
+}
+
+TEST(TestKQuarantine, Disabled) {
+    uint32_t size = 1024;
+
+    std::cout << "test kupid::kquarantine with size = " << size << " and capacity = 0\n";
+
+    kupid::kbtree tree{size};
+
+    {
+        kquarantine quarantine{tree, 0};
+
+        ASSERT_EQ(quarantine.next(), 0);
+        ASSERT_TRUE(quarantine.free_id(0));
+        ASSERT_EQ(quarantine.count(), 0);
+        ASSERT_EQ(quarantine.next(), 0);
+        ASSERT_EQ(quarantine.next(), 1);
+        ASSERT_TRUE(quarantine.free_id(1));
+    }
+
+    // held IDs are given back on destruction
+    {
+        kquarantine quarantine{tree};
+
+        ASSERT_TRUE(quarantine.free_id(0));
+        ASSERT_TRUE(tree.is_using(0));
+    }
+
+    ASSERT_EQ(tree.used_count(), 0);
+}
+
+TEST(TestKQuarantine, BTree64) {
+    uint64_t size = 300000;
+
+    std::cout << "test kupid::kquarantine<uint64_t> with size = " << size << '\n';
+
+    kupid::kbtree64 tree{size};
+    kupid::kquarantine<uint64_t> quarantine{tree, 64, 10};
+
+    ASSERT_TRUE(tree.use_range(0, size));
+
+    for (uint64_t id = 0; id < 64; ++id) {
+        ASSERT_TRUE(quarantine.free_id(size - 1 - id));
+    }
+
+    for (uint64_t i = 0; i < 9; ++i) {
+        ASSERT_EQ(quarantine.next(), -1);
+    }
+
+    ASSERT_EQ(quarantine.next(), size - 64);
+    ASSERT_EQ(tree.used_count(), size - 63);
+}
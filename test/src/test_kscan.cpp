@@ -0,0 +1,122 @@
+#include "gtest/gtest.h"
+#include <vector>
+#include "../include/krandom.h"
+#include "../../src/include/kscan.h"
+
+static const std::vector<kupid::kscan::kernel> kernels = {
+    kupid::kscan::kernel::scalar,
+    kupid::kscan::kernel::avx2,
+    kupid::kscan::kernel::avx512
+};
+
+TEST(TestKScan, EveryPosition) {
+    std::cout << "test kupid::kscan with the best kernel = " << static_cast<int>(kupid::kscan::get_kernel()) << '\n';
+
+    kupid::kscan::kernel best = kupid::kscan::get_kernel();
+
+    for (auto k : kernels) {
+        if (!kupid::kscan::set_kernel(k)) {
+            std::cout << "kernel " << static_cast<int>(k) << " not supported\n";
+            continue;
+        }
+
+        // every length up to 20 words, the first zero bit at every position
+        for (size_t count = 1; count <= 20; ++count) {
+            std::vector<uint64_t> words(count, ~uint64_t{0});
+            size_t bits = count * 64;
+
+            ASSERT_EQ(kupid::kscan::find_first_zero(words.data(), bits), -1);
+
+            for (size_t bit = 0; bit < bits; bit += 7) {
+                words[bit / 64] &= ~(uint64_t{1} << (bit % 64));
+                ASSERT_EQ(kupid::kscan::find_first_zero(words.data(), bits), static_cast<int64_t>(bit));
+                words[bit / 64] = ~uint64_t{0};
+            }
+        }
+    }
+
+    ASSERT_TRUE(kupid::kscan::set_kernel(best));
+}
+
+TEST(TestKScan, TailIgnored) {
+    std::vector<uint64_t> words(10, ~uint64_t{0});
+
+    std::cout << "test kupid::kscan with bits past the last one\n";
+
+    kupid::kscan::kernel best = kupid::kscan::get_kernel();
+
+    for (auto k : kernels) {
+        if (!kupid::kscan::set_kernel(k)) {
+            continue;
+        }
+
+        words.back() = uint64_t{1} << 40;
+        ASSERT_EQ(kupid::kscan::find_first_zero(words.data(), 9 * 64 + 1), 9 * 64);
+        ASSERT_EQ(kupid::kscan::find_first_zero(words.data(), 9 * 64 + 40), 9 * 64);
+
+        words.back() = ~uint64_t{0} >> 1;
+        ASSERT_EQ(kupid::kscan::find_first_zero(words.data(), 9 * 64 + 63), -1);
+        ASSERT_EQ(kupid::kscan::find_first_zero(words.data(), 10 * 64), 10 * 64 - 1);
+        ASSERT_EQ(kupid::kscan::find_first_zero(words.data(), 0), -1);
+    }
+
+    ASSERT_TRUE(kupid::kscan::set_kernel(best));
+}
+
+TEST(TestKScan, RandomAsScalar) {
+    size_t count = 1000;
+    int rnd_size = 1000;
+
+    std::cout << "test kupid::kscan kernels vs. the scalar kernel with " << count << " words\n";
+
+    std::vector<uint64_t> words(count, ~uint64_t{0});
+    kupid::krandom_int rnd_factory{static_cast<uint32_t>(count * 64)};
+    kupid::kscan::kernel best = kupid::kscan::get_kernel();
+
+    for (int i = 0; i < rnd_size; ++i) {
+        // a single free bit, maybe past the last one
+        uint32_t bit = rnd_factory.get_random();
+        size_t bits = count * 64 - i;
+
+        words[bit / 64] &= ~(uint64_t{1} << (bit % 64));
+
+        int64_t expected = bit < bits ? static_cast<int64_t>(bit) : -1;
+
+        for (auto k : kernels) {
+            if (kupid::kscan::set_kernel(k)) {
+                ASSERT_EQ(kupid::kscan::find_first_zero(words.data(), bits), expected);
+            }
+        }
+
+        words[bit / 64] = ~uint64_t{0};
+    }
+
+    ASSERT_TRUE(kupid::kscan::set_kernel(best));
+}
+
+TEST(TestKScan, SelectBit) {
+    int rnd_size = 10000;
+
+    std::cout << "test kupid::kscan select of the k-th set bit with " << rnd_size << " random words\n";
+
+    std::mt19937_64 rnd_factory{787350};
+
+    for (int i = 0; i < rnd_size; ++i) {
+        // sparse and dense words
+        uint64_t bits = rnd_factory();
+        bits = i % 3 == 0 ? bits & rnd_factory() & rnd_factory() : i % 3 == 1 ? bits | rnd_factory() : bits;
+
+        uint32_t k = 0;
+
+        for (uint32_t pos = 0; pos < 64; ++pos) {
+            if ((bits >> pos) & 1) {
+                ASSERT_EQ(kupid::kscan::select_bit_scalar(bits, k), pos);
+                ASSERT_EQ(kupid::kscan::select_bit(bits, k), pos);
+                ++k;
+            }
+        }
+    }
+
+    ASSERT_EQ(kupid::kscan::select_bit(~uint64_t{0}, 63), 63U);
+    ASSERT_EQ(kupid::kscan::select_bit(uint64_t{1} << 63, 0), 63U);
+}
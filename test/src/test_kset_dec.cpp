@@ -45,3 +45,11 @@ TEST(TestKSetDec, RandomUnordered) {
 TEST(TestKSetDec, RandomOrdered) {
     test_kset_dec.test_random_ordered();
 }
+
+TEST(TestKSetDec, Bulk) {
+    test_kset_dec.test_bulk();
+}
+
+TEST(TestKSetDec, Usage) {
+    test_kset_dec.test_usage();
+}
@@ -45,3 +45,11 @@ TEST(TestKSetInc, RandomUnordered) {
 TEST(TestKSetInc, RandomOrdered) {
     test_kset_inc.test_random_ordered();
 }
+
+TEST(TestKSetInc, Bulk) {
+    test_kset_inc.test_bulk();
+}
+
+TEST(TestKSetInc, Usage) {
+    test_kset_inc.test_usage();
+}
@@ -0,0 +1,112 @@
+#include "gtest/gtest.h"
+#include <thread>
+#include <algorithm>
+#include "../../src/include/kshard.h"
+
+TEST(TestKShard, Layout) {
+    std::cout << "test kupid::kshard layout\n";
+
+    kupid::kshard<> id_factory{10, 4};
+    ASSERT_EQ(id_factory.shard_count(), 4);
+    ASSERT_EQ(id_factory.shard_size(), 3);
+
+    // no shard without an ID
+    kupid::kshard<> small{9, 4};
+    ASSERT_EQ(small.shard_count(), 3);
+
+    kupid::kshard<> tiny{3, 8};
+    ASSERT_EQ(tiny.shard_count(), 3);
+
+    kupid::kshard<> empty{0, 8};
+    ASSERT_EQ(empty.shard_count(), 1);
+    ASSERT_FALSE(empty.has_free());
+    ASSERT_EQ(empty.next(), -1);
+    ASSERT_FALSE(empty.use_id(0));
+}
+
+TEST(TestKShard, Steal) {
+    uint32_t size = 10000;
+
+    std::cout << "test kupid::kshard with size = " << size << '\n';
+
+    kupid::kshard<> id_factory{size, 4};
+    std::vector<int64_t> ids;
+
+    // the home shard first, then the others until all are exhausted
+    int64_t id;
+    while ((id = id_factory.next()) >= 0) {
+        ids.push_back(id);
+    }
+
+    std::sort(ids.begin(), ids.end());
+    ASSERT_EQ(ids.size(), size);
+
+    for (uint32_t i = 0; i < size; ++i) {
+        ASSERT_EQ(ids[i], i);
+        ASSERT_TRUE(id_factory.is_using(i));
+    }
+
+    ASSERT_FALSE(id_factory.has_free());
+
+    // a free ID in any shard is found
+    for (uint32_t i : {0U, 2500U, 9999U}) {
+        ASSERT_TRUE(id_factory.free_id(i));
+        ASSERT_TRUE(id_factory.has_free());
+        ASSERT_EQ(id_factory.next(), i);
+    }
+
+    ASSERT_FALSE(id_factory.free_id(size));
+    ASSERT_FALSE(id_factory.is_using(size));
+
+    id_factory.clear();
+    ASSERT_TRUE(id_factory.has_free());
+    ASSERT_FALSE(id_factory.is_using(0));
+}
+
+TEST(TestKShard, ThreadsUnique) {
+    uint32_t size = 64 * 1024;
+    uint32_t thread_size = 4;
+    uint32_t per_thread = size / thread_size;
+
+    std::cout << "test kupid::kshard with size = " << size << " and " << thread_size << " threads\n";
+
+    kupid::kshard<> id_factory{size, thread_size};
+    std::vector<std::vector<int64_t>> ids(thread_size);
+    std::vector<std::thread> threads;
+
+    for (uint32_t t = 0; t < thread_size; ++t) {
+        threads.emplace_back([&id_factory, &ids, t, per_thread] {
+            for (uint32_t i = 0; i < per_thread; ++i) {
+                ids[t].push_back(id_factory.next());
+
+                // churn: give back every other ID and take one again
+                if (i % 2 == 0) {
+                    id_factory.free_id(ids[t].back());
+                    ids[t].back() = id_factory.next();
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<int64_t> all;
+
+    for (const auto& v : ids) {
+        all.insert(all.end(), v.begin(), v.end());
+    }
+
+    std::sort(all.begin(), all.end());
+
+    // every ID handed out exactly once
+    ASSERT_EQ(all.size(), size);
+
+    for (uint32_t i = 0; i < size; ++i) {
+        ASSERT_EQ(all[i], i);
+    }
+
+    ASSERT_FALSE(id_factory.has_free());
+    ASSERT_EQ(id_factory.next(), -1);
+}
@@ -0,0 +1,127 @@
+#include "gtest/gtest.h"
+#include "../include/kcommon_tests.h"
+#include "../../src/include/kbtree.h"
+#include "../../src/include/kveb.h"
+
+TEST(TestKVEB, Successor) {
+    uint32_t size = 64 * 64 * 64 + 10;
+
+    std::cout << "test kupid::kveb successor with size = " << size << '\n';
+
+    kupid::kveb id_factory{size};
+
+    for (uint32_t i = 0; i < size; ++i) {
+        id_factory.use_id(i);
+    }
+
+    ASSERT_EQ(id_factory.successor(0), -1);
+
+    ASSERT_TRUE(id_factory.free_id(5));
+    ASSERT_TRUE(id_factory.free_id(70000));
+    ASSERT_TRUE(id_factory.free_id(size - 1));
+
+    ASSERT_EQ(id_factory.successor(0), 5);
+    ASSERT_EQ(id_factory.successor(5), 70000);
+    ASSERT_EQ(id_factory.successor(69999), 70000);
+    ASSERT_EQ(id_factory.successor(70000), size - 1);
+    ASSERT_EQ(id_factory.successor(size - 1), -1);
+    ASSERT_EQ(id_factory.successor(UINT32_MAX), -1);
+
+    ASSERT_EQ(id_factory.next(), 5);
+    ASSERT_EQ(id_factory.next(), 70000);
+    ASSERT_EQ(id_factory.next(), size - 1);
+    ASSERT_EQ(id_factory.next(), -1);
+}
+
+TEST(TestKVEB, RandomAsKBTree) {
+    uint32_t size = 1000000;
+    int rnd_size = 200000;
+
+    std::cout << "test kupid::kveb vs. kupid::kbtree with size = " << size << '\n';
+
+    kupid::kveb id_factory{size};
+    kupid::kbtree kbtree_factory{size};
+    kupid::krandom_int rnd_factory{size, kupid::krandom_int::seed_token};
+
+    for (int i = 0; i < rnd_size; ++i) {
+        auto rnd_num = rnd_factory.get_random();
+
+        switch (i % 4) {
+            case 0:
+                ASSERT_EQ(id_factory.next(), kbtree_factory.next());
+                break;
+            case 1:
+                id_factory.use_id(rnd_num);
+                kbtree_factory.use_id(rnd_num);
+                break;
+            case 2:
+                id_factory.free_id(rnd_num);
+                kbtree_factory.free_id(rnd_num);
+                break;
+            default:
+                ASSERT_EQ(id_factory.is_using(rnd_num), kbtree_factory.is_using(rnd_num));
+                break;
+        }
+    }
+
+    // the free IDs in order through successor()
+    for (int64_t id = id_factory.next(false); id >= 0; id = id_factory.successor(id)) {
+        ASSERT_EQ(id, kbtree_factory.next());
+    }
+
+    ASSERT_EQ(kbtree_factory.next(), -1);
+}
+
+// common tests
+
+kcommon_tests<kupid::kveb> test_kveb{"kupid::kveb"};
+
+TEST(TestKVEB, SizeZero) {
+    test_kveb.test_size_zero();
+}
+
+TEST(TestKVEB, SizeOne) {
+    test_kveb.test_size_one();
+}
+
+TEST(TestKVEB, SizeTwo) {
+    test_kveb.test_size_two();
+}
+
+TEST(TestKVEB, ClearUseHalf) {
+    test_kveb.test_clear_use_half();
+}
+
+TEST(TestKVEB, SizeSmall) {
+    test_kveb.test_size_small();
+}
+
+TEST(TestKVEB, SizeMedium) {
+    test_kveb.test_size_medium();
+}
+
+TEST(TestKVEB, SizeLarge) {
+    test_kveb.test_size_large();
+}
+
+#ifdef TEST_XLARGE
+TEST(TestKVEB, SizeXLarge) {
+    test_kveb.test_size_xlarge();
+}
+#endif
+
+TEST(TestKVEB, RandomUnordered) {
+    test_kveb.test_random_unordered();
+}
+
+TEST(TestKVEB, RandomOrdered) {
+    test_kveb.test_random_ordered();
+}
+
+TEST(TestKVEB, Bulk) {
+    test_kveb.test_bulk();
+}
+
+TEST(TestKVEB, Usage) {
+    test_kveb.test_usage();
+}
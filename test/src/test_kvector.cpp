@@ -45,3 +45,11 @@ TEST(TestKVector, RandomUnordered) {
 TEST(TestKVector, RandomOrdered) {
     test_kvector.test_random_ordered();
 }
+
+TEST(TestKVector, Bulk) {
+    test_kvector.test_bulk();
+}
+
+TEST(TestKVector, Usage) {
+    test_kvector.test_usage();
+}